@@ -10,12 +10,62 @@ See the file COPYING for details.
 #include "xxmalloc.h"
 #include "path.h"
 #include "hash_table.h"
+#include "full_io.h"
+#include "macros.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <dirent.h>
 
-struct hash_table *check_sums = NULL;
+/* Checksums of regular files are only valid while the file keeps the size,
+ * modification and change times, and inode it had when it was read. */
+struct batch_file_checksum {
+	char hash[SHA1_DIGEST_LENGTH * 2 + 1];
+	int64_t size;
+	int64_t mtime;  /* in nanoseconds */
+	int64_t ctime;  /* in nanoseconds */
+	int64_t inode;
+};
+
+/* File times in nanoseconds, where the platform reports them. */
+#if defined(CCTOOLS_OPSYS_DARWIN)
+#define BATCH_FILE_TIME_NS(ts) ((int64_t) (ts).tv_sec * 1000000000 + (ts).tv_nsec)
+#define BATCH_FILE_MTIME_NS(info) BATCH_FILE_TIME_NS((info)->st_mtimespec)
+#define BATCH_FILE_CTIME_NS(info) BATCH_FILE_TIME_NS((info)->st_ctimespec)
+#elif defined(CCTOOLS_OPSYS_LINUX)
+#define BATCH_FILE_TIME_NS(ts) ((int64_t) (ts).tv_sec * 1000000000 + (ts).tv_nsec)
+#define BATCH_FILE_MTIME_NS(info) BATCH_FILE_TIME_NS((info)->st_mtim)
+#define BATCH_FILE_CTIME_NS(info) BATCH_FILE_TIME_NS((info)->st_ctim)
+#else
+#define BATCH_FILE_MTIME_NS(info) ((int64_t) (info)->st_mtime * 1000000000)
+#define BATCH_FILE_CTIME_NS(info) ((int64_t) (info)->st_ctime * 1000000000)
+#endif
+
+/* A file changed this recently may change again without its times moving,
+ * on filesystems with coarse timestamps, so its checksum is not kept. */
+#define BATCH_FILE_CHECKSUM_SETTLE_TIME 1
+
+/* A worker hashing files for batch_file_generate_ids sends one of these per file. */
+struct batch_file_hash_result {
+	int index;
+	int ok;
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+};
+
+/* Files are hashed in parallel only when there is at least this much to read. */
+#define BATCH_FILE_HASH_MIN_PARALLEL_BYTES (64*1024*1024)
+
+static struct hash_table *check_sums = NULL;     /* Absolute path of a file to struct batch_file_checksum. */
+static struct hash_table *dir_check_sums = NULL; /* Directory name to its checksum string. */
+static FILE *checksum_index = NULL;
 double total_checksum_time = 0.0;
 
 /**
@@ -107,14 +157,169 @@ int batch_file_outer_compare(const void *file1, const void *file2) {
 	return strcmp((*f1)->outer_name, (*f2)->outer_name);
 }
 
+/* Checksums are kept by absolute path, so that an index may be shared by workflows run from different directories. */
+static char *batch_file_checksum_key(const char *path)
+{
+	if(path[0] == '/')
+		return xxstrdup(path);
+
+	char *cwd = path_getcwd();
+	char *key = string_format("%s/%s", cwd, path);
+	free(cwd);
+
+	return key;
+}
+
+static struct batch_file_checksum *batch_file_checksum_lookup(const char *key, const struct stat *info)
+{
+	struct batch_file_checksum *c;
+
+	if(!check_sums)
+		return NULL;
+
+	c = hash_table_lookup(check_sums, key);
+	if(c && c->size == (int64_t) info->st_size && c->mtime == BATCH_FILE_MTIME_NS(info) && c->ctime == BATCH_FILE_CTIME_NS(info) && c->inode == (int64_t) info->st_ino)
+		return c;
+
+	return NULL;
+}
+
+static void batch_file_checksum_insert(const char *key, const char *hash, int64_t size, int64_t mtime, int64_t ctime, int64_t inode)
+{
+	struct batch_file_checksum *c;
+
+	if(!check_sums)
+		check_sums = hash_table_create(0, 0);
+
+	c = hash_table_lookup(check_sums, key);
+	if(!c) {
+		c = xxmalloc(sizeof(*c));
+		hash_table_insert(check_sums, key, c);
+	}
+
+	strncpy(c->hash, hash, sizeof(c->hash) - 1);
+	c->hash[sizeof(c->hash) - 1] = 0;
+	c->size = size;
+	c->mtime = mtime;
+	c->ctime = ctime;
+	c->inode = inode;
+}
+
+/* Remember the checksum of a file, and record it in the index if one is open.
+ * info must be the status of the file from before it was read. */
+static void batch_file_checksum_store(const char *key, const struct stat *info, const char *hash)
+{
+	if(time(0) - info->st_mtime <= BATCH_FILE_CHECKSUM_SETTLE_TIME || time(0) - info->st_ctime <= BATCH_FILE_CHECKSUM_SETTLE_TIME) {
+		debug(D_MAKEFLOW, "not keeping the checksum of recently modified file %s", key);
+		return;
+	}
+
+	batch_file_checksum_insert(key, hash, info->st_size, BATCH_FILE_MTIME_NS(info), BATCH_FILE_CTIME_NS(info), info->st_ino);
+
+	if(checksum_index && !strchr(key, '\n')) {
+		fprintf(checksum_index, "%s %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %s\n", hash, (int64_t) info->st_size, BATCH_FILE_MTIME_NS(info), BATCH_FILE_CTIME_NS(info), (int64_t) info->st_ino, key);
+		fflush(checksum_index);
+	}
+}
+
+/* Rewrite the index with one record per file, dropping superseded records. */
+static int batch_file_checksum_index_rewrite(const char *filename)
+{
+	char *tmpname = string_format("%s.tmp", filename);
+	FILE *file = fopen(tmpname, "w");
+	if(!file) {
+		free(tmpname);
+		return 0;
+	}
+
+	char *key;
+	struct batch_file_checksum *c;
+	hash_table_firstkey(check_sums);
+	while(hash_table_nextkey(check_sums, &key, (void **) &c)) {
+		fprintf(file, "%s %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %s\n", c->hash, c->size, c->mtime, c->ctime, c->inode, key);
+	}
+
+	int ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	ok = ok && rename(tmpname, filename) == 0;
+	if(!ok)
+		unlink(tmpname);
+
+	free(tmpname);
+	return ok;
+}
+
+int batch_file_checksum_index_open(const char *filename)
+{
+	char line[PATH_MAX + 128];
+	int records = 0;
+
+	batch_file_checksum_index_close();
+
+	if(!check_sums)
+		check_sums = hash_table_create(0, 0);
+
+	FILE *file = fopen(filename, "r");
+	if(file) {
+		while(fgets(line, sizeof(line), file)) {
+			char hash[SHA1_DIGEST_LENGTH * 2 + 1];
+			int64_t size, mtime, ctime, inode;
+			int n = 0;
+
+			size_t len = strlen(line);
+			if(len < 1 || line[len - 1] != '\n')
+				continue;
+			line[len - 1] = 0;
+
+			/* Records from before times were kept in nanoseconds have one number less, and are skipped. */
+			if(sscanf(line, "%40s %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %n", hash, &size, &mtime, &ctime, &inode, &n) != 5 || n < 1 || strlen(hash) != SHA1_DIGEST_LENGTH * 2)
+				continue;
+
+			batch_file_checksum_insert(line + n, hash, size, mtime, ctime, inode);
+			records++;
+		}
+		fclose(file);
+	}
+
+	debug(D_MAKEFLOW, "loaded %d checksum records for %d files from %s", records, hash_table_size(check_sums), filename);
+
+	/* Records are appended as files change, so compact the index once most of it is stale. */
+	if(records > 1000 && records > 2 * hash_table_size(check_sums)) {
+		if(!batch_file_checksum_index_rewrite(filename))
+			debug(D_MAKEFLOW, "could not compact checksum index %s: %s", filename, strerror(errno));
+	}
+
+	checksum_index = fopen(filename, "a");
+	if(!checksum_index) {
+		debug(D_MAKEFLOW, "could not open checksum index %s: %s", filename, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+void batch_file_checksum_index_close()
+{
+	if(checksum_index) {
+		fclose(checksum_index);
+		checksum_index = NULL;
+	}
+}
+
 /* Return the content based ID for a file.
- * generates the checksum of a file's contents if does not exist */
+ * generates the checksum of a file's contents if does not exist,
+ * or if the file has changed since it was computed. */
 char * batch_file_generate_id(struct batch_file *f) {
-	if(check_sums == NULL){
-		check_sums = hash_table_create(0,0);
-		}
-	char *check_sum_value = hash_table_lookup(check_sums, f->outer_name);
-	if(check_sum_value == NULL){
+	struct stat info;
+
+	if(stat(f->outer_name, &info) < 0) {
+		debug(D_MAKEFLOW, "Unable to checksum this file: %s", f->outer_name);
+		return NULL;
+	}
+
+	char *key = batch_file_checksum_key(f->outer_name);
+	struct batch_file_checksum *c = batch_file_checksum_lookup(key, &info);
+	if(c == NULL){
 		unsigned char hash[SHA1_DIGEST_LENGTH];
 		struct timeval start_time;
 			struct timeval end_time;
@@ -127,15 +332,129 @@ char * batch_file_generate_id(struct batch_file *f) {
 			debug(D_MAKEFLOW_HOOK," The total checksum time is %lf",total_checksum_time);
 		if(success == 0){
 			debug(D_MAKEFLOW, "Unable to checksum this file: %s", f->outer_name);
+			free(key);
 			return NULL;
 		}
 		f->hash = xxstrdup(sha1_string(hash));
-		hash_table_insert(check_sums, f->outer_name, xxstrdup(sha1_string(hash)));
+		batch_file_checksum_store(key, &info, f->hash);
 		debug(D_MAKEFLOW,"Checksum hash of %s is: %s",f->outer_name,f->hash);
+		free(key);
 		return xxstrdup(f->hash);
 	}
-	debug(D_MAKEFLOW,"Checksum already exists in hash table. Cached CHECKSUM hash of %s is: %s", f->outer_name, check_sum_value);
-	return xxstrdup(check_sum_value);
+	debug(D_MAKEFLOW,"Checksum already exists in hash table. Cached CHECKSUM hash of %s is: %s", f->outer_name, c->hash);
+	free(key);
+	return xxstrdup(c->hash);
+}
+
+void batch_file_generate_ids(struct list *files, int workers)
+{
+	struct batch_file *f;
+	int i, n = 0;
+	int64_t total = 0;
+
+	int count = list_size(files);
+	if(workers < 2 || count < 2)
+		return;
+
+	char **keys = xxmalloc(count * sizeof(*keys));
+	const char **paths = xxmalloc(count * sizeof(*paths));
+	struct stat *infos = xxmalloc(count * sizeof(*infos));
+
+	/* Only the regular files without a valid checksum are hashed. */
+	struct list_cursor *cur = list_cursor_create(files);
+	for(list_seek(cur, 0); list_get(cur, (void **) &f); list_next(cur)) {
+		if(stat(f->outer_name, &infos[n]) < 0 || !S_ISREG(infos[n].st_mode))
+			continue;
+
+		char *key = batch_file_checksum_key(f->outer_name);
+		if(batch_file_checksum_lookup(key, &infos[n])) {
+			free(key);
+			continue;
+		}
+
+		keys[n] = key;
+		paths[n] = f->outer_name;
+		total += infos[n].st_size;
+		n++;
+	}
+	list_cursor_destroy(cur);
+
+	workers = MIN(workers, n);
+
+	int fds[2];
+	if(workers < 2 || total < BATCH_FILE_HASH_MIN_PARALLEL_BYTES || pipe(fds) < 0) {
+		/* Not worth the processes: batch_file_generate_id will hash them one by one. */
+		for(i = 0; i < n; i++)
+			free(keys[i]);
+		free(keys);
+		free(paths);
+		free(infos);
+		return;
+	}
+
+	debug(D_MAKEFLOW, "hashing %d files (%" PRId64 " bytes) with %d processes", n, total, workers);
+
+	struct timeval start_time;
+	struct timeval end_time;
+	gettimeofday(&start_time, NULL);
+
+	/*
+	Each worker hashes every workers-th file, and sends one record per file
+	over a single pipe.  The records are smaller than PIPE_BUF, so the writes
+	of different workers are never interleaved.
+	*/
+
+	pid_t *pids = xxmalloc(workers * sizeof(*pids));
+	int started;
+
+	for(started = 0; started < workers; started++) {
+		pid_t pid = fork();
+		if(pid == 0) {
+			close(fds[0]);
+			for(i = started; i < n; i += workers) {
+				struct batch_file_hash_result r;
+				memset(&r, 0, sizeof(r));
+				r.index = i;
+				r.ok = sha1_file(paths[i], r.digest);
+				if(full_write(fds[1], &r, sizeof(r)) != sizeof(r))
+					_exit(1);
+			}
+			_exit(0);
+		} else if(pid < 0) {
+			debug(D_MAKEFLOW, "couldn't create hashing worker: %s", strerror(errno));
+			break;
+		}
+		pids[started] = pid;
+	}
+
+	close(fds[1]);
+
+	struct batch_file_hash_result r;
+	while(full_read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+		if(r.index < 0 || r.index >= n || !r.ok)
+			continue;
+		batch_file_checksum_store(keys[r.index], &infos[r.index], sha1_string(r.digest));
+	}
+
+	close(fds[0]);
+
+	for(i = 0; i < started; i++) {
+		while(waitpid(pids[i], NULL, 0) < 0 && errno == EINTR) {
+		}
+	}
+
+	gettimeofday(&end_time, NULL);
+	total_checksum_time += ((end_time.tv_sec*1000000 + end_time.tv_usec) - (start_time.tv_sec*1000000 + start_time.tv_usec)) / 1000000.0;
+	debug(D_MAKEFLOW_HOOK," The total checksum time is %lf",total_checksum_time);
+
+	/* Files that no worker reported are hashed by batch_file_generate_id when needed. */
+
+	for(i = 0; i < n; i++)
+		free(keys[i]);
+	free(keys);
+	free(paths);
+	free(infos);
+	free(pids);
 }
 
 
@@ -143,10 +462,10 @@ char * batch_file_generate_id(struct batch_file *f) {
  * generates the checksum for the directories contents if does not exist
  * 		*NEED TO ACCOUNT FOR SYMLINKS LATER*  */
 char *  batch_file_generate_id_dir(char *file_name){
-	if(check_sums == NULL){
-		check_sums = hash_table_create(0,0);
+	if(dir_check_sums == NULL){
+		dir_check_sums = hash_table_create(0,0);
 	}
-	char *check_sum_value = hash_table_lookup(check_sums, file_name);
+	char *check_sum_value = hash_table_lookup(dir_check_sums, file_name);
 	if(check_sum_value == NULL){
 		char *hash_sum = "";
 		struct dirent **dp;
@@ -192,7 +511,7 @@ char *  batch_file_generate_id_dir(char *file_name){
 			unsigned char hash[SHA1_DIGEST_LENGTH];
 			sha1_buffer(hash_sum, strlen(hash_sum), hash);
 			free(hash_sum);
-			hash_table_insert(check_sums, file_name, xxstrdup(sha1_string(hash)));
+			hash_table_insert(dir_check_sums, file_name, xxstrdup(sha1_string(hash)));
 			debug(D_MAKEFLOW,"Checksum hash of %s is: %s",file_name,sha1_string(hash));
 			return xxstrdup(sha1_string(hash));
 		}
@@ -73,4 +73,26 @@ char * batch_file_generate_id(struct batch_file *f);
 */
 char *  batch_file_generate_id_dir(char *file_name);
 
+/** Compute the checksums of several files at once.
+Files that are not regular or already have a valid checksum are skipped.
+The results are cached, so that later calls to @ref batch_file_generate_id
+for these files do not read them again.  Files are hashed by up to
+the given number of processes, and only when there is enough data to read.
+@param files A list of batch_file structs.
+@param workers The largest number of processes to use.
+*/
+void batch_file_generate_ids(struct list *files, int workers);
+
+/** Load and keep checksums in a persistent index.
+Checksums recorded in the index are reused as long as the size,
+modification time, and inode of the file are unchanged, and new
+checksums are appended to the index as they are computed.
+@param filename The path of the index, created if it does not exist.
+@return One on success, zero if the index could not be opened for writing.
+*/
+int batch_file_checksum_index_open(const char *filename);
+
+/** Stop recording checksums in the persistent index. */
+void batch_file_checksum_index_close();
+
 #endif
@@ -9,14 +9,19 @@ See the file COPYING for details.
 #include "batch_job_internal.h"
 
 #include "debug.h"
+#include "full_io.h"
 #include "itable.h"
+#include "macros.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
 #include <sys/stat.h>
+#include <sys/wait.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 extern const struct batch_queue_module batch_queue_amazon;
 extern const struct batch_queue_module batch_queue_lambda;
@@ -107,6 +112,7 @@ struct batch_queue *batch_queue_create(batch_queue_type_t type)
 	batch_queue_set_feature(q, "output_directories", "yes");
 	batch_queue_set_feature(q, "batch_log_name", "%s.batchlog");
 	batch_queue_set_feature(q, "gc_size", "yes");
+	batch_queue_set_feature(q, "parallel_fs_stat", "yes");
 
 	q->module = NULL;
 	for (i = 0; batch_queue_modules[i]->type != BATCH_QUEUE_TYPE_UNKNOWN; i++)
@@ -265,6 +271,26 @@ batch_job_id_t batch_job_wait_timeout(struct batch_queue * q, struct batch_job_i
 	return q->module->job.wait(q, info, stoptime);
 }
 
+int batch_job_wait_all(struct batch_queue *q, batch_job_complete_t complete, void *arg, time_t stoptime)
+{
+	struct batch_job_info info;
+	int count = 0;
+
+	while(1) {
+		memset(&info, 0, sizeof(info));
+
+		/* Only the first wait may block. */
+		batch_job_id_t jobid = batch_job_wait_timeout(q, &info, count > 0 ? time(0) : stoptime);
+		if(jobid <= 0)
+			break;
+
+		complete(q, jobid, &info, arg);
+		count++;
+	}
+
+	return count;
+}
+
 int batch_job_remove(struct batch_queue *q, batch_job_id_t jobid)
 {
 	return q->module->job.remove(q, jobid);
@@ -306,4 +332,94 @@ int batch_fs_unlink (struct batch_queue *q, const char *path)
 	return q->module->fs.unlink(q, path);
 }
 
+/*
+Each stat worker is not worth a process unless it examines at least this many files.
+*/
+
+#define BATCH_FS_STAT_MIN_PER_WORKER 256
+
+struct batch_fs_stat_result {
+	int index;
+	int result;
+	struct stat buf;
+};
+
+void batch_fs_stat_many (struct batch_queue *q, const char **paths, struct stat *bufs, int *results, int n, int workers)
+{
+	int i;
+
+	if(!batch_queue_supports_feature(q, "parallel_fs_stat"))
+		workers = 1;
+
+	workers = MIN(workers, n / BATCH_FS_STAT_MIN_PER_WORKER);
+
+	int fds[2];
+	if(workers < 2 || pipe(fds) < 0) {
+		for(i = 0; i < n; i++) {
+			results[i] = batch_fs_stat(q, paths[i], &bufs[i]);
+		}
+		return;
+	}
+
+	debug(D_BATCH, "examining %d files with %d processes", n, workers);
+
+	/*
+	Each worker examines every workers-th path, and sends one record per path
+	over a single pipe.  The records are smaller than PIPE_BUF, so the writes
+	of different workers are never interleaved.
+	*/
+
+	int *done = xxcalloc(n, sizeof(*done));
+	pid_t *pids = xxmalloc(workers * sizeof(*pids));
+	int started;
+
+	for(started = 0; started < workers; started++) {
+		pid_t pid = fork();
+		if(pid == 0) {
+			close(fds[0]);
+			for(i = started; i < n; i += workers) {
+				struct batch_fs_stat_result r;
+				memset(&r, 0, sizeof(r));
+				r.index = i;
+				r.result = batch_fs_stat(q, paths[i], &r.buf);
+				if(full_write(fds[1], &r, sizeof(r)) != sizeof(r))
+					_exit(1);
+			}
+			_exit(0);
+		} else if(pid < 0) {
+			debug(D_BATCH, "couldn't create stat worker: %s", strerror(errno));
+			break;
+		}
+		pids[started] = pid;
+	}
+
+	close(fds[1]);
+
+	struct batch_fs_stat_result r;
+	while(full_read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+		if(r.index < 0 || r.index >= n)
+			continue;
+		results[r.index] = r.result;
+		bufs[r.index] = r.buf;
+		done[r.index] = 1;
+	}
+
+	close(fds[0]);
+
+	for(i = 0; i < started; i++) {
+		while(waitpid(pids[i], NULL, 0) < 0 && errno == EINTR) {
+		}
+	}
+
+	/* Anything a worker did not report, because it failed or was never started, is examined here. */
+	for(i = 0; i < n; i++) {
+		if(!done[i]) {
+			results[i] = batch_fs_stat(q, paths[i], &bufs[i]);
+		}
+	}
+
+	free(pids);
+	free(done);
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -118,6 +118,26 @@ If less than zero, the operation timed out or was interrupted by a system event,
 */
 batch_job_id_t batch_job_wait_timeout(struct batch_queue *q, struct batch_job_info *info, time_t stoptime);
 
+/** Function called by @ref batch_job_wait_all for each completed job.
+@param q The queue the job was submitted to.
+@param jobid The jobid of the completed job.
+@param info The details of the completed job.
+@param arg The argument given to @ref batch_job_wait_all.
+*/
+typedef void (*batch_job_complete_t)(struct batch_queue *q, batch_job_id_t jobid, struct batch_job_info *info, void *arg);
+
+/** Wait for batch jobs to complete, collecting all the jobs already complete.
+Blocks until a batch job completes or the current time exceeds stoptime, as @ref batch_job_wait_timeout.
+Once a job has completed, keeps collecting without blocking every other job that has completed,
+so that a burst of completions can be handled at once.
+@param q The queue to wait on.
+@param complete Function called once for each completed job.
+@param arg An argument passed to each call of complete.
+@param stoptime An absolute time at which to stop waiting for the first job.
+@return The number of completed jobs passed to complete.
+*/
+int batch_job_wait_all(struct batch_queue *q, batch_job_complete_t complete, void *arg, time_t stoptime);
+
 /** Remove a batch job.
 This call will start the removal process.
 You must still call @ref batch_job_wait to wait for the removal to complete.
@@ -135,6 +155,20 @@ int batch_fs_rename (struct batch_queue *q, const char *lpath, const char *rpath
 int batch_fs_stat (struct batch_queue *q, const char *path, struct stat *buf);
 int batch_fs_unlink (struct batch_queue *q, const char *path);
 
+/** Get the status of many files at once.
+Equivalent to calling @ref batch_fs_stat on each path in turn.
+If the queue supports the feature "parallel_fs_stat", the paths are split
+among several processes that examine them concurrently, which hides the
+latency of each stat on network and parallel filesystems.
+@param q The batch queue.
+@param paths An array of n paths to examine.
+@param bufs An array of n stat buffers, filled for each path that was found.
+@param results An array of n results, each set to the value @ref batch_fs_stat would return for the path.
+@param n The number of paths.
+@param workers The maximum number of concurrent processes. If less than two, the paths are examined serially.
+*/
+void batch_fs_stat_many (struct batch_queue *q, const char **paths, struct stat *bufs, int *results, int n, int workers);
+
 /** Converts a string into a batch queue type.
 @param str A string listing all of the known batch queue types (which changes over time.)
 @return The batch queue type corresponding to the string, or BATCH_QUEUE_TYPE_UNKNOWN if the string is invalid.
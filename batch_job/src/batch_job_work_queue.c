@@ -97,6 +97,11 @@ static batch_job_id_t batch_job_wq_submit (struct batch_queue * q, const char *c
 		work_queue_task_specify_resources(t, resources);
 	}
 
+	const char *priority = hash_table_lookup(q->options, "task-priority");
+	if(priority) {
+		work_queue_task_specify_priority(t, atof(priority));
+	}
+
 	work_queue_submit(q->data, t);
 
 	return t->taskid;
@@ -33,6 +33,7 @@ See the file COPYING for details.
 
 struct deltadb {
 	struct hash_table *table;
+	struct jx_arena *arena;
 	const char *logdir;
 	FILE *logfile;
 	int epoch_mode;
@@ -109,8 +110,14 @@ static int checkpoint_read( struct deltadb *db, const char *filename )
 	FILE * file = fopen(filename,"r");
 	if(!file) return 0;
 
-	/* Load the entire checkpoint into one json object */
+	/*
+	Load the entire checkpoint into one json object.  It is allocated in
+	one arena, since most of it lives as long as the query.
+	*/
+	if(!db->arena) db->arena = jx_arena_create();
+	jx_arena_enter(db->arena);
 	struct jx *jcheckpoint = jx_parse_stream(file);
+	jx_arena_leave(db->arena);
 
 	fclose(file);
 
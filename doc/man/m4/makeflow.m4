@@ -50,6 +50,7 @@ OPTIONS_BEGIN
 OPTION_ITEM(`-a, --advertise')Advertise the master information to a catalog server.
 OPTION_TRIPLET(-l, makeflow-log, logfile)Use this file for the makeflow log. (default is X.makeflowlog)
 OPTION_TRIPLET(-L, batch-log, logfile)Use this file for the batch system log. (default is X.PARAM(type)log)
+OPTION_PAIR(--log-checkpoint, seconds)Checkpoint the state of the workflow next to the makeflow log every PARAM(seconds), so that a restart replays only the rest of the log. 0 disables checkpoints. (default is 300)
 OPTION_TRIPLET(-m, email, email)Email summary of workflow to address.
 OPTION_TRIPLET(-j, max-local, #)Max number of local jobs to run at once. (default is # of cores)
 OPTION_TRIPLET(-J, max-remote, #)Max number of remote jobs to run at once. (default is 1000 for -Twq, 100 otherwise)
@@ -182,6 +183,7 @@ OPTION_PAIR(--archive-dir,path)Specify archive base directory.
 OPTION_PAIR(--archive-read,path)Only check to see if jobs have been cached and use outputs if it has been
 OPTION_PAIR(--archive-s3,s3_bucket)Base S3 Bucket name
 OPTION_PAIR(--archive-s3-no-check,s3_bucket)Blind upload files to S3 bucket (No existence check in bucket).
+OPTION_PAIR(--archive-hash-workers,n)Checksum the files of a job with up to n processes (by default 4). Checksums are kept in the archive directory and reused while files are unchanged.
 OPTION_PAIR(--s3-hostname, s3_hostname)Base S3 hostname. Used for AWS S3.
 OPTION_PAIR(--s3-keyid, s3_key_id)Access Key for cloud server. Used for AWS S3.
 OPTION_PAIR(--s3-secretkey, secret_key)Secret Key for cloud server. Used for AWS S3.
@@ -209,6 +211,7 @@ OPTION_ITEM(`--enforcement')Use Parrot to restrict access to the given inputs/ou
 OPTION_PAIR(--parrot-path,path)Path to parrot_run executable on the host system.
 OPTION_PAIR(--env-replace-path,path)Path to env_replace executable on the host system.
 OPTION_ITEM(`--skip-file-check')Do not check for file existence before running.
+OPTION_PAIR(--file-check-workers, n)Check for file existence with up to PARAM(n) concurrent processes. (default is 8)
 OPTION_ITEM(`--do-not-save-failed-output')Disable saving failed nodes to directory for later analysis.
 OPTION_PAIR(--shared-fs,dir)Assume the given directory is a shared filesystem accessible at all execution sites.
 OPTION_TRIPLET(-X, change-directory, dir)Change to <dir> prior to executing the workflow.
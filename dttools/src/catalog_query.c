@@ -12,6 +12,7 @@ See the file COPYING for details.
 #include "http_query.h"
 #include "jx.h"
 #include "jx_parse.h"
+#include "jx_print.h"
 #include "jx_eval.h"
 #include "xxmalloc.h"
 #include "stringtools.h"
@@ -24,6 +25,8 @@ See the file COPYING for details.
 #include "address.h"
 #include "zlib.h"
 #include "macros.h"
+#include "buffer.h"
+#include "b64.h"
 
 struct catalog_query {
 	struct jx *data;
@@ -34,6 +37,7 @@ struct catalog_query {
 struct catalog_host {
 	char *host;
 	char *url;
+	char *filter_url;
 	int down;
 };
 
@@ -69,10 +73,30 @@ struct jx *catalog_query_send_query(const char *url, time_t stoptime) {
 		return NULL;
 	}
 
-	struct jx *j = jx_parse_link(link,stoptime);
+	/*
+	Read the whole response before parsing, so that a server which does not
+	understand the query, and sends back an HTML page, is detected quietly.
+	*/
+	buffer_t buf;
+	char chunk[65536];
+	ssize_t length;
+
+	buffer_init(&buf);
+	while((length = link_read(link, chunk, sizeof(chunk), stoptime)) > 0) {
+		buffer_putlstring(&buf, chunk, length);
+	}
 
 	link_close(link);
 
+	const char *text = buffer_tolstring(&buf, NULL);
+	text += strspn(text, " \t\r\n");
+
+	struct jx *j = NULL;
+	if(text[0] == '[') {
+		j = jx_parse_string(text);
+	}
+	buffer_free(&buf);
+
 	if(!j) {
 		debug(D_DEBUG,"query result failed to parse as JSON");
 		return NULL;
@@ -87,7 +111,28 @@ struct jx *catalog_query_send_query(const char *url, time_t stoptime) {
 	return j;
 }
 
-struct list *catalog_query_sort_hostlist(const char *hosts) {
+/*
+Encode a filter expression so that the server can apply it, and send back
+only the matching records.  Returns null if the expression cannot be encoded.
+*/
+
+static char *catalog_query_encode_filter(struct jx *filter_expr)
+{
+	char *text = jx_print_string(filter_expr);
+	char *encoded = NULL;
+	buffer_t buf;
+
+	buffer_init(&buf);
+	if(b64_encode(text, strlen(text), &buf) == 0) {
+		encoded = xxstrdup(buffer_tolstring(&buf, NULL));
+	}
+	buffer_free(&buf);
+	free(text);
+
+	return encoded;
+}
+
+struct list *catalog_query_sort_hostlist(const char *hosts, const char *filter) {
 	const char *next_host;
 	char *n;
 	struct catalog_host *h;
@@ -112,6 +157,13 @@ struct list *catalog_query_sort_hostlist(const char *hosts) {
 
 		h->host = xxstrdup(host);
 		h->url = string_format("http://%s:%d/query.json", host, port);
+		h->filter_url = filter ? string_format("http://%s:%d/query/%s", host, port, filter) : NULL;
+		if(h->filter_url && strlen(h->filter_url) + strlen("GET  HTTP/1.1\r\n") > CATALOG_QUERY_LINE_MAX) {
+			/* The server would refuse the request, so filter all records here instead. */
+			debug(D_DEBUG, "filter is too long to send to %s", host);
+			free(h->filter_url);
+			h->filter_url = NULL;
+		}
 		h->down = 0;
 
 		set_first_element(down_hosts);
@@ -135,7 +187,8 @@ struct catalog_query *catalog_query_create(const char *hosts, struct jx *filter_
 	struct catalog_query *q = NULL;
 	char *n;
 	struct catalog_host *h;
-	struct list *sorted_hosts = catalog_query_sort_hostlist(hosts);
+	char *filter = filter_expr ? catalog_query_encode_filter(filter_expr) : NULL;
+	struct list *sorted_hosts = catalog_query_sort_hostlist(hosts, filter);
 
 	int backoff_interval = 1;
 
@@ -150,7 +203,18 @@ struct catalog_query *catalog_query_create(const char *hosts, struct jx *filter_
 
 			continue;
 		}
-		struct jx *j = catalog_query_send_query(h->url, time(NULL) + 5);
+		/*
+		Prefer to have the server apply the filter.  Older servers do not
+		understand filtered queries, so fall back to fetching everything.
+		The filter is applied again as results are read, in either case.
+		*/
+		struct jx *j = NULL;
+		if(h->filter_url) {
+			j = catalog_query_send_query(h->filter_url, time(NULL) + 5);
+		}
+		if(!j) {
+			j = catalog_query_send_query(h->url, time(NULL) + 5);
+		}
 
 		if(j) {
 			q = xxmalloc(sizeof(*q));
@@ -182,9 +246,11 @@ struct catalog_query *catalog_query_create(const char *hosts, struct jx *filter_
 	while((h = list_next_item(sorted_hosts))) {
 		free(h->host);
 		free(h->url);
+		free(h->filter_url);
 		free(h);
 	}
 	list_delete(sorted_hosts);
+	free(filter);
 	return q;
 }
 
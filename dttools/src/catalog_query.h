@@ -17,6 +17,9 @@ Query the global catalog server for server descriptions.
 #define CATALOG_HOST_DEFAULT "catalog.cse.nd.edu,backup-catalog.cse.nd.edu"
 #define CATALOG_PORT_DEFAULT 9097
 
+/* Longest request line that every catalog server accepts.  Filters that would make longer requests are applied by the client. */
+#define CATALOG_QUERY_LINE_MAX 1024
+
 #define CATALOG_HOST (getenv("CATALOG_HOST") ? getenv("CATALOG_HOST") : CATALOG_HOST_DEFAULT )
 #define CATALOG_PORT (getenv("CATALOG_PORT") ? atoi(getenv("CATALOG_PORT")) : CATALOG_PORT_DEFAULT )
 
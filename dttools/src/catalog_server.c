@@ -14,6 +14,7 @@ See the file COPYING for details.
 #include "nvpair.h"
 #include "nvpair_jx.h"
 #include "jx_database.h"
+#include "jx_eval.h"
 #include "jx_parse.h"
 #include "jx_print.h"
 #include "jx_table.h"
@@ -22,6 +23,9 @@ See the file COPYING for details.
 #include "domain_name_cache.h"
 #include "username.h"
 #include "list.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "b64.h"
 #include "xxmalloc.h"
 #include "macros.h"
 #include "daemon.h"
@@ -37,13 +41,12 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <sys/resource.h>
 
 #ifndef LINE_MAX
 #define LINE_MAX 1024
 #endif
 
-#define MAX_TABLE_SIZE 10000
-
 /* Timeout in communicating with the querying client */
 #define HANDLE_QUERY_TIMEOUT 15
 
@@ -53,11 +56,55 @@ See the file COPYING for details.
 /* Maximum size of a JX record arriving via TCP is 1MB. */
 #define TCP_PAYLOAD_MAX 1024*1024
 
+/* Number of UDP updates to receive at once. */
+#define UDP_BATCH_SIZE 32
+
 /* The table of record, hashed on address:port */
 static struct jx_database *table = 0;
 
-/* An array of jxs used to sort for display */
-static struct jx *array[MAX_TABLE_SIZE];
+/* One record in the snapshot of the table used for display. */
+struct snapshot_entry {
+	char *key;
+	char *name;
+};
+
+/*
+The snapshot lists the keys of the table sorted by name.  Because the key
+of a record includes its name, the order only changes when records come or
+go, so the snapshot is only rebuilt then.  Each record is also kept rendered
+as JSON, and rendered again only after it is updated.  The snapshot is
+brought up to date just before a query is forked, so that query processes
+inherit it rather than sorting and printing the whole table themselves.
+*/
+static struct snapshot_entry *snapshot = 0;
+static int snapshot_size = 0;
+static int snapshot_capacity = 0;
+static int snapshot_valid = 0;
+
+/* JSON text of each record in the table, indexed by key. */
+static struct hash_table *rendered_records = 0;
+
+/* Keys of records updated since they were last rendered. */
+static struct hash_table *stale_records = 0;
+
+/*
+Updates are not applied to the table as soon as they arrive.  Instead, they
+wait in a queue for up to update_window seconds, and a newer update with the
+same key replaces the one waiting, since each update carries the complete
+state of its source.  The queue is then applied as a group, so that the
+history log is written out once rather than after every update.  The queue
+is also applied when it fills up, and before answering any query.
+*/
+static struct hash_table *pending_updates = 0;
+
+/* Time when the oldest update in the queue arrived. */
+static time_t pending_since = 0;
+
+/* Maximum time an update waits in the queue. */
+static time_t update_window = 5;
+
+/* Maximum number of updates waiting in the queue. */
+static int update_queue_max = 10000;
 
 /* The time for which updated data lives before automatic deletion */
 static int lifetime = 1800;
@@ -137,20 +184,88 @@ static void install_handler(int sig, void (*handler) (int sig))
 	sigaction(sig, &s, 0);
 }
 
-int compare_jx(const void *a, const void *b)
+static int compare_snapshot_entry(const void *a, const void *b)
 {
-	struct jx **pa = (struct jx **) a;
-	struct jx **pb = (struct jx **) b;
+	const struct snapshot_entry *ea = a;
+	const struct snapshot_entry *eb = b;
+
+	int result = strcasecmp(ea->name, eb->name);
+	if(result) return result;
+
+	return strcmp(ea->key, eb->key);
+}
+
+static void snapshot_record_updated( const char *key, int is_new )
+{
+	free(hash_table_remove(rendered_records, key));
+	if(!hash_table_lookup(stale_records, key)) {
+		hash_table_insert(stale_records, key, (void *) 1);
+	}
+	if(is_new) snapshot_valid = 0;
+}
+
+static void snapshot_record_removed( const char *key )
+{
+	free(hash_table_remove(rendered_records, key));
+	hash_table_remove(stale_records, key);
+	snapshot_valid = 0;
+}
+
+static void snapshot_render( const char *key, struct jx *j )
+{
+	if(!hash_table_lookup(rendered_records, key)) {
+		hash_table_insert(rendered_records, key, jx_print_string(j));
+	}
+}
+
+/*
+Bring the snapshot up to date with the table.
+The cost is proportional to the records changed since the last call,
+except when records have come or gone and the order must be rebuilt.
+*/
+
+static void snapshot_refresh()
+{
+	char *key;
+	struct jx *j;
+	void *value;
+	int i;
+
+	hash_table_firstkey(stale_records);
+	while(hash_table_nextkey(stale_records, &key, &value)) {
+		j = jx_database_lookup(table, key);
+		if(j) snapshot_render(key, j);
+	}
+	hash_table_clear(stale_records);
+
+	if(snapshot_valid) return;
 
-	const char *sa = jx_lookup_string(*pa, "name");
-	const char *sb = jx_lookup_string(*pb, "name");
+	for(i = 0; i < snapshot_size; i++) {
+		free(snapshot[i].key);
+		free(snapshot[i].name);
+	}
+
+	snapshot_size = 0;
+
+	jx_database_firstkey(table);
+	while(jx_database_nextkey(table, &key, &j)) {
+		const char *name = jx_lookup_string(j, "name");
+		if(!name)
+			name = "unknown";
+
+		snapshot_render(key, j);
+		if(snapshot_size == snapshot_capacity) {
+			snapshot_capacity = snapshot_capacity ? snapshot_capacity * 2 : 1024;
+			snapshot = xxrealloc(snapshot, snapshot_capacity * sizeof(*snapshot));
+		}
+		snapshot[snapshot_size].key = xxstrdup(key);
+		snapshot[snapshot_size].name = xxstrdup(name);
+		snapshot_size++;
+	}
 
-	if(!sa)
-		sa = "unknown";
-	if(!sb)
-		sb = "unknown";
+	qsort(snapshot, snapshot_size, sizeof(*snapshot), compare_snapshot_entry);
 
-	return strcasecmp(sa, sb);
+	snapshot_valid = 1;
 }
 
 static void remove_expired_records()
@@ -169,6 +284,9 @@ static void remove_expired_records()
 
 	jx_database_firstkey(table);
 	while(jx_database_nextkey(table, &key, &j)) {
+		// A record with a newer update waiting in the queue has not expired.
+		if(hash_table_lookup(pending_updates,key)) continue;
+
 		time_t lastheardfrom = jx_lookup_integer(j,"lastheardfrom");
 
 		int this_lifetime = jx_lookup_integer(j,"lifetime");
@@ -179,6 +297,7 @@ static void remove_expired_records()
 		}
 
 		if( (current-lastheardfrom) > this_lifetime ) {
+				snapshot_record_removed(key);
 				j = jx_database_remove(table,key);
 			if(j) jx_delete(j);
 		}
@@ -207,6 +326,55 @@ static void update_all_catalogs()
 	free(text);
 }
 
+/* Apply all waiting updates to the table as one group. */
+
+static void updates_commit()
+{
+	char *key;
+	struct jx *j;
+
+	if(hash_table_size(pending_updates)==0) return;
+
+	jx_database_begin(table);
+
+	hash_table_firstkey(pending_updates);
+	while(hash_table_nextkey(pending_updates, &key, (void **) &j)) {
+		int is_new = !jx_database_lookup(table,key);
+
+		if(logfile && is_new) {
+			jx_print_stream(j,logfile);
+			fprintf(logfile,"\n");
+		}
+
+		jx_database_insert(table, key, j);
+		snapshot_record_updated(key, is_new);
+	}
+
+	jx_database_commit(table);
+	if(logfile) fflush(logfile);
+
+	debug(D_DEBUG, "applied %d updates", hash_table_size(pending_updates));
+
+	/* The objects now belong to the table. */
+	hash_table_clear(pending_updates);
+}
+
+static void updates_enqueue( const char *key, struct jx *j )
+{
+	struct jx *old = hash_table_remove(pending_updates, key);
+	if(old) {
+		jx_delete(old);
+	} else if(hash_table_size(pending_updates)==0) {
+		pending_since = time(0);
+	}
+
+	hash_table_insert(pending_updates, key, j);
+
+	if(hash_table_size(pending_updates) >= update_queue_max) {
+		updates_commit();
+	}
+}
+
 static void make_hash_key(struct jx *j, char *key)
 {
 	const char *name, *addr, *uuid;
@@ -321,37 +489,37 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 
 		make_hash_key(j, key);
 
-		if(logfile) {
-			if(!jx_database_lookup(table,key)) {
-				jx_print_stream(j,logfile);
-				fprintf(logfile,"\n");
-				fflush(logfile);
-			}
-		}
-
-		jx_database_insert(table, key, j);
+		updates_enqueue(key, j);
 
 		debug(D_DEBUG, "received %s update from %s",protocol,key);
 }
 
 /*
 Where possible, we prefer to accept short updates via UDP,
-because these can be accepted quickly in a non-blocking manner.
+because these can be accepted quickly in a non-blocking manner,
+and many of them can be received at once.
 */
 
 static void handle_udp_updates(struct datagram *update_port)
 {
-	char data[DATAGRAM_PAYLOAD_MAX];
-	char addr[DATAGRAM_ADDRESS_MAX];
-	int port;
+	static char data[UDP_BATCH_SIZE][DATAGRAM_PAYLOAD_MAX];
+	struct datagram_message messages[UDP_BATCH_SIZE];
+	int i;
+
+	for(i = 0; i < UDP_BATCH_SIZE; i++) {
+		messages[i].data = data[i];
+		messages[i].size = DATAGRAM_PAYLOAD_MAX - 1;
+	}
 
 	while(1) {
-		int result = datagram_recv(update_port, data, DATAGRAM_PAYLOAD_MAX, addr, &port, 0);
-		if(result <= 0)
+		int n = datagram_recv_batch(update_port, messages, UDP_BATCH_SIZE);
+		if(n <= 0)
 			return;
 
-		data[result] = 0;
-		handle_update(addr,port,data,result,"udp");
+		for(i = 0; i < n; i++) {
+			messages[i].data[messages[i].length] = 0;
+			handle_update(messages[i].addr,messages[i].port,messages[i].data,messages[i].length,"udp");
+		}
 	}
 }
 
@@ -396,6 +564,110 @@ static struct jx_table html_headers[] = {
 	{0,0,0,0,0}
 };
 
+static struct jx *snapshot_record( int i )
+{
+	return jx_database_lookup(table, snapshot[i].key);
+}
+
+static const char *snapshot_text( int i )
+{
+	return hash_table_lookup(rendered_records, snapshot[i].key);
+}
+
+static struct jx *decode_expression( const char *text )
+{
+	buffer_t buf;
+	struct jx *j = 0;
+
+	buffer_init(&buf);
+	if(b64_decode(text, &buf) == 0) {
+		j = jx_parse_string(buffer_tolstring(&buf, NULL));
+	}
+	buffer_free(&buf);
+
+	return j;
+}
+
+/*
+Send the records for which a filter expression is true, as a JSON array.
+The arguments have the form <filter> or <filter>?select=<projection>,
+where each is a JX expression encoded in base64.  If a projection is given,
+it is evaluated against each matching record, and the result is sent
+instead of the record.  If the arguments are invalid, nothing is sent,
+so that the client falls back to filtering the full table itself.
+Expressions are refused unless jx_eval_is_safe accepts them, since they
+come from unauthenticated clients.
+*/
+
+static void handle_filtered_query(FILE *stream, const char *args)
+{
+	char *filter_text = xxstrdup(args);
+	struct jx *select = 0;
+	int i, first = 1;
+
+	char *select_text = strstr(filter_text, "?select=");
+	if(select_text) {
+		*select_text = 0;
+		select_text += 8;
+		select = decode_expression(select_text);
+	}
+
+	struct jx *filter = decode_expression(filter_text);
+	free(filter_text);
+
+	if(!filter || (select_text && !select)) {
+		debug(D_DEBUG, "invalid query expression: %s", args);
+		jx_delete(filter);
+		jx_delete(select);
+		return;
+	}
+
+	if(!jx_eval_is_safe(filter) || (select && !jx_eval_is_safe(select))) {
+		debug(D_DEBUG, "refusing query expression with unsafe functions: %s", args);
+		jx_delete(filter);
+		jx_delete(select);
+		return;
+	}
+
+	fprintf(stream, "[\n");
+	for(i = 0; i < snapshot_size; i++) {
+		struct jx *j = snapshot_record(i);
+		struct jx *b = jx_eval(filter, j);
+		if(jx_istrue(b)) {
+			if(!first) fprintf(stream, ",\n");
+			if(select) {
+				struct jx *r = jx_eval(select, j);
+				jx_print_stream(r, stream);
+				jx_delete(r);
+			} else {
+				fputs(snapshot_text(i), stream);
+			}
+			first = 0;
+		}
+		jx_delete(b);
+	}
+	fprintf(stream, "\n]\n");
+
+	jx_delete(filter);
+	jx_delete(select);
+}
+
+/*
+Read one line of an HTTP request.  Returns 1 on success, 0 if the client
+went away or timed out, or -1 if the line does not fit in length bytes.
+*/
+
+static int read_query_line(struct link *query_link, char *line, size_t length)
+{
+	memset(line, 0, length);
+	if(link_readline(query_link, line, length, time(0) + HANDLE_QUERY_TIMEOUT)) {
+		return 1;
+	}
+
+	/* The line fills the whole buffer only if it was cut short. */
+	return strnlen(line, length) == length ? -1 : 0;
+}
+
 static void handle_query(struct link *query_link)
 {
 	FILE *stream;
@@ -410,14 +682,14 @@ static void handle_query(struct link *query_link)
 	int port;
 	time_t current;
 
-	char *hkey;
 	struct jx *j;
 	int i, n;
 
 	link_address_remote(query_link, addr, &port);
 	debug(D_DEBUG, "www query from %s:%d", addr, port);
 
-	if(link_readline(query_link, line, LINE_MAX, time(0) + HANDLE_QUERY_TIMEOUT)) {
+	int result = read_query_line(query_link, line, LINE_MAX);
+	if(result > 0) {
 		string_chomp(line);
 		if(sscanf(line, "%s %s %s", action, url, version) != 3) {
 			return;
@@ -425,15 +697,19 @@ static void handle_query(struct link *query_link)
 
 		// Consume the rest of the query
 		while(1) {
-			if(!link_readline(query_link, line, LINE_MAX, time(0) + HANDLE_QUERY_TIMEOUT)) {
-				return;
-			}
-
-			if(line[0] == 0) {
+			result = read_query_line(query_link, line, LINE_MAX);
+			if(result <= 0 || line[0] == 0) {
 				break;
 			}
 		}
-	} else {
+	}
+
+	if(result < 0) {
+		// Refuse rather than truncate, so that a filter is never cut short.
+		debug(D_DEBUG, "www query from %s:%d is longer than %d bytes", addr, port, LINE_MAX);
+		link_putliteral(query_link, "HTTP/1.1 414 URI Too Long\nConnection: close\n\n", time(0) + HANDLE_QUERY_TIMEOUT);
+		return;
+	} else if(result == 0) {
 		return;
 	}
 
@@ -457,45 +733,37 @@ static void handle_query(struct link *query_link)
 		strcpy(path, url);
 	}
 
-	/* load the hash table entries into one big array */
-
-	n = 0;
-	jx_database_firstkey(table);
-	while(jx_database_nextkey(table, &hkey, &j)) {
-		array[n] = j;
-		n++;
-	}
-
-	/* sort the array by name before displaying */
-
-	qsort(array, n, sizeof(struct jx *), compare_jx);
+	n = snapshot_size;
 
 	if(!strcmp(path, "/query.text")) {
 		fprintf(stream, "Content-type: text/plain\n\n");
 		for(i = 0; i < n; i++)
-			jx_export_nvpair(array[i], stream);
+			jx_export_nvpair(snapshot_record(i), stream);
 	} else if(!strcmp(path, "/query.json")) {
 		fprintf(stream, "Content-type: text/plain\n\n");
 		fprintf(stream,"[\n");
 		for(i = 0; i < n; i++) {
-			jx_print_stream(array[i],stream);
+			fputs(snapshot_text(i),stream);
 			if(i<(n-1)) fprintf(stream,",\n");
 		}
 		fprintf(stream,"\n]\n");
+	} else if(!strncmp(path, "/query/", 7)) {
+		fprintf(stream, "Content-type: text/plain\n\n");
+		handle_filtered_query(stream, &path[7]);
 	} else if(!strcmp(path, "/query.oldclassads")) {
 		fprintf(stream, "Content-type: text/plain\n\n");
 		for(i = 0; i < n; i++)
-			jx_export_old_classads(array[i], stream);
+			jx_export_old_classads(snapshot_record(i), stream);
 	} else if(!strcmp(path, "/query.newclassads")) {
 		fprintf(stream, "Content-type: text/plain\n\n");
 		for(i = 0; i < n; i++)
-			jx_export_new_classads(array[i], stream);
+			jx_export_new_classads(snapshot_record(i), stream);
 	} else if(!strcmp(path, "/query.xml")) {
 		fprintf(stream, "Content-type: text/xml\n\n");
 		fprintf(stream, "<?xml version=\"1.0\" standalone=\"yes\"?>\n");
 		fprintf(stream, "<catalog>\n");
 		for(i = 0; i < n; i++)
-			jx_export_xml(array[i], stream);
+			jx_export_xml(snapshot_record(i), stream);
 		fprintf(stream, "</catalog>\n");
 	} else if(sscanf(path, "/detail/%s", key) == 1) {
 		struct jx *j;
@@ -539,7 +807,7 @@ static void handle_query(struct link *query_link)
 		fprintf(stream, "<p>\n");
 
 		for(i = 0; i < n; i++) {
-			j = array[i];
+			j = snapshot_record(i);
 			sum_total += jx_lookup_integer(j, "total");
 			sum_avail += jx_lookup_integer(j, "avail");
 			sum_devices++;
@@ -551,9 +819,8 @@ static void handle_query(struct link *query_link)
 
 		jx_export_html_header(stream, html_headers);
 		for(i = 0; i < n; i++) {
-			j = array[i];
-			make_hash_key(j, key);
-			string_nformat(url, sizeof(url), "/detail/%s", key);
+			j = snapshot_record(i);
+			string_nformat(url, sizeof(url), "/detail/%s", snapshot[i].key);
 			jx_export_html_with_link(j, stream, html_headers, "name", url);
 		}
 		jx_export_html_footer(stream, html_headers);
@@ -738,6 +1005,10 @@ int main(int argc, char *argv[])
 	username_get(owner);
 	starttime = time(0);
 
+	rendered_records = hash_table_create(0, 0);
+	stale_records = hash_table_create(0, 0);
+	pending_updates = hash_table_create(0, 0);
+
 	table = jx_database_create(history_dir);
 	if(!table)
 		fatal("couldn't create directory %s: %s\n",history_dir,strerror(errno));
@@ -789,6 +1060,10 @@ int main(int argc, char *argv[])
 		int result, maxfd;
 		struct timeval timeout;
 
+		if(hash_table_size(pending_updates) && time(0) >= pending_since + update_window) {
+			updates_commit();
+		}
+
 		remove_expired_records();
 
 		if(time(0) > outgoing_alarm) {
@@ -818,6 +1093,10 @@ int main(int argc, char *argv[])
 		timeout.tv_sec = 5;
 		timeout.tv_usec = 0;
 
+		if(hash_table_size(pending_updates)) {
+			timeout.tv_sec = MAX(0, MIN(5, pending_since + update_window - time(0)));
+		}
+
 		result = select(maxfd, &rfds, 0, 0, &timeout);
 		if(result <= 0)
 			continue;
@@ -833,12 +1112,18 @@ int main(int argc, char *argv[])
 		if(FD_ISSET(lfd, &rfds)) {
 			link = link_accept(query_port, time(0) + 5);
 			if(link) {
+				updates_commit();
+				snapshot_refresh();
 				if(fork_mode) {
 					pid_t pid = fork();
 					if(pid == 0) {
 						link_address_remote(link, raddr, &rport);
 						change_process_title("catalog_server [%s]", raddr);
 						alarm(child_procs_timeout);
+						/* A query that keeps the processor busy is stopped even if it blocks the alarm. */
+						struct rlimit cpu_limit;
+						cpu_limit.rlim_cur = cpu_limit.rlim_max = child_procs_timeout;
+						setrlimit(RLIMIT_CPU, &cpu_limit);
 						handle_query(link);
 						_exit(0);
 					} else if (pid>0) {
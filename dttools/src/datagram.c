@@ -89,14 +89,23 @@ static int errno_is_temporary(int e)
 	}
 }
 
+/* The most datagrams taken by one call to datagram_recv_batch. */
+#define DATAGRAM_BATCH_MAX 64
+
+static void datagram_sender(struct sockaddr_storage *iaddr, SOCKLEN_T iaddr_length, char *addr, int *port)
+{
+	char port_string[16];
+
+	getnameinfo((struct sockaddr *)iaddr,iaddr_length,addr,DATAGRAM_ADDRESS_MAX,port_string,sizeof(port_string),NI_NUMERICHOST|NI_NUMERICSERV);
+
+	*port = atoi(port_string);
+}
+
 int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *port, int timeout)
 {
 	int result;
 	struct sockaddr_storage iaddr;
 	SOCKLEN_T iaddr_length;
-	SOCKLEN_T addr_length = DATAGRAM_ADDRESS_MAX;
-	char port_string[16];
-	SOCKLEN_T port_string_length = 16;
 	fd_set fds;
 	struct timeval tm;
 
@@ -125,13 +134,60 @@ int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *p
 	if(result < 0)
 		return result;
 
-	getnameinfo((struct sockaddr *)&iaddr,iaddr_length,addr,addr_length,port_string,port_string_length,NI_NUMERICHOST|NI_NUMERICSERV);
-
-	*port = atoi(port_string);
+	datagram_sender(&iaddr,iaddr_length,addr,port);
 
 	return result;
 }
 
+int datagram_recv_batch(struct datagram *d, struct datagram_message *messages, int count)
+{
+	struct sockaddr_storage iaddr[DATAGRAM_BATCH_MAX];
+	int n;
+
+	if(count > DATAGRAM_BATCH_MAX)
+		count = DATAGRAM_BATCH_MAX;
+
+#ifdef HAS_RECVMMSG
+	struct mmsghdr headers[DATAGRAM_BATCH_MAX];
+	struct iovec iov[DATAGRAM_BATCH_MAX];
+	int i;
+
+	memset(headers, 0, count * sizeof(*headers));
+
+	for(i = 0; i < count; i++) {
+		iov[i].iov_base = messages[i].data;
+		iov[i].iov_len = messages[i].size;
+		headers[i].msg_hdr.msg_iov = &iov[i];
+		headers[i].msg_hdr.msg_iovlen = 1;
+		headers[i].msg_hdr.msg_name = &iaddr[i];
+		headers[i].msg_hdr.msg_namelen = sizeof(iaddr[i]);
+	}
+
+	n = recvmmsg(d->fd, headers, count, MSG_DONTWAIT, 0);
+	if(n < 0)
+		return errno_is_temporary(errno) ? 0 : -1;
+
+	for(i = 0; i < n; i++) {
+		messages[i].length = headers[i].msg_len;
+		datagram_sender(&iaddr[i], headers[i].msg_hdr.msg_namelen, messages[i].addr, &messages[i].port);
+	}
+#else
+	for(n = 0; n < count; n++) {
+		SOCKLEN_T iaddr_length = sizeof(iaddr[n]);
+		int result = recvfrom(d->fd, messages[n].data, messages[n].size, MSG_DONTWAIT, (struct sockaddr *) &iaddr[n], &iaddr_length);
+		if(result < 0) {
+			if(n == 0 && !errno_is_temporary(errno))
+				return -1;
+			break;
+		}
+		messages[n].length = result;
+		datagram_sender(&iaddr[n], iaddr_length, messages[n].addr, &messages[n].port);
+	}
+#endif
+
+	return n;
+}
+
 int datagram_send(struct datagram *d, const char *data, int length, const char *addr, int port)
 {
 	int result;
@@ -98,6 +98,25 @@ void datagram_delete(struct datagram *d);
 */
 int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *port, int timeout);
 
+/** A datagram received by @ref datagram_recv_batch. */
+struct datagram_message {
+	char *data;                       /**< Where to store the message, supplied by the caller. */
+	int size;                         /**< The size of the data buffer, supplied by the caller. */
+	int length;                       /**< The number of bytes received. */
+	char addr[DATAGRAM_ADDRESS_MAX];  /**< The IP address of the sender. */
+	int port;                         /**< The port number of the sender. */
+};
+
+/** Receive several datagrams at once, without waiting.
+Where the system supports it, all of the datagrams are received with a single system call,
+which is much cheaper than calling @ref datagram_recv for each one when many are waiting.
+@param d The datagram object.
+@param messages An array of messages, each with data and size describing a buffer.
+@param count The number of messages in the array.
+@return The number of datagrams received, which is zero if none are waiting.  On failure, returns less than zero and sets errno appropriately.
+*/
+int datagram_recv_batch(struct datagram *d, struct datagram_message *messages, int count);
+
 /** Send a datagram.
 @param d The datagram object.
 @param data The data to send.
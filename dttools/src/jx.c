@@ -7,6 +7,7 @@ See the file COPYING for details.
 #include "jx.h"
 #include "stringtools.h"
 #include "buffer.h"
+#include "hash_table.h"
 #include "xxmalloc.h"
 
 #include <assert.h>
@@ -15,9 +16,237 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/*
+Values are allocated from the heap, or from the arena last entered.  Values in
+an arena have JX_FLAG_ARENA set, and so do their strings, which jx_delete does
+not free.  Keys are interned in a table that lives as long as the program;
+their values have JX_FLAG_INTERNED set.  The number and length of interned keys
+is limited, so that objects with arbitrary keys do not grow the table forever.
+*/
+
+#define JX_FLAG_ARENA 1
+#define JX_FLAG_INTERNED 2
+
+#define JX_ARENA_CHUNK_SIZE 65536
+#define JX_ARENA_ALIGN 8
+
+#define JX_INTERN_MAX 4096
+#define JX_INTERN_LENGTH 64
+
+struct jx_arena_chunk {
+	struct jx_arena_chunk *next;
+};
+
+struct jx_arena {
+	struct jx_arena_chunk *chunks;
+	char *free_space;
+	size_t free_size;
+	struct jx **objects;	/* objects that may get an index, which is not in the arena. */
+	size_t nobjects;
+	size_t maxobjects;
+	struct jx_arena *previous;
+};
+
+static struct jx_arena *jx_arena_current = 0;
+static struct hash_table *jx_intern_table = 0;
+
+struct jx_arena * jx_arena_create()
+{
+	return xxcalloc(1,sizeof(struct jx_arena));
+}
+
+void jx_arena_enter( struct jx_arena *a )
+{
+	a->previous = jx_arena_current;
+	jx_arena_current = a;
+}
+
+void jx_arena_leave( struct jx_arena *a )
+{
+	assert(jx_arena_current==a);
+	jx_arena_current = a->previous;
+	a->previous = 0;
+}
+
+static void jx_index_delete( struct jx_index *x );
+
+void jx_arena_delete( struct jx_arena *a )
+{
+	size_t i;
+
+	if(!a) return;
+
+	for(i=0;i<a->nobjects;i++) {
+		jx_index_delete(a->objects[i]->index);
+	}
+	free(a->objects);
+
+	while(a->chunks) {
+		struct jx_arena_chunk *c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+
+	free(a);
+}
+
+/* Get zeroed memory from the current arena, or from the heap. */
+
+static void * jx_alloc( size_t size, unsigned *flags )
+{
+	struct jx_arena *a = jx_arena_current;
+
+	if(!a) {
+		*flags = 0;
+		return xxcalloc(1,size);
+	}
+
+	*flags = JX_FLAG_ARENA;
+	size = (size+JX_ARENA_ALIGN-1) & ~(size_t)(JX_ARENA_ALIGN-1);
+
+	if(size>a->free_size) {
+		/* Large values get a chunk of their own, so that the current chunk is not wasted. */
+		size_t chunk_size = size>JX_ARENA_CHUNK_SIZE/4 ? size : JX_ARENA_CHUNK_SIZE;
+		size_t header = (sizeof(struct jx_arena_chunk)+JX_ARENA_ALIGN-1) & ~(size_t)(JX_ARENA_ALIGN-1);
+
+		struct jx_arena_chunk *c = xxmalloc(header+chunk_size);
+		c->next = a->chunks;
+		a->chunks = c;
+
+		if(chunk_size==size) {
+			return memset((char*)c+header,0,size);
+		}
+
+		a->free_space = (char*)c+header;
+		a->free_size = chunk_size;
+	}
+
+	void *p = a->free_space;
+	a->free_space += size;
+	a->free_size -= size;
+	return memset(p,0,size);
+}
+
+static void jx_free( void *p, unsigned flags )
+{
+	if(!(flags&JX_FLAG_ARENA)) free(p);
+}
+
+static char * jx_strdup( const char *str, unsigned *flags )
+{
+	size_t length = strlen(str);
+	char *s;
+
+	if(jx_arena_current) {
+		s = jx_alloc(length+1,flags);
+	} else {
+		s = xxmalloc(length+1);
+		*flags = 0;
+	}
+
+	return memcpy(s,str,length+1);
+}
+
+/* Return the interned copy of a key, or null if it cannot be interned. */
+
+static const char * jx_intern( const char *key )
+{
+	if(!jx_intern_table) jx_intern_table = hash_table_create(0,0);
+
+	char *s = hash_table_lookup(jx_intern_table,key);
+	if(!s && strlen(key)<JX_INTERN_LENGTH && hash_table_size(jx_intern_table)<JX_INTERN_MAX) {
+		s = xxstrdup(key);
+		hash_table_insert(jx_intern_table,key,s);
+	}
+
+	return s;
+}
+
+/*
+Objects with many pairs get an index from string keys to pairs, so that
+lookups do not walk the list.  The index is built by the first lookup that
+walks past JX_INDEX_THRESHOLD pairs, and is kept up to date by jx_insert and
+jx_remove.  Pairs pushed directly on the head of the list, as deltadb does,
+are added at the next use of the index.  Code that changes the list of an
+object directly must not do anything else, because the index cannot see it.
+*/
+
+#define JX_INDEX_THRESHOLD 16
+
+struct jx_index {
+	struct hash_table *table;
+	struct jx_pair *head;	/* head of the list when the index was last updated. */
+	int duplicates;		/* some key may appear more than once in the list. */
+};
+
+/* Map the key of p to p, which is newer than any pair already in the index. */
+
+static void jx_index_add( struct jx_index *x, struct jx_pair *p )
+{
+	if(!p->key || p->key->type!=JX_STRING) return;
+
+	const char *key = p->key->u.string_value;
+	if(hash_table_remove(x->table,key)) {
+		x->duplicates = 1;
+	}
+	hash_table_insert(x->table,key,p);
+}
+
+static void jx_index_delete( struct jx_index *x )
+{
+	if(!x) return;
+	hash_table_delete(x->table);
+	free(x);
+}
+
+/*
+Bring the index of j up to date with its list of pairs, and return it.
+The pairs in front of the old head were pushed since the last update,
+and are added oldest first, so that the first pair with a key wins,
+as in a walk of the list.
+*/
+
+static struct jx_index * jx_index_sync( struct jx *j )
+{
+	struct jx_index *x = j->index;
+	struct jx_pair *p;
+	int n = 0;
+
+	if(!x || x->head==j->u.pairs) return x;
+
+	for(p=j->u.pairs;p && p!=x->head;p=p->next) n++;
+
+	if(p!=x->head) {
+		hash_table_clear(x->table);
+		x->duplicates = 0;
+		x->head = 0;
+	}
+
+	if(n>0) {
+		struct jx_pair **pushed = xxmalloc(n*sizeof(*pushed));
+		int i = 0;
+		for(p=j->u.pairs;p!=x->head;p=p->next) pushed[i++] = p;
+		while(i>0) jx_index_add(x,pushed[--i]);
+		free(pushed);
+	}
+
+	x->head = j->u.pairs;
+	return x;
+}
+
+static void jx_index_create( struct jx *j )
+{
+	struct jx_index *x = xxcalloc(1,sizeof(*x));
+	x->table = hash_table_create(0,0);
+	j->index = x;
+	jx_index_sync(j);
+}
+
 struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next )
 {
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	unsigned flags;
+	struct jx_pair *pair = jx_alloc(sizeof(*pair), &flags);
+	pair->flags = flags;
 	pair->key = key;
 	pair->value = value;
 	pair->next = next;
@@ -26,7 +255,9 @@ struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next
 
 struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 {
-	struct jx_item *item = calloc(1, sizeof(*item));
+	unsigned flags;
+	struct jx_item *item = jx_alloc(sizeof(*item), &flags);
+	item->flags = flags;
 	item->value = value;
 	item->next = next;
 	return item;
@@ -35,8 +266,10 @@ struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 struct jx_comprehension *jx_comprehension(const char *variable, struct jx *elements, struct jx *condition, struct jx_comprehension *next) {
 	assert(variable);
 	assert(elements);
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
-	comp->variable = strdup(variable);
+	unsigned flags;
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp), &flags);
+	comp->flags = flags;
+	comp->variable = jx_strdup(variable, &flags);
 	comp->elements = elements;
 	comp->condition = condition;
 	comp->next = next;
@@ -45,7 +278,9 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 
 static struct jx * jx_create( jx_type_t type )
 {
-	struct jx *j = xxcalloc(1, sizeof(*j));
+	unsigned flags;
+	struct jx *j = jx_alloc(sizeof(*j), &flags);
+	j->flags = flags;
 	j->type = type;
 	return j;
 }
@@ -57,24 +292,57 @@ struct jx * jx_null()
 
 struct jx * jx_symbol( const char *symbol_name )
 {
+	unsigned flags;
 	struct jx *j = jx_create(JX_SYMBOL);
-	j->u.symbol_name = strdup(symbol_name);
+	j->u.symbol_name = jx_strdup(symbol_name, &flags);
 	return j;
 }
 
 struct jx * jx_string( const char *string_value )
 {
+	unsigned flags;
 	assert(string_value);
-	return jx_string_nocopy(strdup(string_value));
+	struct jx *j = jx_create(JX_STRING);
+	j->u.string_value = jx_strdup(string_value, &flags);
+	return j;
 }
 
 struct jx * jx_string_nocopy( char *string_value )
 {
+	if(jx_arena_current) {
+		struct jx *j = jx_string(string_value);
+		free(string_value);
+		return j;
+	}
+
 	struct jx *j = jx_create(JX_STRING);
 	j->u.string_value = string_value;
 	return j;
 }
 
+struct jx * jx_key( const char *key )
+{
+	const char *s = jx_intern(key);
+	if(!s) return jx_string(key);
+
+	struct jx *j = jx_create(JX_STRING);
+	j->u.string_value = (char *) s;
+	j->flags |= JX_FLAG_INTERNED;
+	return j;
+}
+
+void jx_key_intern( struct jx *key )
+{
+	if(!key || key->type!=JX_STRING || (key->flags&JX_FLAG_INTERNED)) return;
+
+	const char *s = jx_intern(key->u.string_value);
+	if(!s) return;
+
+	jx_free(key->u.string_value, key->flags);
+	key->u.string_value = (char *) s;
+	key->flags |= JX_FLAG_INTERNED;
+}
+
 struct jx * jx_format( const char *fmt, ... )
 {
 	va_list va;
@@ -90,8 +358,7 @@ struct jx * jx_format( const char *fmt, ... )
 	buffer_dup(B, &str);
 	buffer_free(B);
 
-	j = jx_create(JX_STRING);
-	j->u.string_value = str;
+	j = jx_string_nocopy(str);
 
 	return j;
 }
@@ -121,6 +388,16 @@ struct jx * jx_object( struct jx_pair *pairs )
 {
 	struct jx *j = jx_create(JX_OBJECT);
 	j->u.pairs = pairs;
+
+	struct jx_arena *a = jx_arena_current;
+	if(a) {
+		if(a->nobjects==a->maxobjects) {
+			a->maxobjects = a->maxobjects ? a->maxobjects*2 : 1024;
+			a->objects = xxrealloc(a->objects, a->maxobjects*sizeof(*a->objects));
+		}
+		a->objects[a->nobjects++] = j;
+	}
+
 	return j;
 }
 
@@ -132,7 +409,7 @@ struct jx * jx_objectv( const char *key, struct jx *value, ... ) {
 
 	while(key) {
 		assert(value);
-		jx_insert(object,jx_string(xxstrdup(key)),value);
+		jx_insert(object,jx_key(key),value);
 		key = va_arg(args,char *);
 		value = va_arg(args,struct jx *);
 	}
@@ -183,23 +460,35 @@ struct jx * jx_arrayv( struct jx *value, ... )
 struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 {
 	struct jx_pair *p;
+	int walked = 0;
 
 	if(found)
 		*found = 0;
 
 	if(!j || j->type!=JX_OBJECT) return 0;
 
+	struct jx_index *x = jx_index_sync(j);
+	if(x) {
+		p = hash_table_lookup(x->table,key);
+		if(p && found)
+			*found = 1;
+		return p ? p->value : 0;
+	}
+
 	for(p=j->u.pairs;p;p=p->next) {
+		walked++;
 		if(p && p->key && p->key->type==JX_STRING) {
 			if(!strcmp(p->key->u.string_value,key)) {
 				if(found)
 					*found = 1;
-				return p->value;
+				break;
 			}
 		}
 	}
 
-	return 0;
+	if(walked>=JX_INDEX_THRESHOLD) jx_index_create(j);
+
+	return p ? p->value : 0;
 }
 
 struct jx * jx_lookup( struct jx *j, const char *key )
@@ -263,9 +552,25 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 
 	struct jx_pair *p;
 	struct jx_pair *last = 0;
+	struct jx_pair *target = 0;
+
+	struct jx_index *x = jx_index_sync(object);
+	if(x && key && key->type==JX_STRING) {
+		target = hash_table_remove(x->table,key->u.string_value);
+		if(!target) return 0;
+		if(x->duplicates) {
+			/* an older pair with the same key takes its place. */
+			for(p=target->next;p;p=p->next) {
+				if(jx_equals(key,p->key)) {
+					hash_table_insert(x->table,key->u.string_value,p);
+					break;
+				}
+			}
+		}
+	}
 
 	for(p=object->u.pairs;p;p=p->next) {
-		if(jx_equals(key,p->key)) {
+		if(target ? p==target : jx_equals(key,p->key)) {
 			struct jx *value = p->value;
 			if(last) {
 				last->next = p->next;
@@ -275,6 +580,7 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 			p->value = 0;
 			p->next = 0;
 			jx_pair_delete(p);
+			if(x) x->head = object->u.pairs;
 			return value;
 		}
 		last = p;
@@ -286,7 +592,12 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 int jx_insert( struct jx *j, struct jx *key, struct jx *value )
 {
 	if(!j || j->type!=JX_OBJECT) return 0;
+	struct jx_index *x = jx_index_sync(j);
 	j->u.pairs = jx_pair(key,value,j->u.pairs);
+	if(x) {
+		jx_index_add(x,j->u.pairs);
+		x->head = j->u.pairs;
+	}
 	return 1;
 }
 
@@ -312,22 +623,22 @@ int jx_insert_unless_empty( struct jx *object, struct jx *key, struct jx *value
 
 void jx_insert_boolean( struct jx *j, const char *key, int value )
 {
-	jx_insert(j,jx_string(key),jx_boolean(value));
+	jx_insert(j,jx_key(key),jx_boolean(value));
 }
 
 void jx_insert_integer( struct jx *j, const char *key, jx_int_t value )
 {
-	jx_insert(j,jx_string(key),jx_integer(value));
+	jx_insert(j,jx_key(key),jx_integer(value));
 }
 
 void jx_insert_double( struct jx *j, const char *key, double value )
 {
-	jx_insert(j,jx_string(key),jx_double(value));
+	jx_insert(j,jx_key(key),jx_double(value));
 }
 
 void jx_insert_string( struct jx *j, const char *key, const char *value )
 {
-	jx_insert(j,jx_string(key),jx_string(value));
+	jx_insert(j,jx_key(key),jx_string(value));
 }
 
 void jx_array_insert( struct jx *array, struct jx *value )
@@ -374,7 +685,7 @@ struct jx *jx_array_concat( struct jx *array, ...) {
 		}
 		*tail = a->u.items;
 		while(*tail) tail = &(*tail)->next;
-		free(a);
+		jx_free(a, a->flags);
 	}
 	va_end(ap);
 	return result;
@@ -387,7 +698,7 @@ struct jx *jx_array_shift(struct jx *array) {
 	if (i) {
 		result = i->value;
 		array->u.items = i->next;
-		free(i);
+		jx_free(i, i->flags);
 	}
 	return result;
 
@@ -399,7 +710,7 @@ void jx_pair_delete( struct jx_pair *pair )
 	jx_delete(pair->key);
 	jx_delete(pair->value);
 	jx_pair_delete(pair->next);
-	free(pair);
+	jx_free(pair, pair->flags);
 }
 
 void jx_item_delete( struct jx_item *item )
@@ -408,16 +719,16 @@ void jx_item_delete( struct jx_item *item )
 	jx_delete(item->value);
 	jx_comprehension_delete(item->comp);
 	jx_item_delete(item->next);
-	free(item);
+	jx_free(item, item->flags);
 }
 
 void jx_comprehension_delete(struct jx_comprehension *comp) {
 	if (!comp) return;
-	free(comp->variable);
+	jx_free(comp->variable, comp->flags);
 	jx_delete(comp->elements);
 	jx_delete(comp->condition);
 	jx_comprehension_delete(comp->next);
-	free(comp);
+	jx_free(comp, comp->flags);
 }
 
 void jx_delete( struct jx *j )
@@ -431,16 +742,18 @@ void jx_delete( struct jx *j )
 		case JX_NULL:
 			break;
 		case JX_SYMBOL:
-			free(j->u.symbol_name);
+			jx_free(j->u.symbol_name, j->flags);
 			break;
 		case JX_STRING:
-			free(j->u.string_value);
+			if(!(j->flags&JX_FLAG_INTERNED)) jx_free(j->u.string_value, j->flags);
 			break;
 		case JX_ARRAY:
 			jx_item_delete(j->u.items);
 			break;
 		case JX_OBJECT:
 			jx_pair_delete(j->u.pairs);
+			jx_index_delete(j->index);
+			j->index = 0;
 			break;
 		case JX_OPERATOR:
 			jx_delete(j->u.oper.left);
@@ -450,7 +763,7 @@ void jx_delete( struct jx *j )
 			jx_delete(j->u.err);
 			break;
 	}
-	free(j);
+	jx_free(j, j->flags);
 }
 
 int jx_isatomic( struct jx *j )
@@ -519,7 +832,7 @@ int jx_equals( struct jx *j, struct jx *k )
 		case JX_SYMBOL:
 			return !strcmp(j->u.symbol_name,k->u.symbol_name);
 		case JX_STRING:
-			return !strcmp(j->u.string_value,k->u.string_value);
+			return j->u.string_value==k->u.string_value || !strcmp(j->u.string_value,k->u.string_value);
 		case JX_ARRAY:
 			return jx_item_equals(j->u.items,k->u.items);
 		case JX_OBJECT:
@@ -538,9 +851,11 @@ int jx_equals( struct jx *j, struct jx *k )
 
 struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c) {
 	if (!c) return NULL;
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
+	unsigned flags;
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp), &flags);
+	comp->flags = flags;
 	comp->line = c->line;
-	comp->variable = strdup(c->variable);
+	comp->variable = jx_strdup(c->variable, &flags);
 	comp->elements = jx_copy(c->elements);
 	comp->condition = jx_copy(c->condition);
 	comp->next = jx_comprehension_copy(c->next);
@@ -550,7 +865,9 @@ struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c) {
 struct jx_pair * jx_pair_copy( struct jx_pair *p )
 {
 	if (!p) return NULL;
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	unsigned flags;
+	struct jx_pair *pair = jx_alloc(sizeof(*pair), &flags);
+	pair->flags = flags;
 	pair->key = jx_copy(p->key);
 	pair->value = jx_copy(p->value);
 	pair->next = jx_pair_copy(p->next);
@@ -561,7 +878,9 @@ struct jx_pair * jx_pair_copy( struct jx_pair *p )
 struct jx_item * jx_item_copy( struct jx_item *i )
 {
 	if (!i) return NULL;
-	struct jx_item *item = calloc(1, sizeof(*item));
+	unsigned flags;
+	struct jx_item *item = jx_alloc(sizeof(*item), &flags);
+	item->flags = flags;
 	item->line = i->line;
 	item->value = jx_copy(i->value);
 	item->comp = jx_comprehension_copy(i->comp);
@@ -591,7 +910,11 @@ struct jx  *jx_copy( struct jx *j )
 			c = jx_symbol(j->u.symbol_name);
 			break;
 		case JX_STRING:
-			c = jx_string(j->u.string_value);
+			if(j->flags&JX_FLAG_INTERNED) {
+				c = jx_key(j->u.string_value);
+			} else {
+				c = jx_string(j->u.string_value);
+			}
 			break;
 		case JX_ARRAY:
 			c = jx_array(jx_item_copy(j->u.items));
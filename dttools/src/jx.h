@@ -56,6 +56,7 @@ typedef int64_t jx_int_t;
 
 struct jx_comprehension {
 	unsigned line;
+	unsigned flags;
 	char *variable; /**< variable for comprehension */
 	struct jx *elements; /**< items for list comprehension */
 	struct jx *condition; /**< condition for filtering list comprehension */
@@ -66,6 +67,7 @@ struct jx_comprehension {
 
 struct jx_item {
 	unsigned line;
+	unsigned flags;
 	struct jx *value;       /**< value of this item */
 	struct jx_comprehension *comp;
 	struct jx_item *next;	/**< pointer to next item */
@@ -77,6 +79,7 @@ struct jx_pair {
 	struct jx      *key;	/**< key of this pair */
 	struct jx      *value;  /**< value of this pair */
 	unsigned line;
+	unsigned flags;
 	struct jx_pair *next;   /**< pointer to next pair */
 };
 
@@ -113,6 +116,7 @@ struct jx_operator {
 struct jx {
 	jx_type_t type;               /**< type of this value */
 	unsigned line;                /**< line where this value was defined */
+	unsigned flags;               /**< how the value was allocated, private to jx.c */
 	union {
 		int boolean_value;      /**< value of @ref JX_BOOLEAN */
 		jx_int_t integer_value; /**< value of @ref JX_INTEGER */
@@ -124,6 +128,7 @@ struct jx {
 		struct jx_operator oper; /**< value of @ref JX_OPERATOR */
 		struct jx *err;  /**< error value of @ref JX_ERROR */
 	} u;
+	struct jx_index *index; /**< index of the pairs of a large @ref JX_OBJECT, private to jx.c */
 };
 
 /** Create a JX null value. @return A JX expression. */
@@ -147,6 +152,24 @@ struct jx * jx_string_nocopy( char *string_value );
 /** Create a JX string value using prinf style formatting.  @param fmt A printf-style format string, followed by matching arguments.  @return A JX string value. */
 struct jx * jx_format( const char *fmt, ... );
 
+/** Create a JX string for use as the key of an object.  Short keys are interned, so that all the keys with the same name share one copy of the name, which is never freed. @param key A C string. @return A JX string value. */
+struct jx * jx_key( const char *key );
+
+/** Intern the string of a key created by other means, as in @ref jx_key.  @param key A JX value, which is unchanged if it is not a string. */
+void jx_key_intern( struct jx *key );
+
+/** Create an arena, a region of memory that holds whole JX documents.  Values allocated from an arena are not freed one by one, but all at once by @ref jx_arena_delete.  This avoids the cost of many small allocations when parsing or copying large documents. @return A new arena. */
+struct jx_arena * jx_arena_create();
+
+/** Allocate from an arena all of the JX values created from now on, until @ref jx_arena_leave is called.  This applies to @ref jx_parse, @ref jx_copy, @ref jx_binary_read, and all other functions that create values. @param a The arena. */
+void jx_arena_enter( struct jx_arena *a );
+
+/** Stop allocating from an arena, and go back to the arena entered before it, if any. @param a The arena given to @ref jx_arena_enter. */
+void jx_arena_leave( struct jx_arena *a );
+
+/** Delete an arena and all of the values allocated from it.  Values from an arena may still be passed to @ref jx_delete, which then frees only the values within them that were not allocated from an arena.  Any such values inserted into the documents of the arena must be deleted before the arena is. @param a The arena to delete. */
+void jx_arena_delete( struct jx_arena *a );
+
 /** Create a JX symbol. Note that symbols are an extension to the JSON standard. A symbol is a reference to an external variable, which can be resolved by using @ref jx_eval. @param symbol_name A C string. @return A JX expression.
 */
 struct jx * jx_symbol( const char *symbol_name );
@@ -251,7 +274,7 @@ void jx_insert_double( struct jx *object, const char *key, double value );
 /** Insert a string value into an object @param object The object @param key The key represented as a C string  @param value The C string value. */
 void jx_insert_string( struct jx *object, const char *key, const char *value );
 
-/** Search for a arbitrary item in an object.  The key is an ordinary string value.  @param object The object in which to search.  @param key The string key to match.  @return The value of the matching pair, or null if none is found. */
+/** Search for a arbitrary item in an object.  The key is an ordinary string value.  Objects with many pairs are indexed on their first search, so that later searches take constant time.  @param object The object in which to search.  @param key The string key to match.  @return The value of the matching pair, or null if none is found. */
 struct jx * jx_lookup( struct jx *object, const char *key );
 
 /* Like @ref jx_lookup, but found is set to 1 when the key is found. Useful for when value is false. */
@@ -210,6 +210,8 @@ static struct jx_pair * jx_binary_read_pair( FILE *stream )
 	struct jx *a = jx_binary_read(stream);
 	if(!a) return 0;
 
+	jx_key_intern(a);
+
 	struct jx *b = jx_binary_read(stream);
 	if(!b) {
 		jx_delete(a);
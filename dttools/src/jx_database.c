@@ -22,6 +22,9 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <stdarg.h>
 
+/* Log records are buffered in memory up to this size between flushes. */
+#define LOG_BUFFER_SIZE (1024*1024)
+
 struct jx_database {
 	struct hash_table *table;
 	const char *logdir;
@@ -29,6 +32,7 @@ struct jx_database {
 	int logday;
 	FILE *logfile;
 	time_t last_log_time;
+	int in_group;
 };
 
 /* Take the current state of the table and write it out verbatim to a checkpoint file. */
@@ -155,6 +159,7 @@ static void log_select( struct jx_database *db )
 	sprintf(filename,"%s/%d/%d.log",db->logdir,db->logyear,db->logday);
 	db->logfile = fopen(filename,"a");
 	if(!db->logfile) fatal("could not open log file %s: %s",filename,strerror(errno));
+	setvbuf(db->logfile,0,_IOFBF,LOG_BUFFER_SIZE);
 
 	// If we switched from one log to another, write an intermediate checkpoint.
 	if(write_checkpoint_file) {
@@ -265,11 +270,11 @@ static void log_delete( struct jx_database *db, const char *key )
 	log_message(db,"D %s\n",key);
 }
 
-/* Push any buffered output out to the log. */
+/* Push any buffered output out to the log, unless in the middle of a group of changes. */
 
 static void log_flush( struct jx_database *db )
 {
-	if(db->logfile) fflush(db->logfile);
+	if(db->logfile && !db->in_group) fflush(db->logfile);
 }
 
 /* Report an invalid bit of data in the log. */
@@ -442,6 +447,7 @@ struct jx_database * jx_database_create( const char *logdir )
 	db->logfile = 0;
 	db->last_log_time = 0;
 	db->logdir = 0;
+	db->in_group = 0;
 
 	if(logdir) {
 		db->logdir = strdup(logdir);
@@ -470,6 +476,17 @@ void jx_database_insert( struct jx_database *db, const char *key, struct jx *nv
 	log_flush(db);
 }
 
+void jx_database_begin( struct jx_database *db )
+{
+	db->in_group = 1;
+}
+
+void jx_database_commit( struct jx_database *db )
+{
+	db->in_group = 0;
+	log_flush(db);
+}
+
 struct jx * jx_database_lookup( struct jx_database *db, const char *key )
 {
 	return hash_table_lookup(db->table,key);
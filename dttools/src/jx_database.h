@@ -77,6 +77,21 @@ If an object with the same primary key exists in the database, it will generate
 
 void jx_database_insert( struct jx_database *db, const char *key, struct jx *j );
 
+/** Begin a group of changes to the database.
+Log records for changes made until @ref jx_database_commit are buffered and
+written out together, which is much cheaper than writing each change as it
+is made when many arrive at once.
+@param db The database to access.
+*/
+
+void jx_database_begin( struct jx_database *db );
+
+/** Finish a group of changes begun by @ref jx_database_begin, and write out their log records.
+@param db The database to access.
+*/
+
+void jx_database_commit( struct jx_database *db );
+
 /** Look up an object in the database.
 @param db The database to access.
 @param key The primary key of the desired object.
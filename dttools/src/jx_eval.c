@@ -628,6 +628,65 @@ struct jx * jx_eval( struct jx *j, struct jx *context )
 	return result;
 }
 
+/*
+Functions that compute a result from their arguments in about the time it
+takes to read them.  select and project evaluate an expression for each
+item of a list, and so multiply the cost of nested calls.
+*/
+
+static const char *jx_safe_functions[] = {
+	"basename", "ceil", "dirname", "escape", "floor", "items", "join",
+	"keys", "len", "like", "schema", "values", 0
+};
+
+static int jx_eval_is_safe_function( struct jx *func )
+{
+	int i;
+
+	if(!jx_istype(func, JX_SYMBOL)) return 0;
+
+	for(i = 0; jx_safe_functions[i]; i++) {
+		if(!strcmp(func->u.symbol_name, jx_safe_functions[i])) return 1;
+	}
+
+	return 0;
+}
+
+int jx_eval_is_safe( struct jx *j )
+{
+	struct jx_item *i;
+	struct jx_pair *p;
+
+	if(!j) return 1;
+
+	switch(j->type) {
+		case JX_ARRAY:
+			for(i = j->u.items; i; i = i->next) {
+				/* Nested comprehensions multiply the items they produce. */
+				if(i->comp) return 0;
+				if(!jx_eval_is_safe(i->value)) return 0;
+			}
+			return 1;
+		case JX_OBJECT:
+			for(p = j->u.pairs; p; p = p->next) {
+				if(!jx_eval_is_safe(p->key)) return 0;
+				if(!jx_eval_is_safe(p->value)) return 0;
+			}
+			return 1;
+		case JX_OPERATOR:
+			if(j->u.oper.type == JX_OP_CALL) {
+				if(!jx_eval_is_safe_function(j->u.oper.left)) return 0;
+			} else if(!jx_eval_is_safe(j->u.oper.left)) {
+				return 0;
+			}
+			return jx_eval_is_safe(j->u.oper.right);
+		case JX_ERROR:
+			return jx_eval_is_safe(j->u.err);
+		default:
+			return 1;
+	}
+}
+
 struct jx * jx_eval_with_defines( struct jx *j, struct jx *context )
 {
 	// Find the define clause in j, if it exists.
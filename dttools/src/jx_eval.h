@@ -30,5 +30,18 @@ If the expression is invalid in some way, an object of type @ref JX_NULL is retu
 */
 struct jx * jx_eval_with_defines( struct jx *j, struct jx* context );
 
+/** Check that an expression is safe to evaluate on behalf of an untrusted client.
+Some functions, such as fetch and listdir, read from the local system,
+and others, such as range, can consume unbounded memory.
+List comprehensions, select, and project evaluate an expression once for
+each item of a list, so that nesting them multiplies the work to be done.
+An expression is safe if it has no list comprehensions, and calls only
+functions that compute a result from their arguments alone, in about the
+time it takes to read them.
+@param j The expression to check.
+@return True if the expression is safe to evaluate, false otherwise.
+*/
+int jx_eval_is_safe( struct jx *j );
+
 
 #endif
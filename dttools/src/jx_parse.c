@@ -11,12 +11,20 @@ See the file COPYING for details.
 #include "stringtools.h"
 #include "debug.h"
 
+#include "copy_stream.h"
+
 #include <assert.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define JX_SCAN_SSE2
+#endif
+
 typedef enum {
 	JX_TOKEN_SYMBOL,
 	JX_TOKEN_INTEGER,
@@ -62,9 +70,9 @@ typedef enum {
 #define MAX_TOKEN_SIZE 65536
 
 struct jx_parser {
-	char token[MAX_TOKEN_SIZE];
 	FILE *source_file;
 	const char *source_string;
+	const char *source_end;
 	struct link *source_link;
 	unsigned line;
 	time_t stoptime;
@@ -77,11 +85,14 @@ struct jx_parser {
 	jx_token_t putback_token;
 	jx_int_t integer_value;
 	double double_value;
+	/* Last, so that only the fields above need to be cleared on create. */
+	char token[MAX_TOKEN_SIZE];
 };
 
 struct jx_parser *jx_parser_create(bool strict_mode) {
 	struct jx_parser *p = malloc(sizeof(*p));
-	memset(p,0,sizeof(*p));
+	memset(p,0,offsetof(struct jx_parser,token));
+	p->token[0] = 0;
 	p->strict_mode = strict_mode;
 	p->line = 1;
 	return p;
@@ -95,6 +106,7 @@ void jx_parser_read_stream( struct jx_parser *p, FILE *file )
 void jx_parser_read_string( struct jx_parser *p, const char *str )
 {
 	p->source_string = str;
+	p->source_end = str + strlen(str);
 }
 
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime )
@@ -160,20 +172,20 @@ static int jx_getchar( struct jx_parser *p )
 		return p->putback_char;
 	}
 
-	if(p->source_file) {
-		c = fgetc(p->source_file);
-	} else if(p->source_string) {
-		c = *p->source_string;
+	if(p->source_string) {
+		c = (unsigned char) *p->source_string;
 		if(c) {
 			p->source_string++;
 		} else {
 			c = EOF;
 		}
+	} else if(p->source_file) {
+		c = getc_unlocked(p->source_file);
 	} else if(p->source_link) {
 		char ch;
 		int result = link_read(p->source_link,&ch,1,p->stoptime);
 		if(result==1) {
-			c = ch;
+			c = (unsigned char) ch;
 		} else {
 			c = EOF;
 		}
@@ -190,6 +202,105 @@ static void jx_ungetchar( struct jx_parser *p, int c )
 	p->putback_char_valid = true;
 }
 
+/*
+When parsing from a string, the whole input is in memory, so the scanner
+can skip whitespace and copy the plain characters of string constants
+in bulk rather than calling jx_getchar for each one.  A "plain" character
+is anything but a quote, a backslash or a newline (so the line count
+stays right).  Where SSE2 is available, sixteen bytes are classified at
+a time; otherwise, and for the remainder of the input, a byte at a time.
+*/
+
+static int jx_scan_bulk( struct jx_parser *p )
+{
+	return p->source_string && !p->putback_char_valid;
+}
+
+static int jx_plain_char( char c )
+{
+	return c!='\"' && c!='\\' && c!='\n' && c!=0;
+}
+
+static size_t jx_span_plain( const char *str, const char *end )
+{
+	const char *s = str;
+
+	/* Most keys and values are short, so check a few bytes before going wide. */
+	const char *head = end-s > 16 ? s+16 : end;
+	while(s<head) {
+		if(!jx_plain_char(*s)) return s - str;
+		s++;
+	}
+
+#ifdef JX_SCAN_SSE2
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	while(end-s >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v,quote),_mm_cmpeq_epi8(v,backslash)),
+			_mm_cmpeq_epi8(v,newline));
+		int mask = _mm_movemask_epi8(m);
+		if(mask) return s - str + __builtin_ctz(mask);
+		s += 16;
+	}
+#endif
+
+	while(s<end && jx_plain_char(*s)) s++;
+	return s - str;
+}
+
+static void jx_skip_space( struct jx_parser *p )
+{
+	const char *s = p->source_string;
+	const char *end = p->source_end;
+
+	const char *head = end-s > 16 ? s+16 : end;
+	while(s<head) {
+		if(!isspace((unsigned char)*s)) {
+			p->source_string = s;
+			return;
+		}
+		if(*s=='\n') p->line++;
+		s++;
+	}
+
+#ifdef JX_SCAN_SSE2
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	while(end-s >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i nl = _mm_cmpeq_epi8(v,newline);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v,space),nl),
+			_mm_or_si128(_mm_cmpeq_epi8(v,tab),_mm_cmpeq_epi8(v,cr)));
+		unsigned spaces = _mm_movemask_epi8(m);
+		unsigned newlines = _mm_movemask_epi8(nl);
+		if(spaces==0xffff) {
+			p->line += __builtin_popcount(newlines);
+			s += 16;
+		} else {
+			int n = __builtin_ctz(~spaces);
+			p->line += __builtin_popcount(newlines & ((1u<<n)-1));
+			s += n;
+			break;
+		}
+	}
+#endif
+
+	while(s<end && isspace((unsigned char)*s)) {
+		if(*s=='\n') p->line++;
+		s++;
+	}
+
+	p->source_string = s;
+}
+
 static int jx_scan_unicode( struct jx_parser *s )
 {
 	int i;
@@ -254,6 +365,7 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	}
 
 	retry:
+	if(jx_scan_bulk(s)) jx_skip_space(s);
 	c = jx_getchar(s);
 
 	if(isspace(c)) {
@@ -317,6 +429,15 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	} else if(c=='\"') {
 		int i;
 		for(i=0;i<MAX_TOKEN_SIZE;i++) {
+			if(jx_scan_bulk(s)) {
+				const char *end = s->source_end;
+				if(end - s->source_string > MAX_TOKEN_SIZE - i) end = s->source_string + MAX_TOKEN_SIZE - i;
+				size_t n = jx_span_plain(s->source_string,end);
+				memcpy(&s->token[i],s->source_string,n);
+				s->source_string += n;
+				i += n;
+				if(i>=MAX_TOKEN_SIZE) break;
+			}
 			int n = jx_scan_string_char(s);
 			if(n==EOF) {
 				if(i>10) i = 10;
@@ -342,12 +463,12 @@ static jx_token_t jx_scan( struct jx_parser *s )
 		while (c != '\n' && c != '\r' && c != EOF) c = jx_getchar(s);
 		jx_ungetchar(s, c);
 		goto retry;
-	} else if(strchr("0123456789.",c)) {
+	} else if(isdigit(c) || c=='.') {
 		s->token[0] = c;
 		int i;
 		for(i=1;i<MAX_TOKEN_SIZE;i++) {
 			c = jx_getchar(s);
-			if(strchr("0123456789.",c)) {
+			if(isdigit(c) || c=='.') {
 				s->token[i] = c;
 			}
 			else if(strchr("eE",c)) {
@@ -567,6 +688,8 @@ static struct jx_pair * jx_parse_pair_list( struct jx_parser *s )
 			return head;
 		}
 
+		jx_key_intern(p->key);
+
 		if(s->strict_mode) {
 			if(p->key->type!=JX_STRING) {
 				jx_parse_error_c(s,"key-value pair must have a string as the key");
@@ -1067,8 +1190,16 @@ struct jx * jx_parse_file( const char *name )
 	FILE *file = fopen(name,"r");
 	if (!file)
 		return NULL;
-	struct jx *j = jx_parse_stream(file);
+
+	/* Load the whole file so that the scanner can work on it in bulk. */
+	char *buffer;
+	int64_t length = copy_stream_to_buffer(file,&buffer,0);
 	fclose(file);
+	if (length<0)
+		return NULL;
+
+	struct jx *j = jx_parse_string(buffer);
+	free(buffer);
 	return j;
 }
 
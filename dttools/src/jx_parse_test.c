@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Compare the character-at-a-time scanner used for streams against the
+bulk scanner used for in-memory strings, on the same documents.
+Typical inputs are a catalog query result or a deltadb checkpoint.
+*/
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "copy_stream.h"
+
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define TIMEIT( name, xxx )\
+{ \
+timestamp_t start = timestamp_get(); \
+xxx \
+timestamp_t end = timestamp_get(); \
+printf( "%s %lu us\n",name,(unsigned long)(end-start));	\
+}
+
+int main( int argc, char *argv[] )
+{
+	if(argc<3) {
+		fprintf(stderr,"use: %s <iterations> <json-file> ...\n",argv[0]);
+		return 1;
+	}
+
+	int iterations = atoi(argv[1]);
+	int i, k;
+
+	for(i=2;i<argc;i++) {
+		FILE *file = fopen(argv[i],"r");
+		if(!file) {
+			fprintf(stderr,"couldn't open %s: %s\n",argv[i],strerror(errno));
+			return 1;
+		}
+
+		char *text;
+		size_t length;
+		if(copy_stream_to_buffer(file,&text,&length)<0) {
+			fprintf(stderr,"couldn't read %s: %s\n",argv[i],strerror(errno));
+			return 1;
+		}
+		fclose(file);
+
+		printf("%s: %lu bytes x %d\n",argv[i],(unsigned long)length,iterations);
+
+		struct jx *a = 0;
+		struct jx *b = 0;
+
+		TIMEIT( "stream parse", for(k=0;k<iterations;k++) { jx_delete(a); file = fopen(argv[i],"r"); a = jx_parse_stream(file); fclose(file); } )
+
+		TIMEIT( "string parse", for(k=0;k<iterations;k++) { jx_delete(b); b = jx_parse_string(text); } )
+
+		if(!a || !b || !jx_equals(a,b)) {
+			fprintf(stderr,"%s: stream and string parsers disagree\n",argv[i]);
+			return 1;
+		}
+
+		jx_delete(a);
+		jx_delete(b);
+		free(text);
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
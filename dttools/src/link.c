@@ -9,9 +9,11 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name.h"
 #include "full_io.h"
+#include "itable.h"
 #include "link.h"
 #include "macros.h"
 #include "stringtools.h"
+#include "timestamp.h"
 #include "address.h"
 
 #include <arpa/inet.h>
@@ -25,6 +27,13 @@ See the file COPYING for details.
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#define LINK_USE_EPOLL
+#define LINK_USE_SPLICE
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -46,6 +55,15 @@ See the file COPYING for details.
 #define TCP_HIGH_PORT_DEFAULT 32767
 #endif
 
+/* Largest amount moved by a single sendfile or splice call. */
+#define LINK_SPLICE_CHUNK (1<<20)
+
+/* Transfers smaller than this are not worth setting up a pipe for splice. */
+#define LINK_SPLICE_MIN (1<<16)
+
+/* Returned by the zero-copy helpers when the descriptors do not support them. */
+#define LINK_ZERO_COPY_UNSUPPORTED -2
+
 enum link_type {
 	LINK_TYPE_STANDARD,
 	LINK_TYPE_FILE,
@@ -60,8 +78,14 @@ struct link {
 	char buffer[1<<16];
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
+	struct link_poll_set *poll_set;
+	double rate_limit;        /* bytes per second, or zero if unlimited. */
+	double rate_tokens;       /* bytes that may be moved before sleeping; negative when in debt. */
+	timestamp_t rate_last;    /* last time rate_tokens was refilled. */
 };
 
+static void link_poll_set_mark(struct link_poll_set *s, struct link *l);
+
 static int link_send_window = 65536;
 static int link_recv_window = 65536;
 static int link_override_window = 0;
@@ -163,6 +187,66 @@ int link_buffer_empty(struct link *link) {
 	return link->buffer_length > 0 ? 0 : 1;
 }
 
+static double link_rate_burst(struct link *link)
+{
+	/* Allow a tenth of a second worth of data, but at least one buffer, to go out without pausing. */
+	return MAX((double) sizeof(link->buffer), link->rate_limit / 10);
+}
+
+void link_rate_limit(struct link *link, double bytes_per_second)
+{
+	if(bytes_per_second < 0)
+		bytes_per_second = 0;
+
+	if(link->rate_limit == bytes_per_second)
+		return;
+
+	link->rate_limit = bytes_per_second;
+	link->rate_tokens = bytes_per_second > 0 ? link_rate_burst(link) : 0;
+	link->rate_last = timestamp_get();
+}
+
+/*
+Token bucket: tokens accumulate at rate_limit up to the burst size,
+and each payload transfer consumes as many tokens as bytes moved.
+Return how many microseconds remain until the bucket is out of debt,
+or zero if more data may be moved now.  Only the stream functions are
+paced, so that messages on the link are never delayed.
+*/
+static timestamp_t link_pace(struct link *link, size_t bytes)
+{
+	if(link->rate_limit <= 0)
+		return 0;
+
+	timestamp_t now = timestamp_get();
+	link->rate_tokens += (now - link->rate_last) * link->rate_limit / 1000000.0;
+	link->rate_tokens = MIN(link->rate_tokens, link_rate_burst(link));
+	link->rate_last = now;
+
+	link->rate_tokens -= bytes;
+	if(link->rate_tokens < 0) {
+		return (timestamp_t) (-link->rate_tokens * 1000000.0 / link->rate_limit);
+	}
+
+	return 0;
+}
+
+int64_t link_rate_wait(struct link *link)
+{
+	return link_pace(link, 0);
+}
+
+/* The blocking stream functions wait out the debt, up to stoptime. */
+static void link_pace_wait(struct link *link, size_t bytes, time_t stoptime)
+{
+	timestamp_t wait = link_pace(link, bytes);
+
+	while(wait > 0 && (stoptime == LINK_FOREVER || time(0) < stoptime)) {
+		usleep((useconds_t) MIN(wait, 1000000));
+		wait = link_pace(link, 0);
+	}
+}
+
 int errno_is_temporary(int e)
 {
 	if(e == EINTR || e == EWOULDBLOCK || e == EAGAIN || e == EINPROGRESS || e == EALREADY || e == EISCONN) {
@@ -229,6 +313,10 @@ int link_sleep(struct link *link, time_t stoptime, int reading, int writing)
 
 	if(stoptime == LINK_FOREVER) {
 		tptr = 0;
+	} else if(stoptime == LINK_NOWAIT) {
+		/* The caller only wants what can be done without blocking. */
+		errno = EWOULDBLOCK;
+		return 0;
 	} else {
 		time_t timeout = stoptime - time(0);
 		if(timeout <= 0) {
@@ -284,6 +372,10 @@ static struct link *link_create()
 	link->raddr[0] = 0;
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
+	link->poll_set = 0;
+	link->rate_limit = 0;
+	link->rate_tokens = 0;
+	link->rate_last = 0;
 
 	return link;
 }
@@ -571,6 +663,8 @@ static ssize_t fill_buffer(struct link *link, time_t stoptime)
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			if(link->poll_set)
+				link_poll_set_mark(link->poll_set, link);
 			return chunk;
 		} else if(chunk == 0) {
 			link->buffer_start = link->buffer;
@@ -828,6 +922,8 @@ ssize_t link_putfstring(struct link *link, const char *fmt, time_t stoptime, ...
 void link_close(struct link *link)
 {
 	if(link) {
+		if(link->poll_set)
+			link_poll_set_remove(link->poll_set, link);
 		if(link->fd >= 0)
 			close(link->fd);
 		if(link->rport)
@@ -839,6 +935,8 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if(link) {
+		if(link->poll_set)
+			link_poll_set_remove(link->poll_set, link);
 		free(link);
 	}
 }
@@ -929,10 +1027,127 @@ ssize_t link_stream_to_buffer(struct link * link, char **buffer, time_t stoptime
 	return total;
 }
 
+#ifdef LINK_USE_SPLICE
+
+/* Move length bytes already in a pipe to fd, copying through userspace if fd does not accept splice. */
+static int link_splice_drain(int pipefd, int fd, ssize_t length)
+{
+	while(length > 0) {
+		ssize_t actual = splice(pipefd, NULL, fd, NULL, length, SPLICE_F_MOVE);
+		if(actual > 0) {
+			length -= actual;
+		} else if(actual < 0 && errno == EINTR) {
+			continue;
+		} else if(actual < 0 && errno == EINVAL) {
+			char buffer[1<<16];
+			ssize_t ractual = full_read(pipefd, buffer, MIN((ssize_t) sizeof(buffer), length));
+			if(ractual <= 0 || full_write(fd, buffer, ractual) != ractual)
+				return 0;
+			length -= ractual;
+		} else {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Receive from a socket into fd via a pipe, without copying through userspace. */
+static int64_t link_splice_to_fd(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+	int pipefd[2];
+
+	if(pipe(pipefd) < 0)
+		return LINK_ZERO_COPY_UNSUPPORTED;
+
+	while(length > 0) {
+		size_t chunk = MIN(LINK_SPLICE_CHUNK, length);
+
+		ssize_t ractual = splice(link->fd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(ractual > 0) {
+			link->read += ractual;
+			if(!link_splice_drain(pipefd[0], fd, ractual)) {
+				total = -1;
+				break;
+			}
+			link_pace_wait(link, ractual, stoptime);
+			total += ractual;
+			length -= ractual;
+		} else if(ractual == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 1, 0))
+				break;
+		} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+			total = LINK_ZERO_COPY_UNSUPPORTED;
+			break;
+		} else {
+			break;
+		}
+	}
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	return total;
+}
+
+/* Send from fd to a socket with sendfile, without copying through userspace. */
+static int64_t link_sendfile_from_fd(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+
+	while(length > 0) {
+		size_t chunk = MIN(LINK_SPLICE_CHUNK, length);
+
+		ssize_t wactual = sendfile(link->fd, fd, NULL, chunk);
+		if(wactual > 0) {
+			link->written += wactual;
+			link_pace_wait(link, wactual, stoptime);
+			total += wactual;
+			length -= wactual;
+		} else if(wactual == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 0, 1))
+				return -1;
+		} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+			return LINK_ZERO_COPY_UNSUPPORTED;
+		} else {
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+#endif
+
 int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
+#ifdef LINK_USE_SPLICE
+	if(link->type == LINK_TYPE_STANDARD && length >= LINK_SPLICE_MIN) {
+		/* Anything already buffered must go out first. */
+		while(link->buffer_length > 0 && length > 0) {
+			size_t chunk = MIN(link->buffer_length, (size_t)length);
+			if(full_write(fd, link->buffer_start, chunk) != (ssize_t) chunk)
+				return -1;
+			link->buffer_start += chunk;
+			link->buffer_length -= chunk;
+			total += chunk;
+			length -= chunk;
+		}
+
+		int64_t actual = link_splice_to_fd(link, fd, length, stoptime);
+		if(actual != LINK_ZERO_COPY_UNSUPPORTED) {
+			return actual < 0 ? actual : total + actual;
+		}
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -947,6 +1162,7 @@ int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t sto
 			break;
 		}
 
+		link_pace_wait(link, ractual, stoptime);
 		total += ractual;
 		length -= ractual;
 	}
@@ -972,6 +1188,7 @@ int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, tim
 			break;
 		}
 
+		link_pace_wait(link, ractual, stoptime);
 		total += ractual;
 		length -= ractual;
 	}
@@ -983,6 +1200,15 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 {
 	int64_t total = 0;
 
+#ifdef LINK_USE_SPLICE
+	if(link->type == LINK_TYPE_STANDARD) {
+		int64_t actual = link_sendfile_from_fd(link, fd, length, stoptime);
+		if(actual != LINK_ZERO_COPY_UNSUPPORTED) {
+			return actual;
+		}
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -997,6 +1223,7 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 			break;
 		}
 
+		link_pace_wait(link, ractual, stoptime);
 		total += ractual;
 		length -= ractual;
 	}
@@ -1004,6 +1231,76 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 	return total;
 }
 
+int64_t link_stream_from_fd_avail(struct link * link, int fd, int64_t length)
+{
+	int64_t total = 0;
+
+	/* A paced link takes no data until its bucket is out of debt, see link_rate_wait. */
+	if(link_rate_wait(link) > 0) {
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+
+#ifdef LINK_USE_SPLICE
+	if(link->type == LINK_TYPE_STANDARD) {
+		/* Keep a paced link from going deeper in debt than one burst. */
+		int64_t chunk = link->rate_limit > 0 ? MIN(LINK_SPLICE_CHUNK, (int64_t) link_rate_burst(link)) : LINK_SPLICE_CHUNK;
+
+		while(length > 0) {
+			ssize_t wactual = sendfile(link->fd, fd, NULL, MIN(chunk, length));
+			if(wactual > 0) {
+				link->written += wactual;
+				total += wactual;
+				length -= wactual;
+				if(link_pace(link, wactual) > 0)
+					return total;
+			} else if(wactual == 0) {
+				return total;
+			} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				break;
+			} else if(total > 0 && errno_is_temporary(errno)) {
+				return total;
+			} else {
+				return -1;
+			}
+		}
+
+		if(length == 0)
+			return total;
+	}
+#endif
+
+	while(length > 0) {
+		char buffer[1<<16];
+		size_t chunk = MIN(sizeof(buffer), (size_t)length);
+
+		ssize_t ractual = full_read(fd, buffer, chunk);
+		if(ractual <= 0)
+			return total > 0 ? total : ractual;
+
+		ssize_t wactual = link_write(link, buffer, ractual, LINK_NOWAIT);
+		if(wactual < ractual) {
+			/* Give back to the file what the link did not take. */
+			lseek(fd, -(off_t) (ractual - MAX(wactual, 0)), SEEK_CUR);
+			if(wactual > 0)
+				total += wactual;
+			if(total > 0)
+				return total;
+			if(wactual == 0)
+				errno = EWOULDBLOCK;
+			return -1;
+		}
+
+		total += ractual;
+		length -= ractual;
+
+		if(link_pace(link, ractual) > 0)
+			break;
+	}
+
+	return total;
+}
+
 int64_t link_stream_from_file(struct link * link, FILE * file, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
@@ -1022,6 +1319,7 @@ int64_t link_stream_from_file(struct link * link, FILE * file, int64_t length, t
 			break;
 		}
 
+		link_pace_wait(link, ractual, stoptime);
 		total += ractual;
 		length -= ractual;
 	}
@@ -1130,4 +1428,267 @@ int link_poll(struct link_info *links, int nlinks, int msec)
 	return result;
 }
 
+/*
+A poll set keeps links registered across calls, so that waiting costs
+time proportional to the number of active links rather than to the number
+of registered links.  On Linux, links are registered with an edge-triggered
+epoll instance.  Because an edge is reported only once, a link that was
+reported (or that has data sitting in its userspace buffer) is kept in the
+hot table, and is re-checked on every wait until it is found idle.
+Other systems fall back to calling poll on all registered links.
+*/
+
+struct link_poll_entry {
+	struct link *link;
+	int events;
+	int revents;
+	int registered;
+};
+
+struct link_poll_set {
+	int epfd;
+	struct itable *entries;
+	struct itable *hot;
+};
+
+struct link_poll_set *link_poll_set_create(void)
+{
+	struct link_poll_set *s = malloc(sizeof(*s));
+	if(!s)
+		return 0;
+
+	s->epfd = -1;
+#ifdef LINK_USE_EPOLL
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epfd < 0) {
+		debug(D_TCP, "epoll_create1 failed, falling back to poll: %s", strerror(errno));
+	}
+#endif
+	s->entries = itable_create(0);
+	s->hot = itable_create(0);
+
+	return s;
+}
+
+void link_poll_set_delete(struct link_poll_set *s)
+{
+	uint64_t fd;
+	struct link_poll_entry *e;
+
+	if(!s)
+		return;
+
+	itable_firstkey(s->entries);
+	while(itable_nextkey(s->entries, &fd, (void **) &e)) {
+		e->link->poll_set = 0;
+		free(e);
+	}
+
+	itable_delete(s->entries);
+	itable_delete(s->hot);
+	if(s->epfd >= 0)
+		close(s->epfd);
+	free(s);
+}
+
+int link_poll_set_size(struct link_poll_set *s)
+{
+	return itable_size(s->entries);
+}
+
+static void link_poll_set_mark(struct link_poll_set *s, struct link *l)
+{
+	struct link_poll_entry *e = itable_lookup(s->entries, l->fd);
+	if(e)
+		itable_insert(s->hot, l->fd, e);
+}
+
+int link_poll_set_add(struct link_poll_set *s, struct link *l, int events)
+{
+	struct link_poll_entry *e;
+
+	if(l->poll_set == s) {
+		e = itable_lookup(s->entries, l->fd);
+		if(e->events == events)
+			return 1;
+		link_poll_set_remove(s, l);
+	} else if(l->poll_set) {
+		link_poll_set_remove(l->poll_set, l);
+	}
+
+	e = malloc(sizeof(*e));
+	if(!e)
+		return 0;
+
+	e->link = l;
+	e->events = events;
+	e->revents = 0;
+	e->registered = 0;
+
+#ifdef LINK_USE_EPOLL
+	if(s->epfd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLET | EPOLLRDHUP;
+		if(events & LINK_READ)
+			ev.events |= EPOLLIN;
+		if(events & LINK_WRITE)
+			ev.events |= EPOLLOUT;
+		ev.data.ptr = e;
+
+		if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, l->fd, &ev) == 0) {
+			e->registered = 1;
+		} else if(errno != EPERM) {
+			/* EPERM means the fd (e.g. a regular file) cannot be waited on, and is treated as always hot. */
+			debug(D_TCP, "could not add fd %d to poll set: %s", l->fd, strerror(errno));
+			free(e);
+			return 0;
+		}
+	}
+#endif
+
+	itable_insert(s->entries, l->fd, e);
+	l->poll_set = s;
+
+	/* Anything that arrived before registration does not produce an edge. */
+	itable_insert(s->hot, l->fd, e);
+
+	return 1;
+}
+
+void link_poll_set_remove(struct link_poll_set *s, struct link *l)
+{
+	struct link_poll_entry *e;
+
+	if(l->poll_set != s)
+		return;
+
+	e = itable_remove(s->entries, l->fd);
+	itable_remove(s->hot, l->fd);
+	l->poll_set = 0;
+
+	if(!e)
+		return;
+
+#ifdef LINK_USE_EPOLL
+	if(e->registered) {
+		struct epoll_event ev;
+		epoll_ctl(s->epfd, EPOLL_CTL_DEL, l->fd, &ev);
+	}
+#endif
+
+	free(e);
+}
+
+/* Check the given entries with a non-blocking poll, and set their revents. */
+static int link_poll_set_check(struct link_poll_entry **entries, int n, int msec)
+{
+	struct pollfd *fds = malloc(n * sizeof(struct pollfd));
+	int i;
+	int result;
+
+	memset(fds, 0, n * sizeof(struct pollfd));
+
+	for(i = 0; i < n; i++) {
+		fds[i].fd = entries[i]->link->fd;
+		fds[i].events = link_to_poll(entries[i]->events);
+		if(entries[i]->link->buffer_length) {
+			msec = 0;
+		}
+	}
+
+	result = poll(fds, n, msec);
+
+	if(result >= 0) {
+		result = 0;
+		for(i = 0; i < n; i++) {
+			entries[i]->revents = poll_to_link(fds[i].revents);
+			if(entries[i]->link->buffer_length) {
+				entries[i]->revents |= LINK_READ;
+			}
+			if(entries[i]->revents)
+				result++;
+		}
+	}
+
+	free(fds);
+
+	return result;
+}
+
+static int link_poll_set_collect(struct itable *table, struct link_poll_entry ***entries)
+{
+	uint64_t fd;
+	struct link_poll_entry *e;
+	int n = 0;
+
+	*entries = malloc(MAX(1, itable_size(table)) * sizeof(**entries));
+
+	itable_firstkey(table);
+	while(itable_nextkey(table, &fd, (void **) &e)) {
+		(*entries)[n++] = e;
+	}
+
+	return n;
+}
+
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *links, int nlinks, int msec)
+{
+	struct link_poll_entry **entries;
+	int i, n;
+	int result = 0;
+
+	if(s->epfd < 0) {
+		/* No epoll: every registered link is checked every time. */
+		n = link_poll_set_collect(s->entries, &entries);
+		link_poll_set_check(entries, n, msec);
+	} else {
+#ifdef LINK_USE_EPOLL
+		struct epoll_event events[256];
+
+		/* Drop hot links that turn out to be idle, and do not block if any are still ready. */
+		n = link_poll_set_collect(s->hot, &entries);
+		if(n > 0) {
+			int ready = link_poll_set_check(entries, n, 0);
+			for(i = 0; i < n; i++) {
+				if(!entries[i]->revents && entries[i]->registered)
+					itable_remove(s->hot, entries[i]->link->fd);
+			}
+			if(ready > 0)
+				msec = 0;
+		}
+		free(entries);
+
+		int nevents = epoll_wait(s->epfd, events, sizeof(events) / sizeof(*events), msec);
+		for(i = 0; i < nevents; i++) {
+			struct link_poll_entry *e = events[i].data.ptr;
+			int r = 0;
+			if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+				r |= LINK_READ;
+			if(events[i].events & EPOLLOUT)
+				r |= LINK_WRITE;
+			e->revents |= r & e->events;
+			itable_insert(s->hot, e->link->fd, e);
+		}
+
+		n = link_poll_set_collect(s->hot, &entries);
+#endif
+	}
+
+	/* Report ready links; those that do not fit remain hot for the next call. */
+	for(i = 0; i < n && result < nlinks; i++) {
+		if(entries[i]->revents) {
+			links[result].link = entries[i]->link;
+			links[result].events = entries[i]->events;
+			links[result].revents = entries[i]->revents;
+			entries[i]->revents = 0;
+			result++;
+		}
+	}
+
+	free(entries);
+
+	return result;
+}
+
 /* vim: set noexpandtab tabstop=4: */
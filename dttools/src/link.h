@@ -58,6 +58,7 @@ link_close(link);
 
 /** Stoptime to give when you wish to wait forever */
 #define LINK_FOREVER ((time_t)INT_MAX)
+/** Stoptime to give when an operation should only do what it can without blocking. */
 #define LINK_NOWAIT ((time_t)INT_MIN)
 
 /** Connect to a remote host.
@@ -306,10 +307,37 @@ int64_t link_stream_to_fd(struct link *link, int fd, int64_t length, time_t stop
 int64_t link_stream_to_file(struct link *link, FILE * file, int64_t length, time_t stoptime);
 
 int64_t link_stream_from_fd(struct link *link, int fd, int64_t length, time_t stoptime);
+/** Send data from a file without blocking.
+Sends up to length bytes from the current offset of fd, for as long as the link
+accepts them without blocking, and leaves the offset of fd after the last byte sent.
+@param link The link to write.
+@param fd The file descriptor to read from.
+@param length The maximum number of bytes to send.
+@return The number of bytes sent, zero if fd reached end of file, or less than zero on error. If the link cannot accept any data yet, errno is set to EWOULDBLOCK.
+*/
+int64_t link_stream_from_fd_avail(struct link *link, int fd, int64_t length);
 int64_t link_stream_from_file(struct link *link, FILE * file, int64_t length, time_t stoptime);
 
 int64_t link_soak(struct link *link, int64_t length, time_t stoptime);
 
+/** Limit the bandwidth used by a link.
+Payloads moved with the stream functions, such as @ref link_stream_to_fd and
+@ref link_stream_from_fd, are paced with a token bucket so that the average
+rate does not exceed the limit. Messages sent with @ref link_write and read
+with @ref link_read are never delayed. The blocking stream functions wait
+as needed, while @ref link_stream_from_fd_avail takes no data until
+@ref link_rate_wait returns zero.
+@param link The link to limit.
+@param bytes_per_second The maximum rate in bytes per second, or zero for no limit.
+*/
+void link_rate_limit(struct link *link, double bytes_per_second);
+
+/** Time until a rate limited link may move more payload.
+@param link The link to check.
+@return The number of microseconds to wait, or zero if data may be moved now.
+*/
+int64_t link_rate_wait(struct link *link);
+
 /** Options for link performance tuning. */
 typedef enum {
 	LINK_TUNE_INTERACTIVE,	/**< Data is sent immediately to optimze interactive latency. */
@@ -347,6 +375,55 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** A set of links that remain registered across calls to @ref link_poll_set_wait.
+Unlike @ref link_poll, the cost of waiting does not grow with the number of idle links.
+On Linux this is backed by an edge-triggered epoll instance. A link is removed
+from its set automatically by @ref link_close and @ref link_detach.
+*/
+struct link_poll_set;
+
+/** Create an empty poll set.
+@return A new poll set, or null on failure.
+*/
+struct link_poll_set *link_poll_set_create(void);
+
+/** Delete a poll set. The links in the set are not closed.
+@param s The poll set to delete.
+*/
+void link_poll_set_delete(struct link_poll_set *s);
+
+/** Add a link to a poll set, or change the events of a link already in the set.
+A link may belong to at most one poll set at a time.
+@param s The poll set.
+@param link The link to add.
+@param events The events of interest (@ref LINK_READ or @ref LINK_WRITE).
+@return One on success, zero on failure.
+*/
+int link_poll_set_add(struct link_poll_set *s, struct link *link, int events);
+
+/** Remove a link from a poll set.
+@param s The poll set.
+@param link The link to remove.
+*/
+void link_poll_set_remove(struct link_poll_set *s, struct link *link);
+
+/** Return the number of links in a poll set.
+@param s The poll set.
+@return The number of links registered.
+*/
+int link_poll_set_size(struct link_poll_set *s);
+
+/** Wait for activity on the links of a poll set.
+A link reported ready is reported again by later calls for as long as it remains ready,
+so the caller does not need to drain a link completely before waiting again.
+@param s The poll set.
+@param array Pointer to an array of @ref link_info structures, which is filled with the links that are ready.
+@param nlinks The length of the array. Ready links that do not fit are reported by the next call.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of entries filled in array.
+*/
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *array, int nlinks, int msec);
+
 int errno_is_temporary(int e);
 
 #endif
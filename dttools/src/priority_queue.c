@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "priority_queue.h"
+#include "xxmalloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define DEFAULT_CAPACITY 127
+
+struct priority_queue_entry {
+	void *item;
+	double priority;
+	uint64_t sequence;
+};
+
+struct priority_queue {
+	struct priority_queue_entry *entries;
+	int size;
+	int capacity;
+	uint64_t sequence;
+};
+
+/* a is returned before b if it has a higher priority, or the same priority and was pushed first. */
+
+static int entry_before(const struct priority_queue_entry *a, const struct priority_queue_entry *b)
+{
+	if(a->priority != b->priority) {
+		return a->priority > b->priority;
+	}
+	return a->sequence < b->sequence;
+}
+
+static void entry_swap(struct priority_queue *q, int i, int j)
+{
+	struct priority_queue_entry tmp = q->entries[i];
+	q->entries[i] = q->entries[j];
+	q->entries[j] = tmp;
+}
+
+struct priority_queue *priority_queue_create(int capacity)
+{
+	struct priority_queue *q = xxcalloc(1, sizeof(*q));
+
+	if(capacity < 1)
+		capacity = DEFAULT_CAPACITY;
+
+	q->capacity = capacity;
+	q->entries = xxmalloc(q->capacity * sizeof(*q->entries));
+
+	return q;
+}
+
+void priority_queue_delete(struct priority_queue *q)
+{
+	if(!q)
+		return;
+
+	free(q->entries);
+	free(q);
+}
+
+void priority_queue_push(struct priority_queue *q, void *item, double priority)
+{
+	if(q->size == q->capacity) {
+		q->capacity *= 2;
+		q->entries = xxrealloc(q->entries, q->capacity * sizeof(*q->entries));
+	}
+
+	int i = q->size++;
+	q->entries[i].item = item;
+	q->entries[i].priority = priority;
+	q->entries[i].sequence = q->sequence++;
+
+	while(i > 0) {
+		int parent = (i - 1) / 2;
+		if(!entry_before(&q->entries[i], &q->entries[parent]))
+			break;
+		entry_swap(q, i, parent);
+		i = parent;
+	}
+}
+
+void *priority_queue_pop(struct priority_queue *q)
+{
+	if(q->size < 1)
+		return 0;
+
+	void *item = q->entries[0].item;
+
+	q->size--;
+	q->entries[0] = q->entries[q->size];
+
+	int i = 0;
+	while(1) {
+		int left = 2 * i + 1;
+		int right = left + 1;
+		int first = i;
+
+		if(left < q->size && entry_before(&q->entries[left], &q->entries[first]))
+			first = left;
+		if(right < q->size && entry_before(&q->entries[right], &q->entries[first]))
+			first = right;
+		if(first == i)
+			break;
+
+		entry_swap(q, i, first);
+		i = first;
+	}
+
+	return item;
+}
+
+void *priority_queue_peek(struct priority_queue *q)
+{
+	if(q->size < 1)
+		return 0;
+
+	return q->entries[0].item;
+}
+
+int priority_queue_size(struct priority_queue *q)
+{
+	return q->size;
+}
+
+/* vim: set noexpandtab tabstop=4: */
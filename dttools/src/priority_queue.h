@@ -0,0 +1,68 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PRIORITY_QUEUE_H
+#define PRIORITY_QUEUE_H
+
+/** @file priority_queue.h A priority queue of arbitrary objects.
+Objects are returned in order of decreasing priority.  Objects pushed with
+the same priority are returned in the order in which they were pushed.
+Pushing and popping take logarithmic time in the size of the queue.
+<pre>
+struct priority_queue *q = priority_queue_create(0);
+
+priority_queue_push(q, job_a, 1);
+priority_queue_push(q, job_b, 10);
+
+job = priority_queue_pop(q);   // job_b
+job = priority_queue_pop(q);   // job_a
+</pre>
+*/
+
+/** Create a new priority queue.
+@param capacity The initial number of slots in the queue. If zero, a default value is used. Increases dynamically as needed.
+@return A pointer to a new priority queue.
+*/
+
+struct priority_queue *priority_queue_create(int capacity);
+
+/** Delete a priority queue.
+Note that this function will not free the objects contained within the queue.
+@param q A pointer to a priority queue.
+*/
+
+void priority_queue_delete(struct priority_queue *q);
+
+/** Add an object to a priority queue.
+@param q A pointer to a priority queue.
+@param item The object to add.
+@param priority The priority of the object. Higher priorities are returned first, and objects of equal priority are returned in the order they were pushed.
+*/
+
+void priority_queue_push(struct priority_queue *q, void *item, double priority);
+
+/** Remove the object with the highest priority.
+@param q A pointer to a priority queue.
+@return The object with the highest priority, or null if the queue is empty.
+*/
+
+void *priority_queue_pop(struct priority_queue *q);
+
+/** Get the object with the highest priority without removing it.
+@param q A pointer to a priority queue.
+@return The object with the highest priority, or null if the queue is empty.
+*/
+
+void *priority_queue_peek(struct priority_queue *q);
+
+/** Count the objects in a priority queue.
+@param q A pointer to a priority queue.
+@return The number of objects in the queue.
+*/
+
+int priority_queue_size(struct priority_queue *q);
+
+#endif
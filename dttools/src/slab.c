@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "slab.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_ITEMS_PER_CHUNK 1024
+
+/* Objects are aligned as malloc would align them. */
+#define SLAB_ALIGN 16
+
+struct slab_chunk {
+	struct slab_chunk *next;
+};
+
+struct slab_free_item {
+	struct slab_free_item *next;
+};
+
+struct slab {
+	size_t item_size;
+	int items_per_chunk;
+	struct slab_chunk *chunks;
+	struct slab_free_item *free_items;
+	INT64_T bytes;
+	INT64_T items;
+};
+
+/* The header of a chunk takes a whole alignment unit, so that objects stay aligned. */
+#define SLAB_CHUNK_HEADER (((sizeof(struct slab_chunk) + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN)
+
+struct slab *slab_create(size_t item_size, int items_per_chunk)
+{
+	struct slab *s = xxcalloc(1, sizeof(*s));
+
+	if(item_size < sizeof(struct slab_free_item))
+		item_size = sizeof(struct slab_free_item);
+
+	s->item_size = ((item_size + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN;
+	s->items_per_chunk = items_per_chunk > 0 ? items_per_chunk : DEFAULT_ITEMS_PER_CHUNK;
+
+	return s;
+}
+
+void slab_delete(struct slab *s)
+{
+	if(!s)
+		return;
+
+	while(s->chunks) {
+		struct slab_chunk *c = s->chunks;
+		s->chunks = c->next;
+		free(c);
+	}
+
+	free(s);
+}
+
+static void slab_grow(struct slab *s)
+{
+	size_t size = SLAB_CHUNK_HEADER + s->item_size * s->items_per_chunk;
+	struct slab_chunk *c = xxmalloc(size);
+
+	c->next = s->chunks;
+	s->chunks = c;
+	s->bytes += size;
+
+	/* Thread the new objects onto the free list, lowest address first. */
+	char *base = ((char *) c) + SLAB_CHUNK_HEADER;
+	int i;
+	for(i = s->items_per_chunk - 1; i >= 0; i--) {
+		struct slab_free_item *item = (struct slab_free_item *) (base + i * s->item_size);
+		item->next = s->free_items;
+		s->free_items = item;
+	}
+}
+
+void *slab_alloc(struct slab *s)
+{
+	if(!s->free_items)
+		slab_grow(s);
+
+	struct slab_free_item *item = s->free_items;
+	s->free_items = item->next;
+	s->items++;
+
+	memset(item, 0, s->item_size);
+
+	return item;
+}
+
+void slab_free(struct slab *s, void *item)
+{
+	if(!item)
+		return;
+
+	struct slab_free_item *f = item;
+	f->next = s->free_items;
+	s->free_items = f;
+	s->items--;
+}
+
+INT64_T slab_bytes(struct slab *s)
+{
+	return s->bytes;
+}
+
+INT64_T slab_items(struct slab *s)
+{
+	return s->items;
+}
+
+/* vim: set noexpandtab tabstop=4: */
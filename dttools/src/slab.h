@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "int_sizes.h"
+
+#include <stddef.h>
+
+/** @file slab.h A slab allocator for many objects of the same size.
+Objects are carved out of large chunks rather than allocated one by one,
+which avoids the per-allocation overhead of malloc when a program keeps
+a great number of small records.  Freed objects are kept for reuse by
+the same slab; the chunks are returned to the system only by @ref slab_delete.
+<pre>
+struct slab *s = slab_create(sizeof(struct record), 0);
+
+struct record *r = slab_alloc(s);
+...
+slab_free(s, r);
+
+slab_delete(s);
+</pre>
+*/
+
+/** Create a new slab.
+@param item_size The size of the objects allocated from the slab.
+@param items_per_chunk The number of objects in each chunk. If zero, a default value is used.
+@return A pointer to a new slab.
+*/
+
+struct slab *slab_create(size_t item_size, int items_per_chunk);
+
+/** Delete a slab and all the objects allocated from it.
+@param s The slab to delete.
+*/
+
+void slab_delete(struct slab *s);
+
+/** Allocate an object from a slab.
+@param s The slab to allocate from.
+@return A pointer to a zero-filled object of the size given to @ref slab_create.
+*/
+
+void *slab_alloc(struct slab *s);
+
+/** Return an object to the slab it was allocated from.
+@param s The slab the object was allocated from.
+@param item The object to free. If null, nothing is done.
+*/
+
+void slab_free(struct slab *s, void *item);
+
+/** Get the memory held by a slab.
+@param s The slab to examine.
+@return The number of bytes in the chunks of the slab, whether in use or not.
+*/
+
+INT64_T slab_bytes(struct slab *s);
+
+/** Get the number of objects in use.
+@param s The slab to examine.
+@return The number of objects allocated and not yet freed.
+*/
+
+INT64_T slab_items(struct slab *s);
+
+#endif
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "string_intern.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BUCKETS 1024
+
+struct string_intern_entry {
+	struct string_intern_entry *next;
+	unsigned hash;
+	int refcount;
+	char str[1];
+};
+
+static struct string_intern_entry **buckets = 0;
+static unsigned bucket_count = 0;
+static unsigned entry_count = 0;
+static INT64_T bytes = 0;
+
+static void string_intern_grow()
+{
+	unsigned new_count = bucket_count ? bucket_count * 2 : DEFAULT_BUCKETS;
+	struct string_intern_entry **new_buckets = xxcalloc(new_count, sizeof(*new_buckets));
+
+	unsigned i;
+	for(i = 0; i < bucket_count; i++) {
+		struct string_intern_entry *e = buckets[i];
+		while(e) {
+			struct string_intern_entry *next = e->next;
+			unsigned index = e->hash % new_count;
+			e->next = new_buckets[index];
+			new_buckets[index] = e;
+			e = next;
+		}
+	}
+
+	bytes += (INT64_T) (new_count - bucket_count) * sizeof(*buckets);
+
+	free(buckets);
+	buckets = new_buckets;
+	bucket_count = new_count;
+}
+
+const char *string_intern(const char *s)
+{
+	if(!s)
+		return 0;
+
+	if(entry_count >= bucket_count)
+		string_intern_grow();
+
+	unsigned hash = hash_string(s);
+	unsigned index = hash % bucket_count;
+
+	struct string_intern_entry *e;
+	for(e = buckets[index]; e; e = e->next) {
+		if(e->hash == hash && !strcmp(e->str, s)) {
+			e->refcount++;
+			return e->str;
+		}
+	}
+
+	size_t length = strlen(s);
+	size_t size = sizeof(*e) + length;
+
+	e = xxmalloc(size);
+	memcpy(e->str, s, length + 1);
+	e->hash = hash;
+	e->refcount = 1;
+	e->next = buckets[index];
+	buckets[index] = e;
+
+	entry_count++;
+	bytes += size;
+
+	return e->str;
+}
+
+void string_intern_release(const char *s)
+{
+	if(!s || !bucket_count)
+		return;
+
+	unsigned hash = hash_string(s);
+	struct string_intern_entry **p = &buckets[hash % bucket_count];
+
+	for(; *p; p = &(*p)->next) {
+		struct string_intern_entry *e = *p;
+		if(e->str == s) {
+			if(--e->refcount == 0) {
+				*p = e->next;
+				entry_count--;
+				bytes -= sizeof(*e) + strlen(e->str);
+				free(e);
+			}
+			return;
+		}
+	}
+}
+
+INT64_T string_intern_bytes()
+{
+	return bytes;
+}
+
+/* vim: set noexpandtab tabstop=4: */
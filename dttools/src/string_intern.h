@@ -0,0 +1,47 @@
+/*
+Copyright (C) 2019- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef STRING_INTERN_H
+#define STRING_INTERN_H
+
+#include "int_sizes.h"
+
+/** @file string_intern.h Shared copies of repeated strings.
+A program that keeps many copies of the same strings, such as the file
+names of a great number of tasks, may keep a single reference-counted copy
+of each distinct string instead.  Interned strings must not be modified,
+and are given back with @ref string_intern_release rather than free.
+<pre>
+const char *a = string_intern("input.dat");
+const char *b = string_intern("input.dat");
+
+assert(a == b);
+
+string_intern_release(a);
+string_intern_release(b);
+</pre>
+*/
+
+/** Get the shared copy of a string.
+@param s The string to intern.
+@return The shared copy of the string, which is valid until released as many times as it was interned. If s is null, null is returned.
+*/
+
+const char *string_intern(const char *s);
+
+/** Release a shared copy of a string.
+@param s A string returned by @ref string_intern. If null, nothing is done.
+*/
+
+void string_intern_release(const char *s);
+
+/** Get the memory held by interned strings.
+@return The number of bytes used by the distinct interned strings and the table that holds them.
+*/
+
+INT64_T string_intern_bytes();
+
+#endif
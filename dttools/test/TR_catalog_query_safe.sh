@@ -0,0 +1,209 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="catalog_query_safe.test"
+portfile="catalog_query_safe.port"
+pidfile="catalog_query_safe.pid"
+secret="catalog_query_safe.json"
+history="catalog_query_safe.history"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lz -lm <<EOF
+#include "b64.h"
+#include "buffer.h"
+#include "catalog_query.h"
+#include "debug.h"
+#include "http_query.h"
+#include "jx.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "link.h"
+#include "stringtools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int is_safe(const char *text)
+{
+	struct jx *j = jx_parse_string(text);
+	if(!j) fatal("couldn't parse %s", text);
+	int result = jx_eval_is_safe(j);
+	jx_delete(j);
+	return result;
+}
+
+static char *encode(const char *text)
+{
+	buffer_t B;
+	buffer_init(&B);
+	b64_encode(text, strlen(text), &B);
+	char *result = strdup(buffer_tostring(&B));
+	buffer_free(&B);
+	return result;
+}
+
+/* Fetch a url and return the body of the response. */
+static char *get(const char *url)
+{
+	struct link *l = http_query(url, "GET", time(0) + 10);
+	if(!l) fatal("couldn't query %s", url);
+
+	buffer_t B;
+	char data[4096];
+	ssize_t n;
+	buffer_init(&B);
+	while((n = link_read(l, data, sizeof(data), time(0) + 10)) > 0) {
+		buffer_putlstring(&B, data, n);
+	}
+	link_close(l);
+
+	char *result = strdup(buffer_tostring(&B));
+	buffer_free(&B);
+	return result;
+}
+
+/* Send a request line of the given length, and return the status line of the response. */
+static char *request_status(int port, int length)
+{
+	struct link *l = link_connect("127.0.0.1", port, time(0) + 10);
+	if(!l) fatal("couldn't connect to port %d", port);
+
+	char *path = malloc(length + 1);
+	memset(path, 'a', length);
+	path[length] = 0;
+	link_putfstring(l, "GET /query/%s HTTP/1.1\r\n\r\n", time(0) + 10, path);
+	free(path);
+
+	char line[1024];
+	if(!link_readline(l, line, sizeof(line), time(0) + 10)) line[0] = 0;
+	link_close(l);
+	return strdup(line);
+}
+
+static char *query(int port, const char *filter, const char *select)
+{
+	char *f = encode(filter);
+	char *s = select ? encode(select) : 0;
+	char *url = string_format("http://127.0.0.1:%d/query/%s%s%s", port, f, s ? "?select=" : "", s ? s : "");
+	char *result = get(url);
+	free(f);
+	free(s);
+	free(url);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	int port = atoi(argv[1]);
+	const char *secret = argv[2];
+	char *expr;
+	char *body;
+	int i;
+
+	if(!is_safe("type==\"wq_master\" && like(name,\"host.*\")")) fatal("safe filter refused");
+	if(!is_safe("{\"name\":name,\"n\":len(keys(x))}")) fatal("safe projection refused");
+	if(is_safe("[len(x) for x in items if x>1]")) fatal("comprehension accepted");
+	if(is_safe("{\"a\":[[x for x in [1,2]]]}")) fatal("nested comprehension accepted");
+	if(is_safe("project(project(1,[{},{}]),[{},{}])")) fatal("project accepted");
+	if(is_safe("select(true,[{},{}])")) fatal("select accepted");
+	if(is_safe("fetch(\"/etc/hostname\")")) fatal("fetch accepted");
+	if(is_safe("listdir(\"/\")")) fatal("listdir accepted");
+	if(is_safe("{\"a\":[listdir(\"/\")]}")) fatal("nested listdir accepted");
+	if(is_safe("[x for x in range(1000000000)]")) fatal("range accepted");
+	if(is_safe("true && len(fetch(\"/etc/hostname\"))>0")) fatal("fetch inside operator accepted");
+
+	char *hostport = string_format("127.0.0.1:%d", port);
+	catalog_query_send_update(hostport, "{\"type\":\"test\",\"name\":\"safe\",\"port\":1}");
+
+	for(i = 0; i < 10; i++) {
+		body = query(port, "type==\"test\"", "{\"port\":port}");
+		if(strstr(body, "\"port\":1")) break;
+		free(body);
+		body = 0;
+		sleep(1);
+	}
+	if(!body) fatal("safe query returned nothing");
+	free(body);
+
+	expr = string_format("fetch(\"%s\")", secret);
+	body = query(port, "true", expr);
+	if(strstr(body, "SECRET")) fatal("fetch in projection was evaluated: %s", body);
+	if(body[0]) fatal("fetch in projection was not refused: %s", body);
+	free(body);
+
+	free(expr);
+
+	expr = string_format("len(fetch(\"%s\"))>0", secret);
+	body = query(port, expr, 0);
+	if(body[0]) fatal("fetch in filter was not refused: %s", body);
+	free(body);
+	free(expr);
+
+	body = query(port, "true", "listdir(\"/\")");
+	if(body[0]) fatal("listdir in projection was not refused: %s", body);
+	free(body);
+
+	/* Each clause multiplies the items produced. */
+	expr = strdup("[1 for a in [1,2,3,4,5,6,7,8,9,10] for b in [1,2,3,4,5,6,7,8,9,10] for c in [1,2,3,4,5,6,7,8,9,10] for d in [1,2,3,4,5,6,7,8,9,10] for e in [1,2,3,4,5,6,7,8,9,10]]");
+	body = query(port, "true", expr);
+	if(body[0]) fatal("nested comprehensions were not refused: %s", body);
+	free(body);
+	free(expr);
+
+	/* Requests too long to read whole are refused, not cut short. */
+	body = request_status(port, 100);
+	if(!strstr(body, " 200 ")) fatal("short request was refused: %s", body);
+	free(body);
+	body = request_status(port, 100000);
+	if(!strstr(body, " 414 ")) fatal("long request was not refused: %s", body);
+	free(body);
+
+	/* A filter too long to send is applied by the client. */
+	buffer_t B;
+	buffer_init(&B);
+	buffer_putliteral(&B, "type==\"test\" && type!=\"");
+	for(i = 0; i < 2000; i++) buffer_putliteral(&B, "x");
+	buffer_putliteral(&B, "\"");
+	struct catalog_query *q = catalog_query_create(hostport, jx_parse_string(buffer_tostring(&B)), time(0) + 10);
+	buffer_free(&B);
+	if(!q) fatal("query with a long filter failed");
+	struct jx *j = catalog_query_read(q, time(0) + 10);
+	if(!j || jx_lookup_integer(j, "port") != 1) fatal("query with a long filter returned the wrong record: %s", j ? jx_print_string(j) : "none");
+	jx_delete(j);
+	if(catalog_query_read(q, time(0) + 10)) fatal("query with a long filter returned extra records");
+	catalog_query_delete(q);
+
+	free(hostport);
+	return 0;
+}
+EOF
+	[ $? -eq 0 ] || return 1
+
+	echo '{"secret":"SECRET"}' > "$secret"
+
+	rm -f "$portfile"
+	../src/catalog_server -Z "$portfile" -H "$history" -u 127.0.0.1:1 -B "$pidfile" -b
+	wait_for_file_creation "$portfile" 5
+}
+
+run()
+{
+	./"$exe" $(cat "$portfile") "$(pwd)/$secret"
+	return $?
+}
+
+clean()
+{
+	[ -f "$pidfile" ] && kill $(cat "$pidfile")
+	rm -rf "$exe" "$portfile" "$pidfile" "$secret" "$history"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,160 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="jx_arena.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+static const char *document = "{\"name\":\"a\",\"list\":[1,2.5,true,null,\"x\"],\"sub\":{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17}}";
+
+static void test_mixed_delete()
+{
+	struct jx *heap = jx_parse_string(document);
+
+	struct jx_arena *arena = jx_arena_create();
+	jx_arena_enter(arena);
+	struct jx *doc = jx_parse_string(document);
+	struct jx *loose = jx_array(0);
+	jx_array_append(loose, jx_string("from the arena"));
+	jx_arena_leave(arena);
+
+	CHECK(jx_equals(doc, heap));
+
+	/* the large object gets an index, which lives outside of the arena. */
+	struct jx *sub = jx_lookup(doc, "sub");
+	CHECK(jx_lookup_integer(sub, "k17") == 17);
+	CHECK(sub->index);
+
+	/* heap values inserted into an arena document, both above and below the indexed object. */
+	jx_insert(doc, jx_string("heap"), jx_string("outside of the arena"));
+	jx_insert(sub, jx_string("k18"), jx_integer(18));
+	jx_array_append(jx_lookup(doc, "list"), jx_parse_string("{\"nested\":[\"heap\"]}"));
+	CHECK(jx_lookup_integer(sub, "k18") == 18);
+
+	/* an arena value inserted into a heap document. */
+	jx_insert(heap, jx_string("arena"), loose);
+
+	/* deleting an arena document frees only its heap values, and its index. */
+	jx_delete(doc);
+	CHECK(!sub->index);
+
+	/* deleting a heap document frees none of the arena values within it. */
+	jx_delete(heap);
+
+	jx_arena_delete(arena);
+}
+
+static void test_nested_arenas()
+{
+	struct jx_arena *outer = jx_arena_create();
+	struct jx_arena *inner = jx_arena_create();
+
+	jx_arena_enter(outer);
+	struct jx *a = jx_parse_string(document);
+	jx_arena_enter(inner);
+	struct jx *b = jx_parse_string(document);
+	jx_arena_leave(inner);
+	struct jx *c = jx_copy(b);
+	jx_arena_leave(outer);
+
+	CHECK(jx_equals(a, b));
+	CHECK(jx_equals(b, c));
+
+	jx_arena_delete(inner);
+	CHECK(jx_lookup_integer(jx_lookup(c, "sub"), "k17") == 17);
+
+	jx_delete(a);
+	jx_delete(c);
+	jx_arena_delete(outer);
+}
+
+static void test_intern()
+{
+	char key[128];
+	int i;
+
+	struct jx *a = jx_key("name");
+	struct jx *b = jx_key("name");
+	CHECK(!strcmp(a->u.string_value, "name"));
+	CHECK(a->u.string_value == b->u.string_value);
+
+	/* keys parsed into objects share the interned copy. */
+	struct jx *doc = jx_parse_string("{\"name\":1}");
+	CHECK(doc->u.pairs->key->u.string_value == a->u.string_value);
+	jx_delete(doc);
+
+	struct jx *s = jx_string("name");
+	jx_key_intern(s);
+	CHECK(s->u.string_value == a->u.string_value);
+
+	/* long keys are not interned. */
+	memset(key, 'x', 100);
+	key[100] = 0;
+	struct jx *l1 = jx_key(key);
+	struct jx *l2 = jx_key(key);
+	CHECK(!strcmp(l1->u.string_value, key));
+	CHECK(l1->u.string_value != l2->u.string_value);
+
+	/* the table stops growing at its limit, and keys past it get copies of their own. */
+	for(i = 0; i < 10000; i++) {
+		sprintf(key, "key%d", i);
+		jx_delete(jx_key(key));
+	}
+
+	struct jx *f1 = jx_key("key9999");
+	struct jx *f2 = jx_key("key9999");
+	CHECK(!strcmp(f1->u.string_value, "key9999"));
+	CHECK(f1->u.string_value != f2->u.string_value);
+
+	/* keys interned before the limit was reached are still shared, and were never freed. */
+	struct jx *c = jx_key("name");
+	CHECK(c->u.string_value == a->u.string_value);
+	CHECK(!strcmp(c->u.string_value, "name"));
+
+	jx_delete(a);
+	jx_delete(b);
+	jx_delete(c);
+	jx_delete(s);
+	jx_delete(l1);
+	jx_delete(l2);
+	jx_delete(f1);
+	jx_delete(f2);
+}
+
+int main(int argc, char *argv[])
+{
+	test_mixed_delete();
+	test_nested_arenas();
+	test_intern();
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
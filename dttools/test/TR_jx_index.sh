@@ -0,0 +1,126 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="jx_index.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "jx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS 40
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+/* The value of the first pair with key, as found by walking the list. */
+static struct jx *walk_lookup(struct jx *object, const char *key)
+{
+	struct jx_pair *p;
+	for(p = object->u.pairs; p; p = p->next) {
+		if(p->key && p->key->type == JX_STRING && !strcmp(p->key->u.string_value, key)) {
+			return p->value;
+		}
+	}
+	return 0;
+}
+
+static void check_all(struct jx *object, int step)
+{
+	char key[16];
+	int i;
+
+	for(i = 0; i < KEYS; i++) {
+		sprintf(key, "k%d", i);
+		if(jx_lookup(object, key) != walk_lookup(object, key)) {
+			fprintf(stderr, "step %d: lookup of %s disagrees with a walk of the list\n", step, key);
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct jx *object = jx_object(0);
+	char key[16];
+	int i, step;
+
+	/* enough pairs for the first lookup to build the index. */
+	for(i = 0; i < KEYS; i++) {
+		sprintf(key, "k%d", i);
+		jx_insert(object, jx_string(key), jx_integer(i));
+	}
+	check_all(object, 0);
+	CHECK(object->index);
+
+	srand(17);
+	for(step = 1; step <= 20000; step++) {
+		sprintf(key, "k%d", rand() % KEYS);
+		struct jx *value;
+
+		switch(rand() % 4) {
+			case 0:
+				/* a key may already be present, leaving a duplicate further down the list. */
+				jx_insert(object, jx_string(key), jx_integer(step));
+				break;
+			case 1:
+				/* pairs pushed on the head of the list, as deltadb does, here twice with the same key. */
+				object->u.pairs = jx_pair(jx_string(key), jx_integer(step), object->u.pairs);
+				object->u.pairs = jx_pair(jx_string(key), jx_integer(-step), object->u.pairs);
+				break;
+			case 2: {
+				struct jx *k = jx_string("absent");
+				CHECK(!jx_remove(object, k));
+				jx_delete(k);
+				break;
+			}
+			case 3: {
+				struct jx *k = jx_string(key);
+				value = walk_lookup(object, key);
+				struct jx *removed = jx_remove(object, k);
+				CHECK(removed == value);
+				jx_delete(removed);
+				jx_delete(k);
+				break;
+			}
+		}
+
+		check_all(object, step);
+	}
+
+	/* a copy gets an index of its own, and finds the same values. */
+	struct jx *copy = jx_copy(object);
+	for(i = 0; i < KEYS; i++) {
+		sprintf(key, "k%d", i);
+		struct jx *a = jx_lookup(object, key);
+		struct jx *b = jx_lookup(copy, key);
+		CHECK((!a && !b) || (a && b && jx_equals(a, b)));
+	}
+
+	jx_delete(copy);
+	jx_delete(object);
+
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,253 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="jx_parse_string.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+/* A backslash, spelled out to keep it away from the shell. */
+#define BS 92
+
+static int compared = 0;
+
+static struct jx *parse(const char *text, int from_string, char **error)
+{
+	struct jx_parser *p = jx_parser_create(0);
+	FILE *file = 0;
+
+	if(from_string) {
+		jx_parser_read_string(p, text);
+	} else {
+		file = fmemopen((void *)text, strlen(text), "r");
+		CHECK(file);
+		jx_parser_read_stream(p, file);
+	}
+
+	struct jx *j = jx_parse(p);
+	if(jx_parser_errors(p)) {
+		*error = strdup(jx_parser_error_string(p));
+		jx_delete(j);
+		j = 0;
+	} else {
+		*error = 0;
+	}
+
+	jx_parser_delete(p);
+	if(file) fclose(file);
+	return j;
+}
+
+/*
+The stream parser reads a byte at a time and is the reference:
+the string parser must produce the same value or the same error.
+Values are compared in printed form so that expressions compare too.
+*/
+
+static struct jx *compare(const char *text)
+{
+	char *string_error, *stream_error;
+	struct jx *a = parse(text, 1, &string_error);
+	struct jx *b = parse(text, 0, &stream_error);
+
+	char *string_value = a ? jx_print_string(a) : 0;
+	char *stream_value = b ? jx_print_string(b) : 0;
+
+	int same;
+	if(a && b) {
+		same = !strcmp(string_value, stream_value);
+	} else if(!a && !b) {
+		same = string_error && stream_error ? !strcmp(string_error, stream_error) : string_error == stream_error;
+	} else {
+		same = 0;
+	}
+
+	if(!same) {
+		fprintf(stderr, "parsers disagree on: %s\n", text);
+		fprintf(stderr, "string: %s\n", a ? string_value : string_error);
+		fprintf(stderr, "stream: %s\n", b ? stream_value : stream_error);
+		exit(1);
+	}
+
+	free(string_value);
+	free(stream_value);
+	free(string_error);
+	free(stream_error);
+	jx_delete(b);
+	compared++;
+	return a;
+}
+
+static char *expect_error(const char *text)
+{
+	char *error;
+	struct jx *j;
+
+	compare(text);
+	j = parse(text, 1, &error);
+	CHECK(!j);
+	return error;
+}
+
+int main(int argc, char *argv[])
+{
+	char text[4096];
+	char value[4096];
+	int i, n, e;
+
+	/* Escapes on either side of, and straddling, each sixteen byte boundary. */
+	const char escapes[][8] = { {BS,'"'}, {BS,BS}, {BS,'n'}, {BS,'t'}, {BS,'/'}, {BS,'u','0','0','4','1'} };
+	const char decoded[] = { '"', BS, '\n', '\t', '/', 'A' };
+
+	for(e = 0; e < (int)(sizeof(escapes) / sizeof(escapes[0])); e++) {
+		for(n = 0; n < 50; n++) {
+			char *t = text;
+			char *v = value;
+			t += sprintf(t, "{\"key\":\"");
+			for(i = 0; i < n; i++) {
+				*t++ = *v++ = 'a' + i % 26;
+			}
+			t += sprintf(t, "%s", escapes[e]);
+			*v++ = decoded[e];
+			for(i = 0; i < 20; i++) {
+				*t++ = *v++ = 'z';
+			}
+			sprintf(t, "\"}");
+			*v = 0;
+
+			struct jx *j = compare(text);
+			CHECK(j);
+			struct jx *s = jx_lookup(j, "key");
+			CHECK(s && jx_istype(s, JX_STRING));
+			CHECK(!strcmp(s->u.string_value, value));
+			jx_delete(j);
+		}
+	}
+
+	/* Whitespace runs of every length, with the error on a known line. */
+	const char spaces[] = " \t\r\n\n  \t ";
+	for(n = 0; n < 80; n++) {
+		int lines = 1;
+		char *t = text;
+		t += sprintf(t, "[1,");
+		for(i = 0; i < n; i++) {
+			*t = spaces[i % (sizeof(spaces) - 1)];
+			if(*t == '\n') lines++;
+			t++;
+		}
+		sprintf(t, "2]");
+
+		struct jx *j = compare(text);
+		CHECK(j && jx_array_length(j) == 2);
+		jx_delete(j);
+
+		sprintf(t, "@]");
+		char *error = expect_error(text);
+		char expected[64];
+		sprintf(expected, "line %d: ", lines);
+		CHECK(!strncmp(error, expected, strlen(expected)));
+		free(error);
+	}
+
+	/* Line numbers after a long string and in a string left open. */
+	{
+		char *t = text;
+		t += sprintf(t, "{\"long\":\"%s\",\n\n", "0123456789abcdef0123456789abcdef0123456789");
+		t += sprintf(t, "\"open\":\"%s", "0123456789abcdef0123456789abcdef");
+		char *error = expect_error(text);
+		CHECK(!strncmp(error, "line 3: missing end quote", 25));
+		free(error);
+
+		sprintf(text, "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\"%s\n\"", "0123456789abcdef0123");
+		struct jx *j = compare(text);
+		CHECK(j && jx_istype(j, JX_STRING));
+		jx_delete(j);
+	}
+
+	/* Bytes with the high bit set inside strings and between tokens. */
+	for(n = 0; n < 40; n++) {
+		char *t = text;
+		char *v = value;
+		t += sprintf(t, "[\"");
+		for(i = 0; i < n; i++) {
+			*t++ = *v++ = 'x';
+		}
+		/* e with an acute accent in UTF-8, then every high byte. */
+		*t++ = *v++ = (char)0xc3;
+		*t++ = *v++ = (char)0xa9;
+		for(i = 0x80; i <= 0xff; i++) {
+			*t++ = *v++ = (char)i;
+		}
+		sprintf(t, "\"]");
+		*v = 0;
+
+		struct jx *j = compare(text);
+		CHECK(j && jx_array_length(j) == 1);
+		struct jx *s = jx_array_index(j, 0);
+		CHECK(s && jx_istype(s, JX_STRING));
+		CHECK(!strcmp(s->u.string_value, value));
+		jx_delete(j);
+
+		for(i = 0x80; i <= 0xff; i += 0x1f) {
+			sprintf(text, "[1,%*s%c2]", n, "", i);
+			char *error = expect_error(text);
+			free(error);
+		}
+		sprintf(text, "[1,%*s%c", n, "", 0xff);
+		free(expect_error(text));
+	}
+
+	/* Random documents built from the pieces above. */
+	const char *pieces[] = {
+		" ", "\n", "\t", "\r\n", "                ", "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n",
+		"\"", "\"abcdefghijklmnopqrstuvwxyz\"", "\"\xc3\xa9\"", "\xff", "\x80",
+		"{", "}", "[", "]", ",", ":", "1", "2.5", "true", "null", "x", "#c\n",
+	};
+	const int npieces = sizeof(pieces) / sizeof(pieces[0]);
+	srand(1);
+	for(n = 0; n < 20000; n++) {
+		int count = rand() % 24;
+		char *t = text;
+		for(i = 0; i < count; i++) {
+			int r = rand() % (npieces + 6);
+			if(r < npieces) {
+				t += sprintf(t, "%s", pieces[r]);
+			} else {
+				t += sprintf(t, "%s", escapes[r - npieces]);
+			}
+		}
+		*t = 0;
+		jx_delete(compare(text));
+	}
+
+	printf("%d documents parsed alike\n", compared);
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,112 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="priority_queue.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "priority_queue.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+#define N 5000
+
+int main(int argc, char *argv[])
+{
+	struct priority_queue *q = priority_queue_create(0);
+	uintptr_t i;
+
+	CHECK(priority_queue_size(q) == 0);
+	CHECK(priority_queue_peek(q) == NULL);
+	CHECK(priority_queue_pop(q) == NULL);
+
+	/* higher priorities first. */
+	priority_queue_push(q, (void *) 1, 1);
+	priority_queue_push(q, (void *) 3, 10);
+	priority_queue_push(q, (void *) 2, 5);
+	CHECK(priority_queue_size(q) == 3);
+	CHECK(priority_queue_peek(q) == (void *) 3);
+	CHECK(priority_queue_pop(q) == (void *) 3);
+	CHECK(priority_queue_pop(q) == (void *) 2);
+	CHECK(priority_queue_pop(q) == (void *) 1);
+	CHECK(priority_queue_size(q) == 0);
+
+	/* equal priorities come out in the order they were pushed. */
+	for(i = 1; i <= N; i++) {
+		priority_queue_push(q, (void *) i, 7);
+	}
+	for(i = 1; i <= N; i++) {
+		CHECK(priority_queue_pop(q) == (void *) i);
+	}
+
+	/*
+	Random priorities from a small range, so that ties are common.
+	Each item records its priority and when it was pushed, so that the
+	order of the pops can be checked, while growing the queue past its
+	initial capacity.
+	*/
+	static double priority[N + 1];
+	srand(23);
+	for(i = 1; i <= N; i++) {
+		priority[i] = rand() % 10;
+		priority_queue_push(q, (void *) i, priority[i]);
+		if(i % 3 == 0) {
+			/* interleave some pops, which must still respect the order. */
+			uintptr_t top = (uintptr_t) priority_queue_peek(q);
+			CHECK(priority_queue_pop(q) == (void *) top);
+			priority_queue_push(q, (void *) top, priority[top]);
+		}
+	}
+	CHECK(priority_queue_size(q) == N);
+
+	uintptr_t last = (uintptr_t) priority_queue_pop(q);
+	for(i = 1; i < N; i++) {
+		uintptr_t next = (uintptr_t) priority_queue_pop(q);
+		CHECK(next);
+		CHECK(priority[next] <= priority[last]);
+		last = next;
+	}
+	CHECK(priority_queue_pop(q) == NULL);
+
+	/* among ties, the FIFO order holds while the heap is reshuffled by other priorities. */
+	for(i = 1; i <= N; i++) {
+		priority_queue_push(q, (void *) i, i % 2 ? 1 : rand() % 100 + 2);
+	}
+	uintptr_t previous_odd = 0;
+	while(priority_queue_size(q) > 0) {
+		uintptr_t item = (uintptr_t) priority_queue_pop(q);
+		if(item % 2) {
+			CHECK(item > previous_odd);
+			previous_odd = item;
+		}
+	}
+	CHECK(previous_odd == N - 1);
+
+	priority_queue_delete(q);
+
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,115 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="slab.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "slab.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+#define N 1000
+
+static int is_zero(const char *p, size_t size)
+{
+	size_t i;
+	for(i = 0; i < size; i++) {
+		if(p[i]) return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t size = 13;
+	char *items[N];
+	int i, j;
+
+	/* few objects per chunk, so that many chunks are needed. */
+	struct slab *s = slab_create(size, 7);
+	CHECK(slab_items(s) == 0);
+	CHECK(slab_bytes(s) == 0);
+
+	for(i = 0; i < N; i++) {
+		items[i] = slab_alloc(s);
+		CHECK(items[i]);
+		CHECK(((uintptr_t) items[i]) % 16 == 0);
+		CHECK(is_zero(items[i], size));
+		memset(items[i], i % 255 + 1, size);
+	}
+	CHECK(slab_items(s) == N);
+
+	/* objects do not overlap. */
+	for(i = 0; i < N; i++) {
+		for(j = 0; j < (int) size; j++) {
+			CHECK(items[i][j] == (char) (i % 255 + 1));
+		}
+	}
+
+	INT64_T bytes = slab_bytes(s);
+	CHECK(bytes >= (INT64_T) (N * size));
+
+	/* freed objects are reused, zero-filled, without growing the slab. */
+	for(i = 0; i < N; i += 2) {
+		slab_free(s, items[i]);
+	}
+	CHECK(slab_items(s) == N / 2);
+
+	for(i = 0; i < N; i += 2) {
+		items[i] = slab_alloc(s);
+		CHECK(is_zero(items[i], size));
+	}
+	CHECK(slab_items(s) == N);
+	CHECK(slab_bytes(s) == bytes);
+
+	slab_free(s, NULL);
+	CHECK(slab_items(s) == N);
+
+	for(i = 0; i < N; i++) {
+		slab_free(s, items[i]);
+	}
+	CHECK(slab_items(s) == 0);
+	CHECK(slab_bytes(s) == bytes);
+
+	slab_delete(s);
+
+	/* objects smaller than a pointer, with the default chunk size. */
+	s = slab_create(1, 0);
+	char *a = slab_alloc(s);
+	char *b = slab_alloc(s);
+	CHECK(a != b);
+	*a = 1;
+	*b = 2;
+	CHECK(*a == 1);
+	slab_delete(s);
+
+	slab_delete(NULL);
+
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,96 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="string_intern.test"
+
+prepare()
+{
+	${CC} -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libdttools.a -lm <<EOF
+#include "string_intern.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+#define N 10000
+
+int main(int argc, char *argv[])
+{
+	char name[64];
+	const char *names[N];
+	int i;
+
+	CHECK(string_intern(NULL) == NULL);
+	string_intern_release(NULL);
+
+	INT64_T empty = string_intern_bytes();
+
+	/* equal strings share one copy, which is not the caller's buffer. */
+	strcpy(name, "input.dat");
+	const char *a = string_intern(name);
+	strcpy(name, "input.dat");
+	const char *b = string_intern(name);
+	CHECK(a == b);
+	CHECK(a != name);
+	CHECK(!strcmp(a, "input.dat"));
+
+	const char *c = string_intern("output.dat");
+	CHECK(c != a);
+
+	/* the copy stays valid until released as many times as it was interned. */
+	string_intern_release(a);
+	CHECK(!strcmp(b, "input.dat"));
+	CHECK(string_intern("input.dat") == b);
+	string_intern_release(b);
+	string_intern_release(b);
+
+	string_intern_release(c);
+
+	/* many distinct strings, which grow the table. */
+	for(i = 0; i < N; i++) {
+		sprintf(name, "file.%d", i);
+		names[i] = string_intern(name);
+	}
+	CHECK(string_intern_bytes() > empty);
+
+	for(i = 0; i < N; i++) {
+		sprintf(name, "file.%d", i);
+		CHECK(!strcmp(names[i], name));
+		CHECK(string_intern(name) == names[i]);
+		string_intern_release(names[i]);
+	}
+
+	for(i = 0; i < N; i++) {
+		string_intern_release(names[i]);
+	}
+
+	/* only the table itself is left. */
+	INT64_T table = string_intern_bytes();
+	const char *d = string_intern("again");
+	CHECK(string_intern_bytes() > table);
+	string_intern_release(d);
+	CHECK(string_intern_bytes() == table);
+
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -10,9 +10,11 @@ See the file COPYING for details.
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <inttypes.h>
 
 #include "debug.h"
 #include "xxmalloc.h"
+#include "macros.h"
 
 #include "itable.h"
 #include "hash_table.h"
@@ -20,6 +22,7 @@ See the file COPYING for details.
 #include "set.h"
 #include "stringtools.h"
 #include "rmsummary.h"
+#include "slab.h"
 
 #include "dag.h"
 #include "dag_resources.h"
@@ -51,6 +54,12 @@ struct dag *dag_create()
 	d->allocation_mode = CATEGORY_ALLOCATION_MODE_FIXED;
 	d->cache_dir = NULL;
 
+	d->node_slab = slab_create(sizeof(struct dag_node), 0);
+	d->file_slab = slab_create(sizeof(struct dag_file), 0);
+	d->file_edges = NULL;
+	d->node_edges = NULL;
+	d->compact = 0;
+
 	/* Declare special variables */
 	string_set_insert(d->special_vars, "CATEGORY");
 	string_set_insert(d->special_vars, "SYMBOL");          /* Deprecated alias for CATEGORY */
@@ -74,11 +83,69 @@ struct dag *dag_create()
 	return d;
 }
 
+/* Copy the edges in the arrays of each node and file, which grow as the rules
+ * are parsed, into the arrays of the dag. The edges are laid out in the order
+ * in which the nodes and files are visited, and the edges of each node and
+ * file are kept newest first, the order in which they were listed before. */
+void dag_compact(struct dag *d)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+	char *name;
+	int i;
+
+	if(!d || d->compact)
+		return;
+
+	int64_t file_edges = 0;
+	int64_t node_edges = 0;
+
+	for(n = d->nodes; n; n = n->next)
+		file_edges += n->source_count + n->target_count;
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f))
+		node_edges += f->needed_by_count;
+
+	d->file_edges = xxmalloc(MAX(file_edges, 1) * sizeof(*d->file_edges));
+	d->node_edges = xxmalloc(MAX(node_edges, 1) * sizeof(*d->node_edges));
+
+	struct dag_file **fe = d->file_edges;
+	for(n = d->nodes; n; n = n->next) {
+		for(i = 0; i < n->source_count; i++)
+			fe[i] = n->source_files[n->source_count - 1 - i];
+		free(n->source_files);
+		n->source_files = fe;
+		fe += n->source_count;
+
+		for(i = 0; i < n->target_count; i++)
+			fe[i] = n->target_files[n->target_count - 1 - i];
+		free(n->target_files);
+		n->target_files = fe;
+		fe += n->target_count;
+	}
+
+	struct dag_node **ne = d->node_edges;
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		for(i = 0; i < f->needed_by_count; i++)
+			ne[i] = f->needed_by[f->needed_by_count - 1 - i];
+		free(f->needed_by);
+		f->needed_by = ne;
+		ne += f->needed_by_count;
+	}
+
+	d->compact = 1;
+
+	debug(D_MAKEFLOW_RUN, "dag compacted: %" PRId64 " node to file edges, %" PRId64 " file to node edges", file_edges, node_edges);
+}
+
 void dag_compile_ancestors(struct dag *d)
 {
 	struct dag_node *n, *m;
 	struct dag_file *f;
 	char *name;
+	int i;
 
 	if (!d) return;
 
@@ -89,8 +156,8 @@ void dag_compile_ancestors(struct dag *d)
 		if(!m)
 			continue;
 
-		list_first_item(f->needed_by);
-		while((n = list_next_item(f->needed_by))) {
+		for(i = 0; i < f->needed_by_count; i++) {
+			n = f->needed_by[i];
 			debug(D_MAKEFLOW_RUN, "rule %d ancestor of %d\n", m->nodeid, n->nodeid);
 			set_insert(m->descendants, n);
 			set_insert(n->ancestors, m);
@@ -143,7 +210,7 @@ struct dag_file *dag_file_lookup_or_create(struct dag *d, const char *filename)
 	f = hash_table_lookup(d->files, filename);
 	if(f) return f;
 
-	f = dag_file_create(filename);
+	f = dag_file_create(d, filename);
 
 	hash_table_insert(d->files, f->filename, (void *) f);
 
@@ -191,6 +258,185 @@ void dag_count_states(struct dag *d)
 	}
 }
 
+/* Running time of the logged nodes of a category. */
+struct dag_category_runtime {
+	timestamp_t total;
+	int count;
+};
+
+/* Expected running time of a node in seconds, or zero if unknown. */
+static double dag_node_expected_runtime(struct dag_node *n, struct hash_table *category_runtimes)
+{
+	if(n->runtime > 0)
+		return n->runtime / 1000000.0;
+
+	struct dag_category_runtime *r = hash_table_lookup(category_runtimes, n->category->name);
+	if(r && r->count > 0)
+		return r->total / 1000000.0 / r->count;
+
+	const struct rmsummary *s = dag_node_dynamic_label(n);
+	if(s && s->wall_time > 0)
+		return s->wall_time / 1000000.0;
+
+	return 0;
+}
+
+void dag_compute_priorities(struct dag *d)
+{
+	struct dag_node *n, *m;
+	struct dag_category_runtime *r;
+	char *name;
+	int known = 0;
+	double known_total = 0;
+
+	struct hash_table *category_runtimes = hash_table_create(0, 0);
+
+	for(n = d->nodes; n; n = n->next) {
+		if(n->runtime <= 0)
+			continue;
+		r = hash_table_lookup(category_runtimes, n->category->name);
+		if(!r) {
+			r = xxcalloc(1, sizeof(*r));
+			hash_table_insert(category_runtimes, n->category->name, r);
+		}
+		r->total += n->runtime;
+		r->count++;
+	}
+
+	/* Nodes with no estimate weigh as much as the average node that has one. */
+	for(n = d->nodes; n; n = n->next) {
+		double t = dag_node_expected_runtime(n, category_runtimes);
+		if(t > 0) {
+			known_total += t;
+			known++;
+		}
+	}
+	double default_runtime = known > 0 ? known_total / known : 1;
+
+	/*
+	Visit the nodes from the end of the workflow backwards, so that every node
+	is visited after all of its descendants. Until then, the priority of a node
+	holds the largest rank among its visited descendants.
+	*/
+
+	int *remaining = xxcalloc(d->nodeid_counter + 1, sizeof(*remaining));
+	struct list *visit = list_create();
+
+	for(n = d->nodes; n; n = n->next) {
+		n->priority = 0;
+		remaining[n->nodeid] = set_size(n->descendants);
+		if(remaining[n->nodeid] == 0)
+			list_push_tail(visit, n);
+	}
+
+	int visited = 0;
+	while((n = list_pop_head(visit))) {
+		visited++;
+
+		if(n->state != DAG_NODE_STATE_COMPLETE) {
+			double t = dag_node_expected_runtime(n, category_runtimes);
+			n->priority += t > 0 ? t : default_runtime;
+		}
+
+		set_first_element(n->ancestors);
+		while((m = set_next_element(n->ancestors))) {
+			if(n->priority > m->priority)
+				m->priority = n->priority;
+			if(--remaining[m->nodeid] == 0)
+				list_push_tail(visit, m);
+		}
+	}
+
+	debug(D_MAKEFLOW_RUN, "computed the priority of %d nodes, %d with an expected runtime", visited, known);
+
+	free(remaining);
+	list_delete(visit);
+
+	hash_table_firstkey(category_runtimes);
+	while(hash_table_nextkey(category_runtimes, &name, (void **) &r)) {
+		free(r);
+	}
+	hash_table_delete(category_runtimes);
+}
+
+static void dag_ready_push(struct dag *d, struct dag_node *n)
+{
+	if(n->ready_queued || n->unmet_sources > 0 || n->state != DAG_NODE_STATE_WAITING)
+		return;
+
+	n->ready_queued = 1;
+	priority_queue_push(d->ready_nodes, n, n->priority);
+}
+
+void dag_ready_compute(struct dag *d)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+	int i;
+
+	if(d->ready_nodes)
+		priority_queue_delete(d->ready_nodes);
+	d->ready_nodes = priority_queue_create(0);
+
+	dag_compute_priorities(d);
+
+	for(n = d->nodes; n; n = n->next) {
+		n->unmet_sources = 0;
+		n->ready_queued = 0;
+
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
+			if(!dag_file_should_exist(f))
+				n->unmet_sources++;
+		}
+
+		dag_ready_push(d, n);
+	}
+}
+
+/* Called whenever dag_file_should_exist(f) changes its value. */
+void dag_ready_file_changed(struct dag *d, struct dag_file *f)
+{
+	struct dag_node *n;
+	int i;
+
+	if(!d->ready_nodes)
+		return;
+
+	int exists = dag_file_should_exist(f);
+
+	for(i = 0; i < f->needed_by_count; i++) {
+		n = f->needed_by[i];
+		if(exists) {
+			n->unmet_sources--;
+			dag_ready_push(d, n);
+		} else {
+			n->unmet_sources++;
+		}
+	}
+}
+
+void dag_ready_node_waiting(struct dag *d, struct dag_node *n)
+{
+	if(!d->ready_nodes)
+		return;
+
+	dag_ready_push(d, n);
+}
+
+struct dag_node *dag_ready_pop(struct dag *d)
+{
+	struct dag_node *n;
+
+	while((n = priority_queue_pop(d->ready_nodes))) {
+		n->ready_queued = 0;
+		if(n->state == DAG_NODE_STATE_WAITING && n->unmet_sources == 0)
+			return n;
+	}
+
+	return NULL;
+}
+
 /**
  * If the return value is x, a positive integer, that means at least x tasks
  * can be run in parallel during a certain point of the execution of the
@@ -206,14 +452,15 @@ int dag_width_guaranteed_max(struct dag *d)
 	int nodeid;
 	int depends_on_single_node = 1;
 	int max = 0;
+	int i;
 
 	for(n = d->nodes; n; n = n->next) {
 		depends_on_single_node = 1;
 		nodeid = -1;
 		m = 0;
 		// for each source file, see if it is a target file of another node
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			// get the node (tmp) that outputs current source file
 			tmp = f->created_by;
 			// if a source file is also a target file
@@ -252,12 +499,13 @@ int dag_depth(struct dag *d)
 {
 	struct dag_node *n, *parent;
 	struct dag_file *f;
+	int i;
 
 	struct list *level_unsolved_nodes = list_create();
 	for(n = d->nodes; n != NULL; n = n->next) {
 		n->level = 0;
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			if((parent = f->created_by) != NULL) {
 				n->level = -1;
 				list_push_tail(level_unsolved_nodes, n);
@@ -268,8 +516,8 @@ int dag_depth(struct dag *d)
 
 	int max_level = 0;
 	while((n = (struct dag_node *) list_pop_head(level_unsolved_nodes)) != NULL) {
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			if((parent = f->created_by) != NULL) {
 				if(parent->level == -1) {
 					n->level = -1;
@@ -334,14 +582,15 @@ int dag_width(struct dag *d )
 {
 	struct dag_node *n, *parent;
 	struct dag_file *f;
+	int i;
 
 	/* 1. Find the number of immediate children for all nodes; also,
 	   determine leaves by adding nodes with children==0 to list. */
 
 	for(n = d->nodes; n != NULL; n = n->next) {
 		n->level = 0;	// initialize 'level' value to 0 because other functions might have modified this value.
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			parent = f->created_by;
 			if(parent)
 				parent->children++;
@@ -368,8 +617,8 @@ int dag_width(struct dag *d )
 	while(list_size(leaves) > 0) {
 		struct dag_node *n = (struct dag_node *) list_pop_head(leaves);
 
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			parent = f->created_by;
 			if(!parent)
 				continue;
@@ -400,7 +649,7 @@ int dag_width(struct dag *d )
 		level_count[n->level]++;
 	}
 
-	int i, max = 0;
+	int max = 0;
 	for(i = 0; i <= max_level; i++) {
 		if(max < level_count[i])
 			max = level_count[i];
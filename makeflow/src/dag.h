@@ -17,9 +17,13 @@ See the file COPYING for details.
 #include "timestamp.h"
 #include "batch_job.h"
 #include "category.h"
+#include "priority_queue.h"
+#include "slab.h"
 
 #include <stdio.h>
 
+struct dag_file;
+
 struct dag {
 	/* Static properties of the DAG */
 	char *filename;                    /* Source makeflow file path. */
@@ -34,11 +38,19 @@ struct dag {
 	struct string_set *special_vars;   /* List of special variables, such as category, cores, memory, etc. */
 	category_mode_t allocation_mode;   /* One of CATEGORY_ALLOCATION_MODE_{FIXED,MAX_THROUGHTPUT,MIN_WASTE} */
 
+	/* Storage of nodes, files, and the edges between them. */
+	struct slab *node_slab;            /* Allocator of every struct dag_node. */
+	struct slab *file_slab;            /* Allocator of every struct dag_file. */
+	struct dag_file **file_edges;      /* After dag_compact, the source and target files of all nodes, node after node. */
+	struct dag_node **node_edges;      /* After dag_compact, the nodes that need each file, file after file. */
+	int compact;                       /* Flag: edges are in file_edges and node_edges, and no more can be added. */
+
 
 	/* Dynamic states related to execution via Makeflow. */
 	FILE *logfile;
 	int node_states[DAG_NODE_STATE_MAX];/* node_states[STATE] keeps the count of nodes that have state STATE \in dag_node_state_t. */
 	int nodeid_counter;                 /* Keeps a count of production rules read so far (used for the value of dag_node->nodeid). */
+	struct priority_queue *ready_nodes; /* Waiting nodes with all their sources present, by dag_node->priority. NULL until dag_ready_compute. */
 
 	struct itable *local_job_table;     /* Mapping from unique integers dag_node->jobid to nodes, rules with prefix LOCAL. */
 	struct itable *remote_job_table;    /* Mapping from unique integers dag_node->jobid to nodes. */
@@ -54,10 +66,32 @@ struct dag *dag_create();
 
 struct list *dag_input_files( struct dag *d );
 
+/* Once all the rules are known, dag_compact moves the edges of each node and
+ * file into the two arrays of the dag, so that they are traversed without
+ * chasing pointers across the heap. No edges can be added afterwards. */
+void dag_compact(struct dag *d);
+
 void dag_compile_ancestors(struct dag *d);
 void dag_find_ancestor_depth(struct dag *d);
 void dag_count_states(struct dag *d);
 
+/* Set the priority of every node to its upward rank: the expected time of the
+ * longest chain of nodes that still have to run, from the node to the end of
+ * the workflow. Nodes are weighted by the time they took in the log, then by the
+ * average time of the logged nodes of their category, then by their declared
+ * wall time. Completed nodes weigh nothing. Called by dag_ready_compute. */
+void dag_compute_priorities(struct dag *d);
+
+/* The ready queue holds the waiting nodes whose source files all should exist.
+ * dag_ready_compute counts the unmet sources of every node and fills the queue,
+ * after which it is kept up to date by dag_ready_file_changed and dag_ready_node_waiting
+ * as files and nodes change state. Nodes in the queue may have left the waiting state
+ * since they were pushed, so dag_ready_pop skips them. */
+void dag_ready_compute(struct dag *d);
+void dag_ready_file_changed(struct dag *d, struct dag_file *f);
+void dag_ready_node_waiting(struct dag *d, struct dag_node *n);
+struct dag_node *dag_ready_pop(struct dag *d);
+
 struct dag_file *dag_file_lookup_or_create(struct dag *d, const char *filename);
 struct dag_file *dag_file_from_name(struct dag *d, const char *filename);
 
@@ -13,11 +13,12 @@ See the file COPYING for details.
 
 #include <stdlib.h>
 
-struct dag_file * dag_file_create( const char *filename )
+struct dag_file * dag_file_create( struct dag *d, const char *filename )
 {
-	struct dag_file *f = xxcalloc(1, sizeof(*f));
+	struct dag_file *f = slab_alloc(d->file_slab);
 	f->filename = xxstrdup(filename);
-	f->needed_by = list_create();
+	f->needed_by = NULL;
+	f->needed_by_count = 0;
 	f->created_by = 0;
 	f->actual_size = 0;
 	f->estimated_size = GIGABYTE;
@@ -83,7 +84,7 @@ int dag_file_is_source( const struct dag_file *f )
 /* Returns whether the file is used in any rule */
 int dag_file_is_sink( const struct dag_file *f )
 {
-	if(list_size(f->needed_by) > 0)
+	if(f->needed_by_count > 0)
 		return 0;
 	else
 		return 1;
@@ -123,14 +124,13 @@ uint64_t dag_file_size( const struct dag_file *f )
 }
 
 /* Returns the sum of results for dag_file_size for each file
- * in list. */
-uint64_t dag_file_list_size(struct list *s)
+ * in array. */
+uint64_t dag_file_array_size(struct dag_file **files, int count)
 {
-	struct dag_file *f;
 	uint64_t size = 0;
-	list_first_item(s);
-	while((f = list_next_item(s)))
-		size += dag_file_size(f);
+	int i;
+	for(i = 0; i < count; i++)
+		size += dag_file_size(files[i]);
 
 	return size;
 }
@@ -151,8 +151,9 @@ uint64_t dag_file_set_size(struct set *s)
 int dag_file_coexist_files(struct set *s, struct dag_file *f)
 {
 	struct dag_node *n;
-	list_first_item(f->needed_by);
-	while((n = list_next_item(f->needed_by))){
+	int i;
+	for(i = 0; i < f->needed_by_count; i++) {
+		n = f->needed_by[i];
 		if(set_lookup(s, n))
 			return 1;
 	}
@@ -52,7 +52,8 @@ typedef enum {
 
 struct dag_file {
 	const char *filename;
-	struct list     *needed_by;     /* List of nodes that have this file as a source */
+	struct dag_node **needed_by;    /* Array of nodes that have this file as a source */
+	int    needed_by_count;         /* Number of nodes in needed_by */
 	struct dag_node *created_by;    /* The node (if any) that created the file */
 	uint64_t actual_size;           /* File size reported by stat */
 	uint64_t estimated_size;        /* File size estimation provided prior to execution */
@@ -67,10 +68,11 @@ struct dag_file {
 };
 
 /** Create dag file struct.
+@param d The dag the file belongs to, from which the file is allocated.
 @param filename A const pointer to the unique filename.
 @return dag_file struct.
 */
-struct dag_file *dag_file_create( const char *filename );
+struct dag_file *dag_file_create( struct dag *d, const char *filename );
 
 /** Create JX object of file struct.
 Contains dag_name (originally filename, will be outer_name in code), 
@@ -119,12 +121,13 @@ uint64_t dag_file_size( const struct dag_file *f );
 */
 uint64_t dag_file_size( const struct dag_file *f );
 
-/** Report the sum of file sizes in list. Estimated size is used if actual 
+/** Report the sum of file sizes in array. Estimated size is used if actual 
 does not exist.
-@param s Pointer to list of dag_files.
+@param files Array of dag_files, such as the source_files of a node.
+@param count Number of dag_files in the array.
 @return Sum of dag_file sizes.
 */
-uint64_t dag_file_list_size(struct list *s);
+uint64_t dag_file_array_size(struct dag_file **files, int count);
 
 /** Report the sum of file sizes in set. Estimated size is used if actual 
 does not exist.
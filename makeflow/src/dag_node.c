@@ -13,6 +13,7 @@ See the file COPYING for details.
 #include "rmsummary.h"
 #include "list.h"
 #include "stringtools.h"
+#include "string_intern.h"
 #include "xxmalloc.h"
 #include "jx.h"
 #include "jx_print.h"
@@ -25,25 +26,31 @@ See the file COPYING for details.
 
 extern char **environ; 
 
+/* Most nodes have only a handful of variables, files, and neighbors. The
+   tables below start small and grow as needed, which keeps the footprint of
+   workflows with millions of nodes in check. Tables of remote names are only
+   created for the nodes that use them. */
+#define DAG_NODE_TABLE_BUCKETS 7
+
 struct dag_node *dag_node_create(struct dag *d, int linenum)
 {
-	struct dag_node *n = calloc(1, sizeof(*n));
+	struct dag_node *n = slab_alloc(d->node_slab);
 
 	n->d = d;
 	n->linenum = linenum;
 	n->state = DAG_NODE_STATE_WAITING;
 	n->nodeid = d->nodeid_counter++;
-	n->variables = hash_table_create(0, 0);
+	n->variables = hash_table_create(DAG_NODE_TABLE_BUCKETS, 0);
 
 	n->type = DAG_NODE_TYPE_COMMAND;
-	n->source_files = list_create();
-	n->target_files = list_create();
+	n->source_files = NULL;
+	n->target_files = NULL;
 
-	n->remote_names = itable_create(0);
-	n->remote_names_inv = hash_table_create(0, 0);
+	n->remote_names = NULL;
+	n->remote_names_inv = NULL;
 
-	n->descendants = set_create(0);
-	n->ancestors = set_create(0);
+	n->descendants = set_create(DAG_NODE_TABLE_BUCKETS);
+	n->ancestors = set_create(DAG_NODE_TABLE_BUCKETS);
 
 	n->ancestor_depth = -1;
 
@@ -52,7 +59,7 @@ struct dag_node *dag_node_create(struct dag *d, int linenum)
 	n->resources_requested = rmsummary_create(-1);
 
 	// the value of dag_node_dynamic_label(n) when this node was submitted.
-	n->resources_allocated  = rmsummary_create(-1);
+	n->resources_allocated  = NULL;
 
 	// resources used by the node, as measured by the resource_monitor (if
 	// using monitoring).
@@ -71,19 +78,30 @@ void dag_node_delete(struct dag_node *n)
 {
 	hash_table_delete(n->variables);
 
-	itable_delete(n->remote_names);
-	hash_table_delete(n->remote_names_inv);
+	if(n->remote_names) {
+		uint64_t key;
+		const char *remotename;
+		itable_firstkey(n->remote_names);
+		while(itable_nextkey(n->remote_names, &key, (void **) &remotename)) {
+			string_intern_release(remotename);
+		}
+		itable_delete(n->remote_names);
+		hash_table_delete(n->remote_names_inv);
+	}
 
 	set_delete(n->descendants);
 	set_delete(n->ancestors);
 
-	list_delete(n->source_files);
-	list_delete(n->target_files);
+	if(!n->d->compact) {
+		free(n->source_files);
+		free(n->target_files);
+	}
 
 	if(n->footprint)
 		dag_node_footprint_delete(n->footprint);
 
 	rmsummary_delete(n->resources_requested);
+	rmsummary_delete(n->resources_allocated);
 	if(n->resources_measured)
 		rmsummary_delete(n->resources_measured);
 
@@ -91,7 +109,7 @@ void dag_node_delete(struct dag_node *n)
 	jx_delete(n->workflow_args);
 	free(n->workflow_args_file);
 
-	free(n);
+	slab_free(n->d->node_slab, n);
 }
 
 void dag_node_set_command(struct dag_node *n, const char *cmd) {
@@ -162,6 +180,9 @@ const char *dag_node_get_remote_name(struct dag_node *n, const char *filename)
 	struct dag_file *f;
 	char *name;
 
+	if(!n->remote_names)
+		return NULL;
+
 	f = dag_file_from_name(n->d, filename);
 	name = (char *) itable_lookup(n->remote_names, (uintptr_t) f);
 
@@ -174,6 +195,9 @@ const char *dag_node_get_local_name(struct dag_node *n, const char *filename)
 	struct dag_file *f;
 	const char *name;
 
+	if(!n->remote_names_inv)
+		return NULL;
+
 	f = hash_table_lookup(n->remote_names_inv, filename);
 
 	if(!f)
@@ -250,7 +274,7 @@ static char *dag_node_translate_filename(struct dag_node *n, const char *filenam
 
 	int i = 0;
 	char *newname_org = xxstrdup(newname_ptr);
-	while(hash_table_lookup(n->remote_names_inv, newname_ptr)) {
+	while(n->remote_names_inv && hash_table_lookup(n->remote_names_inv, newname_ptr)) {
 		sprintf(newname_ptr, "%06d-%s", i, newname_org);
 		i++;
 	}
@@ -264,31 +288,62 @@ static char *dag_node_translate_filename(struct dag_node *n, const char *filenam
  * the given node. If remotename is NULL, then a new name is
  * found using dag_node_translate_filename. If the remotename
  * given is different from a previosly specified, a warning is
- * written to the debug output, but otherwise this is ignored. */
+ * written to the debug output, but otherwise this is ignored.
+ * Remote names are interned, as most rules use the same few. */
 static const char *dag_node_add_remote_name(struct dag_node *n, const char *filename, const char *remotename)
 {
 	char *oldname;
+	char *translated = NULL;
 	struct dag_file *f = dag_file_from_name(n->d, filename);
 
 	if(!f)
 		fatal("trying to add remote name %s to unknown file %s.\n", remotename, filename);
 
 	if(!remotename)
-		remotename = dag_node_translate_filename(n, filename);
-	else
-		remotename = xxstrdup(remotename);
+		remotename = translated = dag_node_translate_filename(n, filename);
+
+	remotename = string_intern(remotename);
+	free(translated);
+
+	if(!n->remote_names) {
+		n->remote_names = itable_create(DAG_NODE_TABLE_BUCKETS);
+		n->remote_names_inv = hash_table_create(DAG_NODE_TABLE_BUCKETS, 0);
+	}
 
 	oldname = hash_table_lookup(n->remote_names_inv, remotename);
 
 	if(oldname && strcmp(oldname, filename) == 0)
 		debug(D_MAKEFLOW_RUN, "Remote name %s for %s already in use for %s\n", remotename, filename, oldname);
 
-	itable_insert(n->remote_names, (uintptr_t) f, remotename);
+	const char *previous = itable_lookup(n->remote_names, (uintptr_t) f);
+	itable_insert(n->remote_names, (uintptr_t) f, (void *) remotename);
 	hash_table_insert(n->remote_names_inv, remotename, (void *) f);
+	string_intern_release(previous);
 
 	return remotename;
 }
 
+/* Appends item to an array of edges holding count items, and returns the
+ * array, which is reallocated whenever count reaches a power of two. Edges
+ * can only be added before the arrays are moved into the dag by dag_compact. */
+static void *dag_node_edges_append(struct dag *d, void *edges, int *count, void *item)
+{
+	void **array = edges;
+	int c = *count;
+
+	if(d->compact)
+		fatal("edges cannot be added to the dag after it has been compacted.\n");
+
+	if((c & (c - 1)) == 0) {
+		array = xxrealloc(array, (c ? 2 * c : 1) * sizeof(*array));
+	}
+
+	array[c] = item;
+	*count = c + 1;
+
+	return array;
+}
+
 /* Adds the local name to the list of source files of the node,
  * and adds the node as a dependant of the file. If remotename is
  * not NULL, it is added to the namespace of the node. */
@@ -300,10 +355,10 @@ void dag_node_add_source_file(struct dag_node *n, const char *filename, const ch
 		dag_node_add_remote_name(n, filename, remotename);
 
 	/* register this file as a source of the node */
-	list_push_head(n->source_files, source);
+	n->source_files = dag_node_edges_append(n->d, n->source_files, &n->source_count, source);
 
 	/* register this file as a requirement of the node */
-	list_push_head(source->needed_by, n);
+	source->needed_by = dag_node_edges_append(n->d, source->needed_by, &source->needed_by_count, n);
 
 	source->reference_count++;
 }
@@ -322,7 +377,7 @@ void dag_node_add_target_file(struct dag_node *n, const char *filename, const ch
 		dag_node_add_remote_name(n, filename, remotename);
 
 	/* register this file as a target of the node */
-	list_push_head(n->target_files, target);
+	n->target_files = dag_node_edges_append(n->d, n->target_files, &n->target_count, target);
 
 	/* register this node as the creator of the file */
 	target->created_by = n;
@@ -426,6 +481,7 @@ const struct rmsummary *dag_node_dynamic_label(const struct dag_node *n) {
 struct jx * dag_node_to_jx( struct dag *d, struct dag_node *n, int send_all_local_env)
 {
 	struct jx *task = jx_object(0);
+	int i;
 
 	jx_insert(task, jx_string("resources"), rmsummary_to_json(dag_node_dynamic_label(n), 1));
 	jx_insert(task, jx_string("category"), jx_string(n->category->name));
@@ -434,15 +490,15 @@ struct jx * dag_node_to_jx( struct dag *d, struct dag_node *n, int send_all_loca
 	struct dag_file *f = NULL;
 
 	struct jx *outputs = jx_array(0);
-	list_first_item(n->target_files);
-	while((f = list_next_item(n->target_files))) {
+	for(i = 0; i < n->target_count; i++) {
+		f = n->target_files[i];
 		jx_array_insert(outputs, dag_file_to_jx(f, n));
 	}
 	jx_insert(task, jx_string("outputs"), outputs);
 
 	struct jx *inputs = jx_array(0);
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))) {
+	for(i = 0; i < n->source_count; i++) {
+		f = n->source_files[i];
 		jx_array_insert(inputs, dag_file_to_jx(f, n));
 	}
 	jx_insert(task, jx_string("inputs"), inputs);
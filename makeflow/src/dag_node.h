@@ -10,6 +10,7 @@ See the file COPYING for details.
 #include "batch_job.h"
 #include "batch_task.h"
 #include "category.h"
+#include "timestamp.h"
 #include "set.h"
 #include "hash_table.h"
 #include "itable.h"
@@ -56,10 +57,12 @@ struct dag_node {
 	char *workflow_args_file;   /* Automatically generated temporary file to write workflow_args to disc. */
 	int workflow_is_jx;	    /* True is sub-workflow is jx, false otherwise. */
 
-	struct itable *remote_names;        /* Mapping from struct *dag_files to remotenames (char *) */
-	struct hash_table *remote_names_inv;/* Mapping from remote filenames to dag_file representing the local file. */
-	struct list   *source_files;        /* list of dag_files of the node's requirements */
-	struct list   *target_files;        /* list of dag_files of the node's productions */
+	struct itable *remote_names;        /* Mapping from struct *dag_files to remotenames (char *). NULL if the node has no remote names. */
+	struct hash_table *remote_names_inv;/* Mapping from remote filenames to dag_file representing the local file. NULL if the node has no remote names. */
+	struct dag_file **source_files;     /* array of dag_files of the node's requirements */
+	struct dag_file **target_files;     /* array of dag_files of the node's productions */
+	int source_count;                   /* Number of dag_files in source_files */
+	int target_count;                   /* Number of dag_files in target_files */
 
 	struct dag_node_footprint *footprint; /* Pointer to footprint structure created when using storage limits */
 
@@ -72,7 +75,7 @@ struct dag_node {
                                                 into account its category. Use dag_node_dynamic_label(n) for the
                                                 resources this node requests, taking into account categories,
                                                 dynamic resources, etc.  */
-    struct rmsummary *resources_allocated;   /* resources allocated to this node when submitted */
+    struct rmsummary *resources_allocated;   /* resources allocated to this node when submitted, NULL until then */
 	struct rmsummary *resources_measured;    /* resources measured on completion. */
 
 	/* Variables used in dag_width, dag_width_uniform_task, and dag_depth
@@ -87,7 +90,11 @@ struct dag_node {
 	batch_job_id_t jobid;               /* The id this node get, either from the local or remote batch system. */
 	dag_node_state_t state;             /* Enum: DAG_NODE_STATE_{WAITING,RUNNING,...} */
 	int failure_count;                  /* How many times has this rule failed? (see -R and -r) */
+	int unmet_sources;                  /* Number of source files that are not yet expected to exist. */
+	int ready_queued;                   /* Flag: is the node in the dag's ready queue? */
+	double priority;                    /* Nodes with higher priority are dispatched first. */
 	time_t previous_completion;
+	timestamp_t runtime;                /* Time between running and completing in the log, or zero if unknown. */
 
 	const char *umbrella_spec;          /* the umbrella spec file for executing this job */
 	
@@ -170,8 +170,9 @@ void dag_node_footprint_determine_children(struct dag_node *n)
 void dag_node_footprint_prepare_node_terminal_files(struct dag_node *n)
 {
 	struct dag_file *f;
-	list_first_item(n->target_files);
-	while((f = list_next_item(n->target_files))){
+	int i;
+	for(i = 0; i < n->target_count; i++) {
+		f = n->target_files[i];
 		if(f->type == DAG_FILE_TYPE_OUTPUT){
 			set_push(n->footprint->terminal_files, f);
 		}
@@ -198,17 +199,25 @@ void dag_node_footprint_prepare_node_terminal_files(struct dag_node *n)
 	}
 }
 
+/* Inserts each of the count files of the array into set s. */
+static void dag_node_footprint_insert_files(struct set *s, struct dag_file **files, int count)
+{
+	int i;
+	for(i = 0; i < count; i++)
+		set_insert(s, files[i]);
+}
+
 void dag_node_footprint_prepare_node_size(struct dag_node *n)
 {
 	struct dag_node *s;
 
 	/* Determine source size based on either the actual inputs or the
 		estimated size of the inputs and store in source_size */
-	n->footprint->source_size = dag_file_list_size(n->source_files);
+	n->footprint->source_size = dag_file_array_size(n->source_files, n->source_count);
 
 	/* Determine target size based on either the actual outputs or the
 		estimated size of the outputs and store in target_size */
-	n->footprint->target_size = dag_file_list_size(n->target_files);
+	n->footprint->target_size = dag_file_array_size(n->target_files, n->target_count);
 
 	/* Recursively updated children if they have not yet been updated */
 	set_first_element(n->footprint->direct_children);
@@ -225,8 +234,8 @@ void dag_node_footprint_determine_run_footprint(struct dag_node *n)
 {
 	set_delete(n->footprint->run_files);
 	n->footprint->run_files = set_create(0);
-	set_insert_list(n->footprint->run_files, n->source_files);
-	set_insert_list(n->footprint->run_files, n->target_files);
+	dag_node_footprint_insert_files(n->footprint->run_files, n->source_files, n->source_count);
+	dag_node_footprint_insert_files(n->footprint->run_files, n->target_files, n->target_count);
 	set_insert_set(n->footprint->run_files, n->footprint->terminal_files);
 	set_insert_set(n->footprint->run_files, n->footprint->coexist_files);
 
@@ -383,7 +392,7 @@ void dag_node_footprint_determine_descendant(struct dag_node *n)
 
 		dag_node_footprint_set_desc_res_wgt_diff(n);
 
-		set_insert_list(footprint, n->target_files);
+		dag_node_footprint_insert_files(footprint, n->target_files, n->target_count);
 
 		list_sort(tmp_direct_children, dag_node_footprint_comp_diff);
 		list_first_item(tmp_direct_children);
@@ -427,7 +436,7 @@ void dag_node_footprint_determine_descendant(struct dag_node *n)
 			n->footprint->residual_nodes = list_duplicate(node1->footprint->residual_nodes);
 		}
 
-		set_insert_list(n->footprint->residual_files, n->target_files);
+		dag_node_footprint_insert_files(n->footprint->residual_files, n->target_files, n->target_count);
 		set_insert_set(n->footprint->residual_files, n->footprint->terminal_files);
 		n->footprint->residual_size = dag_file_set_size(n->footprint->residual_files);
 	}
@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "dag_variable.h"
 #include "dag_resources.h"
 #include "hash_table.h"
+#include "string_intern.h"
 #include "xxmalloc.h"
 #include "debug.h"
 
@@ -16,24 +17,26 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <stdlib.h>
 
+/* Values are interned, since the same values are bound for many rules. A
+ * value gets a buffer of its own only when something is appended to it. */
 struct dag_variable_value *dag_variable_value_create(const char *value)
 {
 	struct dag_variable_value *v = malloc(sizeof(struct dag_variable_value));
 
 	v->nodeid = 0;
 	v->len    = strlen(value);
-	v->size   = v->len + 1;
-
-	v->value = malloc(v->size * sizeof(char));
-
-	strcpy(v->value, value);
+	v->size   = 0;
+	v->value  = (char *) string_intern(value);
 
 	return v;
 }
 
 void dag_variable_value_free(struct dag_variable_value *v)
 {
-	free(v->value);
+	if(v->size > 0)
+		free(v->value);
+	else
+		string_intern_release(v->value);
 	free(v);
 }
 
@@ -50,10 +53,15 @@ struct dag_variable_value *dag_variable_value_append_or_create(struct dag_variab
 		//make size for string to be appended, plus some more, so we do not
 		//need to reallocate for a while.
 		int nsize = req > 2*(v->size) ? 2*req : 2*(v->size);
-		char *new_val = realloc(v->value, nsize*sizeof(char));
+		char *new_val = realloc(v->size > 0 ? v->value : NULL, nsize*sizeof(char));
 		if(!new_val)
 			fatal("Could not allocate memory for makeflow variable value: %s\n", value);
 
+		if(v->size == 0) {
+			memcpy(new_val, v->value, v->len + 1);
+			string_intern_release(v->value);
+		}
+
 		v->size  = nsize;
 		v->value = new_val;
 	}
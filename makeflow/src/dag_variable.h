@@ -13,7 +13,7 @@ See the file COPYING for details.
 
 struct dag_variable_value {
 	int   nodeid;  /* The nodeid of the rule to which this value binding takes effect. */
-	int   size;    /* memory size allocated for value */
+	int   size;    /* memory size allocated for value, or 0 if value is interned */
 	int   len;     /* records strlen(value) */
 	char *value;   /* The value of the variable. */
 };
@@ -91,14 +91,15 @@ int dag_to_file_exports(const struct dag *d, FILE * dag_stream, const char *pref
 }
 
 /* Writes a list of files to the the stream */
-int dag_to_file_files(struct dag_node *n, struct list *fs, FILE * dag_stream, char *(*rename) (struct dag_node * n, const char *filename))
+int dag_to_file_files(struct dag_node *n, struct dag_file **fs, int count, FILE * dag_stream, char *(*rename) (struct dag_node * n, const char *filename))
 {
 	//here we may want to call the linker renaming function,
 	//instead of using f->remotename
 
 	const struct dag_file *f;
-	list_first_item(fs);
-	while((f = list_next_item(fs)))
+	int i;
+	for(i = 0; i < count; i++) {
+		f = fs[i];
 		if(rename)
 			fprintf(dag_stream, "%s ", rename(n, f->filename));
 		else {
@@ -108,6 +109,7 @@ int dag_to_file_files(struct dag_node *n, struct list *fs, FILE * dag_stream, ch
 			else
 				fprintf(dag_stream, "%s ", f->filename);
 		}
+	}
 
 	return 0;
 }
@@ -124,9 +126,9 @@ int dag_to_file_files(struct dag_node *n, struct list *fs, FILE * dag_stream, ch
  * */
 int dag_to_file_node(struct dag_node *n, FILE * dag_stream, char *(*rename) (struct dag_node * n, const char *filename))
 {
-	dag_to_file_files(n, n->target_files, dag_stream, rename);
+	dag_to_file_files(n, n->target_files, n->target_count, dag_stream, rename);
 	fprintf(dag_stream, ": ");
-	dag_to_file_files(n, n->source_files, dag_stream, rename);
+	dag_to_file_files(n, n->source_files, n->source_count, dag_stream, rename);
 	fprintf(dag_stream, "\n");
 
 	dag_to_file_vars(n->d->special_vars, n->variables, n->nodeid, dag_stream, "@");
@@ -247,11 +249,12 @@ static void dag_to_dax_header( const char *name, FILE *output )
 /* Write list of files in DAX format for a given node
  * @param type 0 for input 1 for output
  */
-static void dag_to_dax_files(struct list *fs, int type, FILE *output)
+static void dag_to_dax_files(struct dag_file **fs, int count, int type, FILE *output)
 {
 	const struct dag_file *f;
-	list_first_item(fs);
-	while((f = list_next_item(fs))) {
+	int i;
+	for(i = 0; i < count; i++) {
+		f = fs[i];
 		if(type == 0)
 			fprintf(output, "\t\t<uses name=\"%s\" link=\"input\" />\n", f->filename);
 		else
@@ -299,8 +302,8 @@ void dag_to_dax_individual_node(const struct dag_node *n, UINT64_T node_id, FILE
 	const char *redirection = node_executable_redirect(n);
 	if(redirection) fprintf(output, "\t\t<stdout name=\"%s\" link=\"output\" />\n", redirection);
 
-	dag_to_dax_files(n->source_files, 0, output);
-	dag_to_dax_files(n->target_files, 1, output);
+	dag_to_dax_files(n->source_files, n->source_count, 0, output);
+	dag_to_dax_files(n->target_files, n->target_count, 1, output);
 	fprintf(output, "\t</job>\n");
 }
 
@@ -490,6 +493,7 @@ void dag_to_cyto(struct dag *d, int condense_display, int change_size)
 	struct dag_file *f;
 	struct hash_table *h, *g;
 	struct dot_node *t;
+	int i;
 
 	struct file_node *e;
 
@@ -580,8 +584,8 @@ void dag_to_cyto(struct dag *d, int condense_display, int change_size)
 	g = hash_table_create(0, 0);
 
 	for(n = d->nodes; n; n = n->next) {
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			fn = f->filename;
 			e = hash_table_lookup(g, fn);
 			if(!e) {
@@ -595,8 +599,8 @@ void dag_to_cyto(struct dag *d, int condense_display, int change_size)
 				hash_table_insert(g, fn, e);
 			}
 		}
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			fn = f->filename;
 			e = hash_table_lookup(g, fn);
 			if(!e) {
@@ -635,14 +639,14 @@ void dag_to_cyto(struct dag *d, int condense_display, int change_size)
 		t = hash_table_lookup(h, label);
 
 
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			e = hash_table_lookup(g, f->filename);
 			write_edge_to_xgmml(cytograph, 'F', e->id, 'N', n->nodeid, 1);
 		}
 
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			e = hash_table_lookup(g, f->filename);
 			write_edge_to_xgmml(cytograph, 'N', n->nodeid, 'F', e->id, 1);
 		}
@@ -694,6 +698,7 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 	//Dot Details Variables
 	int i;
 	int j;
+	int k;
 	struct file_node *src;
 	struct file_node *tar;
 
@@ -749,8 +754,8 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 	g = hash_table_create(0, 0);
 
 	for(n = d->nodes; n; n = n->next) {
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			fn = f->filename;
 			e = hash_table_lookup(g, fn);
 			if(!e) {
@@ -764,8 +769,8 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 				hash_table_insert(g, fn, e);
 			}
 		}
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			fn = f->filename;
 			e = hash_table_lookup(g, fn);
 			if(!e) {
@@ -796,9 +801,9 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 				printf("\tcores%d -> resMem%d -> workDirFtprnt%d [color=white]", condense_display ? t->id : n->nodeid, condense_display ? t->id : n->nodeid, condense_display ? t->id : n->nodeid);
 
 				//Source Files
-				list_first_item(n->source_files);
 				i = 0;
-				while((f = list_next_item(n->source_files))) {
+				for(k = 0; k < n->source_count; k++) {
+					f = n->source_files[k];
 					fn = f->filename;
 					e = hash_table_lookup(g, fn);
 					if(e) {
@@ -809,9 +814,9 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 				}
 
 				//Target Files
-				list_first_item(n->target_files);
 				j = 0;
-				while((f = list_next_item(n->target_files))) {
+				for(k = 0; k < n->target_count; k++) {
+					f = n->target_files[k];
 					fn = f->filename;
 					e = hash_table_lookup(g, fn);
 					if(e) {
@@ -886,8 +891,8 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 		t = hash_table_lookup(h, label);
 
 
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			e = hash_table_lookup(g, f->filename);
 
 			if(with_details) {
@@ -901,8 +906,8 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 			}
 		}
 
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			e = hash_table_lookup(g, f->filename);
 
 			if(with_details) {
@@ -939,6 +944,7 @@ void dag_to_dot(struct dag *d, int condense_display, int change_size, int with_l
 
 void ppm_color_parser(struct dag_node *n, char *color_array, int ppm_mode, char (*ppm_option), int current_level, int whitespace_on)
 {
+	int i;
 
 	if(whitespace_on) {
 		color_array[0] = 1;
@@ -997,8 +1003,8 @@ void ppm_color_parser(struct dag_node *n, char *color_array, int ppm_mode, char
 	}
 	if(ppm_mode == 3) {
 		//searches the files for a result file named such
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			if(strcmp(f->filename, ppm_option) == 0) {
 				//makes this file, set to purple
 				color_array[0] = 1;
@@ -1210,15 +1216,16 @@ struct jx *category_to_json(struct category *c) {
 	return result;
 }
 
-struct jx *files_to_json(struct list *files, struct itable *remote_names) {
+struct jx *files_to_json(struct dag_file **files, int count, struct itable *remote_names) {
 	struct jx *result = jx_array(NULL);
 	struct dag_file *file;
+	int i;
 
-	list_first_item(files);
-	while((file = list_next_item(files))) {
+	for(i = 0; i < count; i++) {
+		file = files[i];
 
 		const char *task_name = file->filename;
-		const char *dag_name = itable_lookup(remote_names,(uintptr_t)file);
+		const char *dag_name = remote_names ? itable_lookup(remote_names,(uintptr_t)file) : NULL;
 
 		if(dag_name) {
 			struct jx *f = jx_object(NULL);
@@ -1247,8 +1254,8 @@ struct jx *dag_nodes_to_json(struct dag_node *node) {
 		}
 		jx_insert_unless_empty(rule, jx_string("resources"), resources_to_json(n->resources_requested));
 		jx_insert_unless_empty(rule, jx_string("environment"), variables_to_json(n->variables));
-		jx_insert(rule, jx_string("outputs"), files_to_json(n->target_files, n->remote_names));
-		jx_insert(rule, jx_string("inputs"), files_to_json(n->source_files, n->remote_names));
+		jx_insert(rule, jx_string("outputs"), files_to_json(n->target_files, n->target_count, n->remote_names));
+		jx_insert(rule, jx_string("inputs"), files_to_json(n->source_files, n->source_count, n->remote_names));
 		if(n->local_job) {
 			jx_insert(rule, jx_string("local_job"), jx_boolean(n->local_job));
 		}
@@ -9,6 +9,9 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "int_sizes.h"
 #include "stringtools.h"
@@ -30,6 +33,9 @@
 
 #define WHITE_SPACE          " \t"
 #define BUFFER_CHUNK_SIZE 1048576	// One megabyte
+#define LEXEME_INITIAL_SIZE 1024
+
+#define MAX_COLUMN_HISTORY 1024    // Newlines that can be rolled back with correct column numbers.
 
 #define MAX_SUBSTITUTION_DEPTH 32
 
@@ -135,8 +141,14 @@ void lexer_roll_back_one(struct lexer *lx)
 		lx->column_number--;
 	}
 
+	if(lx->single_buffer) {
+		if(lx->lexeme_end > lx->buffer)
+			lx->lexeme_end--;
+		return;
+	}
+
 	if(lx->lexeme_end == lx->buffer)
-		lx->lexeme_end = (lx->buffer + 2 * BUFFER_CHUNK_SIZE);
+		lx->lexeme_end = (lx->buffer + 2 * lx->chunk_size);
 
 	lx->lexeme_end--;
 
@@ -155,12 +167,12 @@ void lexer_roll_back(struct lexer *lx, int offset)
 void lexer_add_to_lexeme(struct lexer *lx, char c)
 {
 	if(lx->lexeme_size == lx->lexeme_max) {
-		char *tmp = realloc(lx->lexeme, lx->lexeme_max + BUFFER_CHUNK_SIZE);
+		char *tmp = realloc(lx->lexeme, 2 * lx->lexeme_max);
 		if(!tmp) {
 			fatal("Could not allocate memory for next token.\n");
 		}
 		lx->lexeme = tmp;
-		lx->lexeme_max += BUFFER_CHUNK_SIZE;
+		lx->lexeme_max *= 2;
 	}
 
 	*(lx->lexeme + lx->lexeme_size) = c;
@@ -256,33 +268,76 @@ void lexer_load_chunk(struct lexer *lx)
 	else
 		return;
 
-	int bread = fread(lx->lexeme_end, sizeof(char), BUFFER_CHUNK_SIZE - 1, lx->stream);
+	size_t bread = fread(lx->lexeme_end, sizeof(char), lx->chunk_size - 1, lx->stream);
 
-	*(lx->buffer + BUFFER_CHUNK_SIZE - 1) = '\0';
-	*(lx->buffer + 2 * BUFFER_CHUNK_SIZE - 1) = '\0';
+	*(lx->buffer + lx->chunk_size - 1) = '\0';
+	*(lx->buffer + 2 * lx->chunk_size - 1) = '\0';
 
-	if(lx->lexeme_end >= lx->buffer + 2 * BUFFER_CHUNK_SIZE)
+	if(lx->lexeme_end >= lx->buffer + 2 * lx->chunk_size)
 		fatal("End of token is out of bounds.\n");
 
-	if(bread < BUFFER_CHUNK_SIZE - 1)
+	if(bread < lx->chunk_size - 1)
 		*(lx->lexeme_end + bread) = CHAR_EOF;
 
 }
 
+/* The whole input is kept in a single buffer, starting at buffer + 1 and
+   terminated with CHAR_EOF. buffer[0] is the position before the first
+   character. */
+
 void lexer_load_string(struct lexer *lx, char *s)
 {
-	int len = strlen(s);
+	size_t len = strlen(s);
 
-	lx->chunk_last_loaded = 1;
+	lx->single_buffer = 1;
+	lx->buffer = malloc(len + 2);
+	if(!lx->buffer)
+		fatal("Could not allocate memory for input buffer.\n");
 
-	strcpy(lx->buffer, s);
-	*(lx->buffer + len) = CHAR_EOF;
+	lx->buffer[0] = '\0';
+	memcpy(lx->buffer + 1, s, len);
+	lx->buffer[len + 1] = CHAR_EOF;
 
-	*(lx->buffer + 2 * BUFFER_CHUNK_SIZE - 1) = '\0';
+	lx->lexeme_end = lx->buffer;
+}
 
-	if(lx->lexeme_end >= lx->buffer + 2 * BUFFER_CHUNK_SIZE)
-		fatal("End of token is out of bounds.\n");
+/* Map a regular file in memory, with room for the '\0' before and the
+   CHAR_EOF after its contents. The file is mapped privately, so that the
+   CHAR_EOF written after the end of the file is not written to the file. */
+
+static int lexer_map_stream(struct lexer *lx, FILE *stream)
+{
+	struct stat info;
+	long page = sysconf(_SC_PAGESIZE);
+
+	if(fstat(fileno(stream), &info) < 0 || !S_ISREG(info.st_mode) || info.st_size < 1)
+		return 0;
+
+	/* Anonymous pages around the file keep the sentinels accessible even
+	   if the file size is a multiple of the page size. */
+	size_t size = page + info.st_size + page;
+	char *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(region == MAP_FAILED)
+		return 0;
+
+	if(mmap(region + page, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(stream), 0) == MAP_FAILED) {
+		munmap(region, size);
+		return 0;
+	}
+
+	madvise(region + page, info.st_size, MADV_SEQUENTIAL);
+
+	lx->mapped = region;
+	lx->mapped_size = size;
+	lx->single_buffer = 1;
+
+	lx->buffer = region + page - 1;
+	lx->buffer[0] = '\0';
+	lx->buffer[info.st_size + 1] = CHAR_EOF;
+
+	lx->lexeme_end = lx->buffer;
 
+	return 1;
 }
 
 
@@ -292,12 +347,13 @@ char lexer_next_char(struct lexer *lx)
 		return CHAR_EOF;
 	}
 
+	if(lx->single_buffer) {
+		lx->lexeme_end++;
+	}
 	/* If at the end of chunk, load the next chunk. */
-	if(((lx->lexeme_end + 1) == (lx->buffer + BUFFER_CHUNK_SIZE - 1)) || ((lx->lexeme_end + 1) == (lx->buffer + 2 * BUFFER_CHUNK_SIZE - 1))) {
-		if(lx->lexeme_max == BUFFER_CHUNK_SIZE - 1)
-			lexer_report_error(lx, "Input buffer is full. Runaway token?");	//BUG: This is really a recoverable error, increase the buffer size.
+	else if(((lx->lexeme_end + 1) == (lx->buffer + lx->chunk_size - 1)) || ((lx->lexeme_end + 1) == (lx->buffer + 2 * lx->chunk_size - 1))) {
 		/* Wrap around the file chunks */
-		else if(lx->lexeme_end == lx->buffer + 2 * BUFFER_CHUNK_SIZE - 2)
+		if(lx->lexeme_end == lx->buffer + 2 * lx->chunk_size - 2)
 			lx->lexeme_end = lx->buffer;
 		/* Position at the beginning of next chunk */
 		else
@@ -312,6 +368,8 @@ char lexer_next_char(struct lexer *lx)
 	if(c == '\n') {
 		lx->line_number++;
 		list_push_head(lx->column_numbers, (uint64_t *) lx->column_number);
+		if(list_size(lx->column_numbers) > MAX_COLUMN_HISTORY)
+			list_pop_tail(lx->column_numbers);
 		lx->column_number = 1;
 	} else {
 		lx->column_number++;
@@ -1283,29 +1341,35 @@ struct lexer *lexer_create(int type, void *data, int line_number, int column_num
 
 	lx->stream = NULL;
 	lx->buffer = NULL;
+	lx->chunk_size = BUFFER_CHUNK_SIZE;
+	lx->single_buffer = 0;
+	lx->mapped = NULL;
+	lx->mapped_size = 0;
 	lx->eof = 0;
 
 	lx->depth = 0;
 
 	lx->keep_quotes = 1; // Keep " and ', unless expanding file specifications
 
-	lx->lexeme = calloc(BUFFER_CHUNK_SIZE, sizeof(char));
+	lx->lexeme = calloc(LEXEME_INITIAL_SIZE, sizeof(char));
 	lx->lexeme_size = 0;
-	lx->lexeme_max = BUFFER_CHUNK_SIZE;
+	lx->lexeme_max = LEXEME_INITIAL_SIZE;
 
 	lx->token_queue = list_create();
 
-	lx->buffer = calloc(2 * BUFFER_CHUNK_SIZE, sizeof(char));
-	if(!lx->buffer)
-		fatal("Could not allocate memory for input buffer.\n");
-
-	lx->lexeme_end = (lx->buffer + 2 * BUFFER_CHUNK_SIZE - 2);
-
 	if(type == STREAM) {
 		lx->stream = (FILE *) data;
 
-		lx->chunk_last_loaded = 2;	// Bootstrap load_chunk to load chunk 1.
-		lexer_load_chunk(lx);
+		if(!lexer_map_stream(lx, lx->stream)) {
+			lx->buffer = calloc(2 * lx->chunk_size, sizeof(char));
+			if(!lx->buffer)
+				fatal("Could not allocate memory for input buffer.\n");
+
+			lx->lexeme_end = (lx->buffer + 2 * lx->chunk_size - 2);
+
+			lx->chunk_last_loaded = 2;	// Bootstrap load_chunk to load chunk 1.
+			lexer_load_chunk(lx);
+		}
 	} else {
 		lexer_load_string(lx, (char *) data);
 	}
@@ -1348,7 +1412,10 @@ void lexer_delete(struct lexer *lx)
 
 	list_delete(lx->token_queue);
 
-	free(lx->buffer);
+	if(lx->mapped)
+		munmap(lx->mapped, lx->mapped_size);
+	else
+		free(lx->buffer);
 
 	free(lx);
 }
@@ -60,9 +60,10 @@
    until a NEWLINE token is found.
 
    The lowest level function is lexer_next_char, which reads the stream
-   char by char. For efficiency, the file chunks are read
-   alternativetely into two buffers as needed. The current buffer
-   position is kept at lx->lexeme_end;
+   char by char. For efficiency, a regular file is memory mapped and read
+   directly, as are the strings of variable substitutions. Other streams
+   are read in chunks alternativetely into two buffers as needed. The
+   current buffer position is kept at lx->lexeme_end;
 
    As tokens are recognized, the function lexer_add_to_lexeme
    accumulates the current value of the token. The function
@@ -95,6 +96,10 @@ struct lexer
 
 	int   chunk_last_loaded;
 	char *buffer;
+	uint64_t chunk_size;   /* Size of each of the two halves of buffer when a stream is read in chunks. */
+	int   single_buffer;   /* If set, all the input is in buffer, between a leading '\0' and CHAR_EOF. */
+	void *mapped;          /* Memory map of the input file, if the file could be mapped. */
+	size_t mapped_size;
 
 	int eof;
 
@@ -184,6 +184,19 @@ before starting the dag, instead proceed under optimistic assumptions.
 
 static int skip_file_check = 0;
 
+/*
+Number of processes used to check for files concurrently before starting the dag.
+*/
+
+static int file_check_workers = 8;
+
+/*
+Seconds between checkpoints of the dag state written next to the log.
+If zero, no checkpoints are written.
+*/
+
+static int log_checkpoint_interval = 300;
+
 /*
 Enable caching within the underlying batch system.
 In the case of Work Queue, this caches immutable files on the workers.
@@ -342,13 +355,14 @@ struct batch_task *makeflow_node_to_task(struct dag_node *n, struct batch_queue
 	/* Add all input and output files to the task */
 
 	struct dag_file *f;
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))){
+	int i;
+	for(i = 0; i < n->source_count; i++) {
+		f = n->source_files[i];
 		batch_task_add_input_file(task, f->filename, dag_node_get_remote_name(n, f->filename));
 	}
 
-	list_first_item(n->target_files);
-	while((f = list_next_item(n->target_files))){
+	for(i = 0; i < n->target_count; i++) {
+		f = n->target_files[i];
 		batch_task_add_output_file(task, f->filename, dag_node_get_remote_name(n, f->filename));
 	}
 
@@ -441,8 +455,9 @@ void makeflow_node_reset( struct dag *d, struct dag_node *n )
 
 	/* For each of my output files... */
 	struct dag_file *f;
-	list_first_item(n->target_files);
-	while((f = list_next_item(n->target_files))) {
+	int i;
+	for(i = 0; i < n->target_count; i++) {
+		f = n->target_files[i];
 		/* Reset all nodes that consume that file. */
 		makeflow_node_reset_by_file(d,f);
 	}
@@ -456,8 +471,9 @@ static void makeflow_node_reset_by_file( struct dag *d, struct dag_file *f )
 {
 	/* For each node that consumes the file... */
 	struct dag_node *n;
-	list_first_item(f->needed_by);
-	while((n = list_next_item(f->needed_by))) {
+	int i;
+	for(i = 0; i < f->needed_by_count; i++) {
+		n = f->needed_by[i];
 		/* Reset that node and its descendants */
 		makeflow_node_reset(d,n);
 	}
@@ -586,6 +602,11 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 	/* Create task from node information */
 	struct batch_task *task = makeflow_node_to_task(n, queue );
 	batch_queue_set_int_option(queue, "task-id", task->taskid);
+
+	/* Let the batch system also run first the nodes on the longest remaining paths. */
+	char *task_priority = string_format("%f", n->priority);
+	batch_queue_set_option(queue, "task-priority", task_priority);
+	free(task_priority);
 	n->task = task;
 
 	int hook_return = makeflow_hook_node_submit(n, task);
@@ -619,6 +640,8 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 			debug(D_MAKEFLOW_RUN, "node %d was successfully submitted.", n->nodeid);
 			n->jobid = task->jobid;
 			/* Not sure if this is necessary/what it does. */
+			if(!n->resources_allocated)
+				n->resources_allocated = rmsummary_create(-1);
 			memcpy(n->resources_allocated, task->resources, sizeof(struct rmsummary));
 			makeflow_log_state_change(d, n, DAG_NODE_STATE_RUNNING);
 
@@ -653,8 +676,6 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 
 static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct rmsummary *resources)
 {
-	struct dag_file *f;
-
 	if(n->state != DAG_NODE_STATE_WAITING)
 		return 0;
 
@@ -671,14 +692,8 @@ static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct r
 			return 0;
 	}
 
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))) {
-		if(dag_file_should_exist(f)) {
-			continue;
-		} else {
-			return 0;
-		}
-	}
+	if(n->unmet_sources > 0)
+		return 0;
 
 	/* If all makeflow checks pass for this node we will 
 	return the result of the hooks, which will be 1 if all pass
@@ -717,12 +732,18 @@ int makeflow_nodes_remote_waiting_count(const struct dag *d) {
 
 /*
 Find all jobs ready to be run, then submit them.
+Only the nodes in the ready queue are considered, that is, waiting nodes
+whose sources all should exist. Nodes that cannot be submitted in this
+cycle (e.g. because of resource limits) are put back in the queue.
 */
 
 static void makeflow_dispatch_ready_jobs(struct dag *d)
 {
 	struct dag_node *n;
 
+	if(!d->ready_nodes)
+		dag_ready_compute(d);
+
 	/* When submitting to an external queue if there are no resources
 	 * available, such as vms in amazon, then the submission fails with a
 	 * timeout. When this occurs, submission_timeout is set to 1, and only
@@ -733,10 +754,12 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 	 */
 	int submission_timeout = 0;
 
-	for(n = d->nodes; n; n = n->next) {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max) {
+	struct list *deferred = list_create();
+
+	while(!(dag_remote_jobs_running(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max)) {
+		n = dag_ready_pop(d);
+		if(!n)
 			break;
-		}
 
 		const struct rmsummary *resources = dag_node_dynamic_label(n);
 
@@ -745,6 +768,7 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 				enum job_submit_status status = makeflow_node_submit(d, n, resources);
 
 				if(status == JOB_SUBMISSION_ABORTED) {
+					list_push_tail(deferred, n);
 					break;
 				} else if(status == JOB_SUBMISSION_TIMEOUT) {
 					debug(D_MAKEFLOW_RUN, "batch submissions are timing-out. Only submitting local jobs for the rest of this cycle.");
@@ -752,7 +776,16 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 				}
 			}
 		}
+
+		/* Keep the node for a later cycle if it was not submitted. */
+		if(n->state == DAG_NODE_STATE_WAITING)
+			list_push_tail(deferred, n);
+	}
+
+	while((n = list_pop_head(deferred))) {
+		dag_ready_node_waiting(d, n);
 	}
+	list_delete(deferred);
 }
 
 /*
@@ -930,25 +963,45 @@ a prior run that was logged.
 
 static int makeflow_check_files(struct dag *d)
 {
-	struct stat buf;
 	struct dag_file *f;
 	char *name;
 	int errors = 0;
 	int warnings = 0;
+	int i, n = 0;
 
 	printf("checking files for unexpected changes...  (use --skip-file-check to skip this step)\n");
 
+	/* Gather all the files to check, so that they can be examined in one batch. */
+	struct dag_file **files = xxmalloc(MAX(hash_table_size(d->files), 1) * sizeof(*files));
+	const char **paths = xxmalloc(MAX(hash_table_size(d->files), 1) * sizeof(*paths));
+
 	hash_table_firstkey(d->files);
 	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
 
 		/* Skip special files that are not connected to the DAG nodes. */
-		if(!f->created_by && !list_size(f->needed_by)) continue;
+		if(!f->created_by && !f->needed_by_count) continue;
 
 		/* Skip any file that should not exist yet. */
 		if(!dag_file_should_exist(f)) continue;
 
-		/* Check for the presence of the file. */
-		int result = batch_fs_stat(remote_queue, f->filename, &buf );
+		files[n] = f;
+		paths[n] = f->filename;
+		n++;
+	}
+
+	/* Check for the presence of the files. */
+	struct stat *bufs = xxmalloc(MAX(n, 1) * sizeof(*bufs));
+	int *results = xxmalloc(MAX(n, 1) * sizeof(*results));
+
+	batch_fs_stat_many(remote_queue, paths, bufs, results, n, file_check_workers);
+
+	for(i = 0; i < n; i++) {
+		f = files[i];
+		int result = results[i];
+		struct stat *buf = &bufs[i];
+
+		/* A previous reset may have removed the expectation for this file. */
+		if(!dag_file_should_exist(f)) continue;
 
 		if(dag_file_is_source(f)) {
 			/* Source files must exist before running */
@@ -964,7 +1017,7 @@ static int makeflow_check_files(struct dag *d)
 				makeflow_log_file_state_change(d, f, DAG_FILE_STATE_UNKNOWN);
 				makeflow_node_reset(d,f->created_by);
 				warnings++;
-			} else if(!S_ISDIR(buf.st_mode) && difftime(buf.st_mtime, f->creation_logged) > 0) {
+			} else if(!S_ISDIR(buf->st_mode) && difftime(buf->st_mtime, f->creation_logged) > 0) {
 				/* Recreate descendants by resetting all nodes that consume this file. */
 				printf("warning: %s was previously created by makeflow, but someone else modified it!\n",f->filename);
 				makeflow_node_reset_by_file(d,f);
@@ -973,6 +1026,11 @@ static int makeflow_check_files(struct dag *d)
 		}
 	}
 
+	free(files);
+	free(paths);
+	free(bufs);
+	free(results);
+
 	if(errors>0 || warnings>0) {
 		printf("found %d errors and %d warnings during consistency check.\n", errors,warnings);
 	}
@@ -999,7 +1057,7 @@ static int makeflow_check_batch_consistency(struct dag *d)
 
 	for(n = d->nodes; n; n = n->next) {
 
-		if(itable_size(n->remote_names) > 0){
+		if(n->remote_names && itable_size(n->remote_names) > 0){
 			if(n->local_job) {
 				debug(D_ERROR, "Remote renaming is not supported with -Tlocal or LOCAL execution. Rule %d (line %d).\n", n->nodeid, n->linenum);
 				error = 1;
@@ -1019,19 +1077,42 @@ static int makeflow_check_batch_consistency(struct dag *d)
 	}
 }
 
+/*
+Handle one job returned by batch_job_wait_all.
+*/
+
+static void makeflow_job_complete(struct batch_queue *queue, batch_job_id_t jobid, struct batch_job_info *info, void *arg)
+{
+	struct dag *d = arg;
+	struct dag_node *n;
+
+	if(queue == remote_queue) {
+		printf("job %"PRIbjid" completed\n",jobid);
+		n = itable_remove(d->remote_job_table, jobid);
+	} else {
+		n = itable_remove(d->local_job_table, jobid);
+	}
+
+	debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
+
+	if(n){
+		// Stop gap until batch_job_wait returns task struct
+		batch_task_set_info(n->task, info);
+		makeflow_node_complete(d, n, queue, n->task);
+	}
+}
+
 /*
 Main loop for running a makeflow: submit jobs, wait for completion, keep going until everything done.
 */
 
 static void makeflow_run( struct dag *d )
 {
-	struct dag_node *n;
-	batch_job_id_t jobid;
-	struct batch_job_info info;
 	// Start Catalog at current time
 	timestamp_t start = timestamp_get();
 	// Last Report is created stall for first reporting.
 	timestamp_t last_time = start - (60 * 1000 * 1000);
+	time_t last_checkpoint = time(0);
 
 	//reporting to catalog
 	if(catalog_reporting_on){
@@ -1054,41 +1135,26 @@ static void makeflow_run( struct dag *d )
 			break;
 		}
 
+		/* Collect every job that has completed before dispatching again,
+		 * so that a burst of completions is handled in a single cycle. */
+		int completed = 0;
+
 		if(dag_remote_jobs_running(d)) {
 			int tmp_timeout = 5;
-			jobid = batch_job_wait_timeout(remote_queue, &info, time(0) + tmp_timeout);
-			if(jobid > 0) {
-				printf("job %"PRIbjid" completed\n",jobid);
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->remote_job_table, jobid);
-				if(n){
-					// Stop gap until batch_job_wait returns task struct
-					batch_task_set_info(n->task, &info);
-					makeflow_node_complete(d, n, remote_queue, n->task);
-				}
-			}
+			completed += batch_job_wait_all(remote_queue, makeflow_job_complete, d, time(0) + tmp_timeout);
 		}
 
 		if(dag_local_jobs_running(d)) {
 			time_t stoptime;
 			int tmp_timeout = 5;
 
-			if(dag_remote_jobs_running(d)) {
+			if(dag_remote_jobs_running(d) || completed > 0) {
 				stoptime = time(0);
 			} else {
 				stoptime = time(0) + tmp_timeout;
 			}
 
-			jobid = batch_job_wait_timeout(local_queue, &info, stoptime);
-			if(jobid > 0) {
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->local_job_table, jobid);
-				if(n){
-					// Stop gap until batch_job_wait returns task struct
-					batch_task_set_info(n->task, &info);
-					makeflow_node_complete(d, n, local_queue, n->task);
-				}
-			}
+			completed += batch_job_wait_all(local_queue, makeflow_job_complete, d, stoptime);
 		}
 
 		/* Report to catalog */
@@ -1099,11 +1165,17 @@ static void makeflow_run( struct dag *d )
 			last_time = now;
 		}
 
+		/* Checkpoint the state of the dag, so that a restart does not replay the whole log. */
+		if(log_checkpoint_interval > 0 && time(0) - last_checkpoint >= log_checkpoint_interval) {
+			makeflow_log_checkpoint(d);
+			last_checkpoint = time(0);
+		}
+
 		/* Rather than try to garbage collect after each time in this
 		 * wait loop, perform garbage collection after a proportional
 		 * amount of tasks have passed. */
-		makeflow_gc_barrier--;
-		if(makeflow_gc_method != MAKEFLOW_GC_NONE && makeflow_gc_barrier == 0) {
+		makeflow_gc_barrier -= MAX(completed, 1);
+		if(makeflow_gc_method != MAKEFLOW_GC_NONE && makeflow_gc_barrier <= 0) {
 			makeflow_gc(d, remote_queue, makeflow_gc_method, makeflow_gc_size, makeflow_gc_count);
 			makeflow_gc_barrier = MAX(d->nodeid_counter * makeflow_gc_task_ratio, 1);
 		}
@@ -1162,6 +1234,7 @@ static void show_help_run(const char *cmd)
 	printf(" -a,--advertise                 Advertise workflow status to catalog.\n");
 	printf(" -l,--makeflow-log=<logfile>    Use this file for the makeflow log.\n");
 	printf(" -L,--batch-log=<logfile>       Use this file for the batch system log.\n");
+	printf("    --log-checkpoint=<seconds>  Checkpoint the log every <seconds>. (default is 300)\n");
 	printf(" -m,--email=<email>             Send summary of workflow to this email.\n");
 	printf("    --json                      Use JSON format for the workflow specification.\n");
 	printf("    --jx                        Use JX format for the workflow specification.\n");
@@ -1186,6 +1259,7 @@ static void show_help_run(const char *cmd)
 	printf("    --archive-dir=<dir>         Archive directory(/tmp/makeflow.archive.USERID).\n");
 	printf("    --archive-read              Read jobs from archive.\n");
 	printf("    --archive-write             Write jobs into archive.\n");
+	printf("    --archive-hash-workers=<n>  Checksum archived files with up to n processes.\n");
 	printf(" -A,--disable-afs-check         Disable the check for AFS. (experts only.)\n");
 	printf("    --cache=<dir>               Use this dir to cache downloaded mounted files.\n");
 	printf(" -X,--change-directory=<dir>    Change to <dir> before executing the workflow.\n");
@@ -1194,6 +1268,7 @@ static void show_help_run(const char *cmd)
 	printf(" -G,--gc-count=<int>            Set number of files to trigger GC.(ref_cnt only)\n");
 	printf("    --mounts=<mountfile>        Use this file as a mountlist\n");
 	printf("    --skip-file-check           Do not check for file existence before running.\n");
+	printf("    --file-check-workers=<n>    Check for files with <n> processes. (default is 8)\n");
 	printf("    --do-not-save-failed-output Disables saving failed nodes to directory.\n"); 
 	printf("    --shared-fs=<dir>           Assume that <dir> is in a shared filesystem.\n");
 	printf("    --storage-limit=<int>       Set storage limit for Makeflow.(default is off)\n");
@@ -1439,6 +1514,8 @@ int main(int argc, char *argv[])
 		LONG_OPT_JX_ARGS,
 		LONG_OPT_JX_DEFINE,
 		LONG_OPT_SKIP_FILE_CHECK,
+		LONG_OPT_FILE_CHECK_WORKERS,
+		LONG_OPT_LOG_CHECKPOINT,
 		LONG_OPT_UMBRELLA_BINARY,
 		LONG_OPT_UMBRELLA_LOG_PREFIX,
 		LONG_OPT_UMBRELLA_MODE,
@@ -1459,6 +1536,7 @@ int main(int argc, char *argv[])
 		LONG_OPT_ARCHIVE_DIR,
 		LONG_OPT_ARCHIVE_READ,
 		LONG_OPT_ARCHIVE_WRITE,
+		LONG_OPT_ARCHIVE_HASH_WORKERS,
 		LONG_OPT_MESOS_MASTER,
 		LONG_OPT_MESOS_PATH,
 		LONG_OPT_MESOS_PRELOAD,
@@ -1537,6 +1615,8 @@ int main(int argc, char *argv[])
 		{"log-verbose", no_argument, 0, LONG_OPT_LOG_VERBOSE_MODE},
 		{"working-dir", required_argument, 0, LONG_OPT_WORKING_DIR},
 		{"skip-file-check", no_argument, 0, LONG_OPT_SKIP_FILE_CHECK},
+		{"file-check-workers", required_argument, 0, LONG_OPT_FILE_CHECK_WORKERS},
+		{"log-checkpoint", required_argument, 0, LONG_OPT_LOG_CHECKPOINT},
 		{"umbrella-binary", required_argument, 0, LONG_OPT_UMBRELLA_BINARY},
 		{"umbrella-log-prefix", required_argument, 0, LONG_OPT_UMBRELLA_LOG_PREFIX},
 		{"umbrella-mode", required_argument, 0, LONG_OPT_UMBRELLA_MODE},
@@ -1579,6 +1659,7 @@ int main(int argc, char *argv[])
 		{"archive-dir", required_argument, 0, LONG_OPT_ARCHIVE_DIR},
 		{"archive-read", no_argument, 0, LONG_OPT_ARCHIVE_READ},
 		{"archive-write", no_argument, 0, LONG_OPT_ARCHIVE_WRITE},
+		{"archive-hash-workers", required_argument, 0, LONG_OPT_ARCHIVE_HASH_WORKERS},
 		{"mesos-master", required_argument, 0, LONG_OPT_MESOS_MASTER},
 		{"mesos-path", required_argument, 0, LONG_OPT_MESOS_PATH},
 		{"mesos-preload", required_argument, 0, LONG_OPT_MESOS_PRELOAD},
@@ -1899,6 +1980,12 @@ int main(int argc, char *argv[])
 			case LONG_OPT_SKIP_FILE_CHECK:
 				skip_file_check = 1;
 				break;
+			case LONG_OPT_FILE_CHECK_WORKERS:
+				file_check_workers = atoi(optarg);
+				break;
+			case LONG_OPT_LOG_CHECKPOINT:
+				log_checkpoint_interval = atoi(optarg);
+				break;
 			case LONG_OPT_DOCKER_TAR:
 				if (makeflow_hook_register(&makeflow_hook_docker, &hook_args) == MAKEFLOW_HOOK_FAILURE)
 					goto EXIT_WITH_FAILURE;
@@ -2029,6 +2116,11 @@ int main(int argc, char *argv[])
 					goto EXIT_WITH_FAILURE;
 				jx_insert(hook_args, jx_string("archive_write"), jx_boolean(1));
 				break;
+			case LONG_OPT_ARCHIVE_HASH_WORKERS:
+				if (makeflow_hook_register(&makeflow_hook_archive, &hook_args) == MAKEFLOW_HOOK_FAILURE)
+					goto EXIT_WITH_FAILURE;
+				jx_insert(hook_args, jx_string("archive_hash_workers"), jx_integer(atoi(optarg)));
+				break;
 #endif
 			case LONG_OPT_SEND_ENVIRONMENT:
 				should_send_all_local_environment = 1;
@@ -2456,6 +2548,9 @@ int main(int argc, char *argv[])
 		if(clean_mode == MAKEFLOW_CLEAN_ALL) {
 			unlink(logfilename);
 			unlink(batchlogfilename);
+			char *checkpointname = makeflow_log_checkpoint_filename(logfilename);
+			unlink(checkpointname);
+			free(checkpointname);
 		}
 
 		goto EXIT_WITH_SUCCESS;
@@ -132,9 +132,10 @@ uint64_t makeflow_alloc_node_size( struct makeflow_alloc *a, struct dag_node *cu
 	uint64_t alloc_size;
 	uint64_t freed_space = 0;
 	struct dag_file *f;
+	int i;
 	if(n->footprint->footprint_min_type != DAG_NODE_FOOTPRINT_RUN){
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))){
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			if(f->reference_count == 1){
 				freed_space += dag_file_size(f);
 			}
@@ -307,7 +308,7 @@ int makeflow_alloc_commit_space( struct makeflow_alloc *a, struct dag_node *n)
 int makeflow_alloc_use_space( struct makeflow_alloc *a, struct dag_node *n)
 {
 	uint64_t start = timestamp_get();
-	uint64_t inc = dag_file_list_size(n->target_files);
+	uint64_t inc = dag_file_array_size(n->target_files, n->target_count);
 	if(a->enabled == MAKEFLOW_ALLOC_TYPE_OFF){
 		a->storage->used   += inc;
 		dynamic_alloc += timestamp_get() - start;
@@ -39,6 +39,7 @@ int  makeflow_local_resources_available(struct rmsummary *local, const struct rm
 void makeflow_local_resources_subtract( struct rmsummary *local, struct dag_node *n )
 {
 	const struct rmsummary *s = n->resources_allocated;
+	if(!s) return;
 	if(s->cores>=0)  local->cores -= s->cores;
 	if(s->memory>=0) local->memory -= s->memory;		
 	if(s->disk>=0)   local->disk -= s->disk;
@@ -48,6 +49,7 @@ void makeflow_local_resources_subtract( struct rmsummary *local, struct dag_node
 void makeflow_local_resources_add( struct rmsummary *local, struct dag_node *n )
 {
 	const struct rmsummary *s = n->resources_allocated;
+	if(!s) return;
 	if(s->cores>=0)  local->cores += s->cores;
 	if(s->memory>=0) local->memory += s->memory;		
 	if(s->disk>=0)   local->disk += s->disk;
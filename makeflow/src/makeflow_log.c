@@ -14,9 +14,15 @@ See the file COPYING for details.
 #include "timestamp.h"
 #include "list.h"
 #include "debug.h"
+#include "full_io.h"
+#include "macros.h"
+#include "stringtools.h"
 #include "xxmalloc.h"
 
+#include <sys/stat.h>
+
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -103,8 +109,55 @@ filename - the filename specified within the dag_file whose state has changed.
 timestamp - the unix time (in microseconds) when this line is written to the log file.
 
 These event types indicate that the workflow as a whole has started or completed in the indicated manner.
+
+----
+
+Replaying a long log can take a long time, so the state of the dag is also
+written periodically to a checkpoint file next to the log (logfile.checkpoint).
+The checkpoint is a binary snapshot of the state of every node and of every
+file that has been logged, together with the size of the log at the time
+the checkpoint was written, and the last bytes of the log before that point.
+On recovery, if the log still has those bytes at that position, the checkpoint
+is loaded and only the rest of the log is replayed. Otherwise the checkpoint is
+ignored and the whole log is replayed. The checkpoint is written in the
+byte order of the machine, and is only meant to be read by makeflow on the
+same machine.
 */
 
+#define MAKEFLOW_CHECKPOINT_MAGIC "MFCKPT02"
+#define MAKEFLOW_CHECKPOINT_TAIL 64
+
+struct makeflow_checkpoint_header {
+	char magic[8];
+	uint64_t log_offset;                      /* Size of the log when the checkpoint was written. */
+	char log_tail[MAKEFLOW_CHECKPOINT_TAIL];  /* Last bytes of the log before log_offset. */
+	int32_t nodes;
+	int32_t files;
+	int32_t completed_files;
+	int32_t deleted_files;
+	int32_t cache_dir_length;                 /* Followed by the cache dir, if any. */
+};
+
+struct makeflow_checkpoint_node {
+	int32_t nodeid;
+	int32_t state;
+	int64_t jobid;
+	int64_t previous_completion;
+	int64_t runtime;
+};
+
+struct makeflow_checkpoint_file {
+	int32_t state;
+	int32_t type;
+	int64_t creation_logged;
+	int32_t filename_length;                  /* Followed by the filename, */
+	int32_t source_length;                    /* the mount source, if any, */
+	int32_t cache_name_length;                /* and the mount cache name, if any. */
+};
+
+/* Name of the checkpoint of the log being written, set by makeflow_log_recover. */
+static char *makeflow_log_checkpoint_name = 0;
+
 void makeflow_node_decide_reset( struct dag *d, struct dag_node *n, int silent );
 
 /*
@@ -185,17 +238,39 @@ void makeflow_log_event( struct dag *d, char *name, uint64_t value)
 	makeflow_log_sync(d,1);
 }
 
+/*
+Remember how long a node ran when it goes from running to complete, to be
+used in the priorities of later runs. The time of the last state change of
+a node is only kept in seconds, so the runtime may be up to a second too long.
+*/
+
+static void makeflow_log_node_runtime( struct dag_node *n, int newstate, timestamp_t now )
+{
+	if(n->state == DAG_NODE_STATE_RUNNING && newstate == DAG_NODE_STATE_COMPLETE && n->previous_completion > 0) {
+		timestamp_t started = (timestamp_t) n->previous_completion * 1000000;
+		if(now > started)
+			n->runtime = now - started;
+	}
+	n->previous_completion = (time_t) (now / 1000000);
+}
+
 void makeflow_log_state_change( struct dag *d, struct dag_node *n, int newstate )
 {
 	debug(D_MAKEFLOW_RUN, "node %d %s -> %s\n", n->nodeid, dag_node_state_name(n->state), dag_node_state_name(newstate));
 
+	timestamp_t now = timestamp_get();
+	makeflow_log_node_runtime(n, newstate, now);
+
 	if(d->node_states[n->state] > 0) {
 		d->node_states[n->state]--;
 	}
 	n->state = newstate;
 	d->node_states[n->state]++;
 
-	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
+	if(newstate == DAG_NODE_STATE_WAITING)
+		dag_ready_node_waiting(d, n);
+
+	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", now, n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
 
 	makeflow_log_sync(d,0);
 }
@@ -204,8 +279,13 @@ void makeflow_log_file_state_change( struct dag *d, struct dag_file *f, int news
 {
 	debug(D_MAKEFLOW_RUN, "file %s %s -> %s\n", f->filename, dag_file_state_name(f->state), dag_file_state_name(newstate));
 
+	int existed = dag_file_should_exist(f);
+
 	f->state = newstate;
 
+	if(dag_file_should_exist(f) != existed)
+		dag_ready_file_changed(d, f);
+
 	/* If a file is a wrapper global file do not log to avoid cleaning floating global files. */
 	if(f->type == DAG_FILE_TYPE_GLOBAL) return;
 
@@ -262,6 +342,261 @@ void makeflow_log_gc_event( struct dag *d, int collected, timestamp_t elapsed, i
 	makeflow_log_sync(d,0);
 }
 
+char *makeflow_log_checkpoint_filename( const char *logfilename )
+{
+	return string_format("%s.checkpoint", logfilename);
+}
+
+static int checkpoint_write_string( FILE *file, const char *str, int length )
+{
+	return length == 0 || fwrite(str, length, 1, file) == 1;
+}
+
+static char *checkpoint_read_string( FILE *file, int32_t length )
+{
+	if(length < 0 || length > PATH_MAX)
+		return 0;
+
+	char *str = xxmalloc(length + 1);
+	if(length > 0 && fread(str, length, 1, file) != 1) {
+		free(str);
+		return 0;
+	}
+	str[length] = 0;
+
+	return str;
+}
+
+void makeflow_log_checkpoint( struct dag *d )
+{
+	struct makeflow_checkpoint_header header;
+	struct stat info;
+	struct dag_node *n;
+	struct dag_file *f;
+	char *name;
+
+	if(!d || !d->logfile || !makeflow_log_checkpoint_name) return;
+
+	/* The checkpoint must not refer to log entries that may still be lost. */
+	makeflow_log_sync(d,1);
+
+	if(fstat(fileno(d->logfile), &info) < 0) return;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAKEFLOW_CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.log_offset = info.st_size;
+
+	/* Read back the end of the log, to recognize it on recovery. */
+	int tail = MIN(header.log_offset, MAKEFLOW_CHECKPOINT_TAIL);
+	if(full_pread(fileno(d->logfile), header.log_tail, tail, header.log_offset - tail) != tail) {
+		debug(D_MAKEFLOW_RUN, "couldn't read back the log for a checkpoint: %s", strerror(errno));
+		return;
+	}
+
+	for(n = d->nodes; n; n = n->next) {
+		header.nodes++;
+	}
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		if(f->type == DAG_FILE_TYPE_GLOBAL) continue;
+		if(f->state == DAG_FILE_STATE_UNKNOWN && !f->source) continue;
+		header.files++;
+	}
+
+	header.completed_files = d->completed_files;
+	header.deleted_files = d->deleted_files;
+	header.cache_dir_length = d->cache_dir ? strlen(d->cache_dir) : 0;
+
+	char *tmpname = string_format("%s.tmp", makeflow_log_checkpoint_name);
+	FILE *file = fopen(tmpname, "w");
+	if(!file) {
+		debug(D_MAKEFLOW_RUN, "couldn't write checkpoint %s: %s", tmpname, strerror(errno));
+		free(tmpname);
+		return;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && checkpoint_write_string(file, d->cache_dir, header.cache_dir_length);
+
+	for(n = d->nodes; n && ok; n = n->next) {
+		struct makeflow_checkpoint_node record;
+		memset(&record, 0, sizeof(record));
+		record.nodeid = n->nodeid;
+		record.state = n->state;
+		record.jobid = n->jobid;
+		record.previous_completion = n->previous_completion;
+		record.runtime = n->runtime;
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	}
+
+	hash_table_firstkey(d->files);
+	while(ok && hash_table_nextkey(d->files, &name, (void **) &f)) {
+		if(f->type == DAG_FILE_TYPE_GLOBAL) continue;
+		if(f->state == DAG_FILE_STATE_UNKNOWN && !f->source) continue;
+
+		struct makeflow_checkpoint_file record;
+		memset(&record, 0, sizeof(record));
+		record.state = f->state;
+		record.type = f->type;
+		record.creation_logged = f->creation_logged;
+		record.filename_length = strlen(f->filename);
+		record.source_length = f->source ? strlen(f->source) : 0;
+		record.cache_name_length = f->cache_name ? strlen(f->cache_name) : 0;
+
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+		ok = ok && checkpoint_write_string(file, f->filename, record.filename_length);
+		ok = ok && checkpoint_write_string(file, f->source, record.source_length);
+		ok = ok && checkpoint_write_string(file, f->cache_name, record.cache_name_length);
+	}
+
+	ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+	ok = (fclose(file) == 0) && ok;
+
+	if(ok && rename(tmpname, makeflow_log_checkpoint_name) == 0) {
+		debug(D_MAKEFLOW_RUN, "checkpointed %d nodes and %d files at log offset %" PRIu64, header.nodes, header.files, header.log_offset);
+	} else {
+		debug(D_MAKEFLOW_RUN, "couldn't write checkpoint %s: %s", makeflow_log_checkpoint_name, strerror(errno));
+		unlink(tmpname);
+	}
+
+	free(tmpname);
+}
+
+/*
+Read the records of a checkpoint that follow its header.
+If apply is zero, the records are only checked to be complete,
+so that a truncated checkpoint is not partially applied.
+Returns 1 on success, 0 if the checkpoint is corrupted,
+and -1 if it is inconsistent with the current options.
+*/
+
+static int makeflow_log_checkpoint_records( struct dag *d, FILE *file, const struct makeflow_checkpoint_header *header, int apply )
+{
+	int32_t i;
+
+	char *cache_dir = checkpoint_read_string(file, header->cache_dir_length);
+	if(!cache_dir) return 0;
+
+	if(apply && header->cache_dir_length > 0) {
+		if(!d->cache_dir) {
+			d->cache_dir = cache_dir;
+			cache_dir = 0;
+		} else if(strcmp(cache_dir, d->cache_dir)) {
+			fprintf(stderr, "The --cache option (%s) does not match the cache dir (%s) in the log file!\n", d->cache_dir, cache_dir);
+			free(cache_dir);
+			return -1;
+		}
+	}
+	free(cache_dir);
+
+	for(i = 0; i < header->nodes; i++) {
+		struct makeflow_checkpoint_node record;
+		if(fread(&record, sizeof(record), 1, file) != 1) return 0;
+		if(!apply) continue;
+
+		struct dag_node *n = itable_lookup(d->node_table, record.nodeid);
+		if(n) {
+			n->state = record.state;
+			n->jobid = record.jobid;
+			n->previous_completion = record.previous_completion;
+			n->runtime = record.runtime;
+		}
+	}
+
+	for(i = 0; i < header->files; i++) {
+		struct makeflow_checkpoint_file record;
+		if(fread(&record, sizeof(record), 1, file) != 1) return 0;
+
+		char *filename = checkpoint_read_string(file, record.filename_length);
+		char *source = checkpoint_read_string(file, record.source_length);
+		char *cache_name = checkpoint_read_string(file, record.cache_name_length);
+		int result = filename && source && cache_name;
+
+		if(result && apply) {
+			struct dag_file *f = dag_file_lookup_or_create(d, filename);
+			f->state = record.state;
+			f->creation_logged = record.creation_logged;
+
+			if(record.source_length > 0) {
+				/* As for MOUNT entries in the log. */
+				if(!f->source) {
+					f->source = source;
+					f->cache_name = cache_name;
+					f->type = record.type;
+					source = cache_name = 0;
+				} else if(makeflow_mount_check_consistency(filename, f->source, source, d->cache_dir, cache_name)) {
+					result = -1;
+				}
+			}
+		}
+
+		free(filename);
+		free(source);
+		free(cache_name);
+
+		if(result != 1) return result;
+	}
+
+	if(apply) {
+		d->completed_files = header->completed_files;
+		d->deleted_files = header->deleted_files;
+	}
+
+	return 1;
+}
+
+/*
+Load the checkpoint of the log, if it matches the log.
+Returns the offset of the log from which to continue replaying,
+zero if there is no usable checkpoint, or -1 on a fatal inconsistency.
+*/
+
+static int64_t makeflow_log_checkpoint_load( struct dag *d, const char *checkpoint_name )
+{
+	struct makeflow_checkpoint_header header;
+	char tail[MAKEFLOW_CHECKPOINT_TAIL];
+	struct stat info;
+
+	FILE *file = fopen(checkpoint_name, "r");
+	if(!file) return 0;
+
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MAKEFLOW_CHECKPOINT_MAGIC, sizeof(header.magic))) {
+		debug(D_MAKEFLOW_RUN, "ignoring checkpoint %s: not a checkpoint", checkpoint_name);
+		fclose(file);
+		return 0;
+	}
+
+	/* The log must still have the same contents at the point of the checkpoint. */
+	int tail_length = MIN(header.log_offset, MAKEFLOW_CHECKPOINT_TAIL);
+	if(fstat(fileno(d->logfile), &info) < 0
+		|| (uint64_t) info.st_size < header.log_offset
+		|| full_pread(fileno(d->logfile), tail, tail_length, header.log_offset - tail_length) != tail_length
+		|| memcmp(tail, header.log_tail, tail_length)) {
+		debug(D_MAKEFLOW_RUN, "ignoring checkpoint %s: it does not match the log", checkpoint_name);
+		fclose(file);
+		return 0;
+	}
+
+	int result = makeflow_log_checkpoint_records(d, file, &header, 0);
+	if(result == 1) {
+		fseek(file, sizeof(header), SEEK_SET);
+		result = makeflow_log_checkpoint_records(d, file, &header, 1);
+	}
+	fclose(file);
+
+	if(result == 0) {
+		fprintf(stderr, "makeflow: checkpoint %s is corrupted, replaying the whole log.\n", checkpoint_name);
+		return 0;
+	} else if(result < 0) {
+		return -1;
+	}
+
+	printf("recovered %d nodes and %d files from checkpoint %s...\n", header.nodes, header.files, checkpoint_name);
+
+	return header.log_offset;
+}
+
 /*
 Dump the dag structure into the log file in comment formats.
 This is used by some tools (such as Weaver) for debugging
@@ -272,6 +607,7 @@ void makeflow_log_dag_structure( struct dag *d )
 {
 	struct dag_file *f;
 	struct dag_node *n, *p;
+	int i;
 
 	for(n = d->nodes; n; n = n->next) {
 		/* Record node information to log */
@@ -283,8 +619,8 @@ void makeflow_log_dag_structure( struct dag *d )
 
 		/* Record node parents to log */
 		fprintf(d->logfile, "# PARENTS\t%d", n->nodeid);
-		list_first_item(n->source_files);
-		while( (f = list_next_item(n->source_files)) ) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			p = f->created_by;
 			if(p)
 				fprintf(d->logfile, "\t%d", p->nodeid);
@@ -293,16 +629,16 @@ void makeflow_log_dag_structure( struct dag *d )
 
 		/* Record node inputs to log */
 		fprintf(d->logfile, "# SOURCES\t%d", n->nodeid);
-		list_first_item(n->source_files);
-		while( (f = list_next_item(n->source_files)) ) {
+		for(i = 0; i < n->source_count; i++) {
+			f = n->source_files[i];
 			fprintf(d->logfile, "\t%s", f->filename);
 		}
 		fputc('\n', d->logfile);
 
 		/* Record node outputs to log */
 		fprintf(d->logfile, "# TARGETS\t%d", n->nodeid);
-		list_first_item(n->target_files);
-		while( (f = list_next_item(n->target_files)) ) {
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			fprintf(d->logfile, "\t%s", f->filename);
 		}
 		fputc('\n', d->logfile);
@@ -327,6 +663,9 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 	timestamp_t previous_completion_time;
 	uint64_t size;
 
+	free(makeflow_log_checkpoint_name);
+	makeflow_log_checkpoint_name = makeflow_log_checkpoint_filename(filename);
+
 	d->logfile = fopen(filename, "r");
 	if(d->logfile) {
 		int linenum = 0;
@@ -334,6 +673,14 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 
 		printf("recovering from log file %s...\n",filename);
 
+		/* Start from the checkpoint, if any, and replay only the rest of the log. */
+		int64_t offset = makeflow_log_checkpoint_load(d, makeflow_log_checkpoint_name);
+		if(offset < 0) {
+			return -1;
+		} else if(offset > 0) {
+			fseek(d->logfile, offset, SEEK_SET);
+		}
+
 		while((line = get_line(d->logfile))) {
 			char source[PATH_MAX], cache_dir[NAME_MAX], cache_name[NAME_MAX];
 			int type;
@@ -383,10 +730,10 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 			} else if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
 				n = itable_lookup(d->node_table, nodeid);
 				if(n) {
+					/* Log timestamp is in microseconds, we need seconds for diff. */
+					makeflow_log_node_runtime(n, state, previous_completion_time);
 					n->state = state;
 					n->jobid = jobid;
-					/* Log timestamp is in microseconds, we need seconds for diff. */
-					n->previous_completion = (time_t) (previous_completion_time / 1000000);
 				}
 			} else {
 				fprintf(stderr, "makeflow: %s appears to be corrupted on line %d\n", filename, linenum);
@@ -397,9 +744,12 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 		fclose(d->logfile);
 	} else {
 		printf("creating new log file %s...\n",filename);
+		/* A checkpoint left from a previous log does not apply to the new one. */
+		unlink(makeflow_log_checkpoint_name);
 	}
 
-	d->logfile = fopen(filename, "a");
+	/* Opened for reading as well, so that checkpoints can read back the end of the log. */
+	d->logfile = fopen(filename, "a+");
 	if(!d->logfile) {
 		fprintf(stderr, "makeflow: couldn't open logfile %s: %s\n", filename, strerror(errno));
 		exit(1);
@@ -442,10 +792,9 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 	for(n = d->nodes; n; n = n->next) {
 		if(n->state == DAG_NODE_STATE_COMPLETE)
 		{
-			struct dag_file *f;
-			list_first_item(n->source_files);
-			while((f = list_next_item(n->source_files)))
-				f->reference_count--;
+			int i;
+			for(i = 0; i < n->source_count; i++)
+				n->source_files[i]->reference_count--;
 		}
 	}
 
@@ -35,6 +35,11 @@ void makeflow_log_alloc_event( struct dag *d, struct makeflow_alloc *alloc );
 void makeflow_log_gc_event( struct dag *d, int collected, timestamp_t elapsed, int total_collected );
 void makeflow_log_close(struct dag *d );
 
+/* Write a checkpoint of the state of the dag next to the log, so that
+ * makeflow_log_recover only has to replay the log written after it. */
+void makeflow_log_checkpoint( struct dag *d );
+/* Return the name of the checkpoint of the given log, to be freed by the caller. */
+char *makeflow_log_checkpoint_filename( const char *logfilename );
 /* return 0 on success, return non-zero on failure. */
 int makeflow_log_recover( struct dag *d, const char *filename, int verbose_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode );
 
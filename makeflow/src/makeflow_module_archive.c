@@ -38,6 +38,7 @@ Updated for S3 bucket handling and directory handling for input and output files
 #include "s3_file_io.h"
 
 #include "batch_job.h"
+#include "batch_file.h"
 #include "batch_wrapper.h"
 
 #include "dag.h"
@@ -49,11 +50,13 @@ Updated for S3 bucket handling and directory handling for input and output files
 
 #define MAKEFLOW_ARCHIVE_DEFAULT_DIRECTORY "/tmp/makeflow.archive."
 #define MAKEFLOW_ARCHIVE_DEFAULT_S3_BUCKET "makeflows3archive"
+#define MAKEFLOW_ARCHIVE_DEFAULT_HASH_WORKERS 4
 
 float total_up_time = 0.0;
 float total_down_time = 0.0;
 float total_s3_check_time = 0.0;
 struct hash_table *s3_files_in_archive = NULL;
+FILE *s3_archive_index = NULL;
 
 struct archive_instance {
 	/* User defined values */
@@ -62,6 +65,7 @@ struct archive_instance {
 	int found_archived_job;
 	int s3;
 	int s3_check;
+	int hash_workers;
 	char *dir;
 	char *s3_dir;
 
@@ -75,10 +79,49 @@ struct archive_instance *archive_instance_create()
 
 	a->dir = NULL;
 	a->source_makeflow = NULL;
+	a->hash_workers = MAKEFLOW_ARCHIVE_DEFAULT_HASH_WORKERS;
 
 	return a;
 }
 
+/* Remember that a file or task is in the s3 bucket, for this and later runs. */
+static void makeflow_archive_s3_index_insert(const char *id){
+	if(hash_table_lookup(s3_files_in_archive, id))
+		return;
+
+	hash_table_insert(s3_files_in_archive, id, xxstrdup(id));
+
+	if(s3_archive_index){
+		fprintf(s3_archive_index, "%s\n", id);
+		fflush(s3_archive_index);
+	}
+}
+
+/* Load the ids already known to be in the s3 bucket, and record new ones as they are found. */
+static void makeflow_archive_s3_index_open(struct archive_instance *a){
+	char line[1024];
+
+	char *index_path = string_format("%s/s3.%s.index", a->dir, a->s3_dir);
+
+	FILE *file = fopen(index_path, "r");
+	if(file){
+		while(fgets(line, sizeof(line), file)){
+			string_chomp(line);
+			if(line[0])
+				makeflow_archive_s3_index_insert(line);
+		}
+		fclose(file);
+		debug(D_MAKEFLOW_HOOK, "loaded %d ids known to be in the S3 bucket %s", hash_table_size(s3_files_in_archive), a->s3_dir);
+	}
+
+	s3_archive_index = fopen(index_path, "a");
+	if(!s3_archive_index){
+		debug(D_MAKEFLOW_HOOK, "could not open S3 index %s: %s", index_path, strerror(errno));
+	}
+
+	free(index_path);
+}
+
 static int create( void ** instance_struct, struct jx *hook_args )
 {	
 	aws_init ();
@@ -151,6 +194,10 @@ static int create( void ** instance_struct, struct jx *hook_args )
 		a->write = 1;
 	}
 
+	if(jx_lookup(hook_args, "archive_hash_workers")){
+		a->hash_workers = jx_lookup_integer(hook_args, "archive_hash_workers");
+	}
+
 	if (!create_dir(a->dir, 0777) && errno != EEXIST){
 		debug(D_ERROR|D_MAKEFLOW_HOOK, "could not create base archiving directory %s: %d %s\n", 
 			a->dir, errno, strerror(errno));
@@ -175,6 +222,15 @@ static int create( void ** instance_struct, struct jx *hook_args )
 	}
 	free(tasks_dir);
 
+	/* Checksums of archived files are kept with the archive, so that unchanged files are not read again by later runs. */
+	char *checksums_path = string_format("%s/checksums", a->dir);
+	batch_file_checksum_index_open(checksums_path);
+	free(checksums_path);
+
+	if(a->s3){
+		makeflow_archive_s3_index_open(a);
+	}
+
 	s3_set_bucket (a->s3_dir);
 
 	return MAKEFLOW_HOOK_SUCCESS;
@@ -184,6 +240,12 @@ static int destroy( void * instance_struct, struct dag *d)
 {
 	struct archive_instance *a = (struct archive_instance*)instance_struct;
 
+	batch_file_checksum_index_close();
+	if(s3_archive_index){
+		fclose(s3_archive_index);
+		s3_archive_index = NULL;
+	}
+
 	free(a->dir);
 	free(a->source_makeflow);
 	free(a);
@@ -410,6 +472,7 @@ static int in_s3_archive(struct archive_instance *a, char *file_name){
 			return 0;
 		}
 		debug(D_MAKEFLOW_HOOK, "file/task %s already exists in the S3 bucket: %s", file_name, a->s3_dir);
+		makeflow_archive_s3_index_insert(file_name);
 		gettimeofday(&end_time,NULL);
 		float run_time = ((end_time.tv_sec*1000000 + end_time.tv_usec) - (start_time.tv_sec*1000000 + start_time.tv_usec)) / 1000000.0;
 		total_s3_check_time += run_time;
@@ -455,7 +518,7 @@ static int makeflow_archive_s3_file(struct archive_instance *a, char *batchID, c
 	gettimeofday(&end_time,NULL);
 		float run_time = ((end_time.tv_sec*1000000 + end_time.tv_usec) - (start_time.tv_sec*1000000 + start_time.tv_usec)) / 1000000.0;
 	total_up_time += run_time;
-	hash_table_insert(s3_files_in_archive, batchID, batchID);
+	makeflow_archive_s3_index_insert(batchID);
 	fclose(fp);
 	printf("Upload %s to %s/%s\n",file_path, a->s3_dir, batchID);
 	debug(D_MAKEFLOW_HOOK," It took %f second(s) for %s to upload to %s\n",run_time, batchID, a->s3_dir);
@@ -910,6 +973,8 @@ static int makeflow_s3_archive_copy_task_files(struct archive_instance *a, char
 static int batch_submit( void * instance_struct, struct batch_task *t){
 	struct archive_instance *a = (struct archive_instance*)instance_struct;
 	int rc = MAKEFLOW_HOOK_SUCCESS;
+	// Checksum the input files together, as the id depends on all of them
+	batch_file_generate_ids(t->input_files, a->hash_workers);
 	// Generates a hash id for the task
 	char *id = batch_task_generate_id(t);
 	char *task_path = string_format("%s/tasks/%.2s/%s",a->dir, id, id);
@@ -989,6 +1054,7 @@ static int makeflow_archive_s3_task(struct archive_instance *a, char *taskID, ch
 	gettimeofday(&end_time,NULL);
 		float run_time = ((end_time.tv_sec*1000000 + end_time.tv_usec) - (start_time.tv_sec*1000000 + start_time.tv_usec)) / 1000000.0;
 		total_up_time += run_time;
+	makeflow_archive_s3_index_insert(taskID);
 	printf("Upload %s to %s/%s\n",tarFile,a->s3_dir,taskID);
 		debug(D_MAKEFLOW_HOOK," It took %f seconds for %s to upload to %s",run_time, taskID, a->s3_dir);
 		debug(D_MAKEFLOW_HOOK," The total upload time is %f second(s)",total_up_time);
@@ -1016,6 +1082,10 @@ static int node_success( void * instance_struct, struct dag_node *n, struct batc
 			return MAKEFLOW_HOOK_SUCCESS;
 		}
 
+		// Checksum the input and output files together, as all of them are archived
+		batch_file_generate_ids(t->input_files, a->hash_workers);
+		batch_file_generate_ids(t->output_files, a->hash_workers);
+
 		// Generates a hash id for the task
 		char *id = batch_task_generate_id(t);
 		char *task_path = string_format("%s/tasks/%.2s/%s",a->dir, id, id);
@@ -110,13 +110,12 @@ static int node_file_uses_unsupported_shared_fs( struct shared_fs_instance *sf,
 	return MAKEFLOW_HOOK_SUCCESS;
 }
 
-static int node_files_uses_unsupported_shared_fs( struct shared_fs_instance *sf, struct dag_node *n, struct list *files)
+static int node_files_uses_unsupported_shared_fs( struct shared_fs_instance *sf, struct dag_node *n, struct dag_file **files, int count)
 {
-	struct dag_file *f;
 	int failed = 0;
-	list_first_item(files);
-	while((f = list_next_item(files))) {
-		int rc = node_file_uses_unsupported_shared_fs(sf, n, f);
+	int i;
+	for(i = 0; i < count; i++) {
+		int rc = node_file_uses_unsupported_shared_fs(sf, n, files[i]);
 		if(rc != MAKEFLOW_HOOK_SUCCESS)
 			failed = 1;
 	}
@@ -131,11 +130,11 @@ static int dag_check(void * instance_struct, struct dag *d){
 	int failed = 0;
 	for(n = d->nodes; n; n = n->next) {
 		if(!batch_queue_supports_feature(makeflow_get_queue(n), "absolute_path")){
-			int rc = node_files_uses_unsupported_shared_fs(sf, n, n->source_files);
+			int rc = node_files_uses_unsupported_shared_fs(sf, n, n->source_files, n->source_count);
 			if(rc != MAKEFLOW_HOOK_SUCCESS)
 				failed = 1;
 
-			rc = node_files_uses_unsupported_shared_fs(sf, n, n->source_files);
+			rc = node_files_uses_unsupported_shared_fs(sf, n, n->source_files, n->source_count);
 			if(rc != MAKEFLOW_HOOK_SUCCESS)
 				failed = 1;
 		}
@@ -133,6 +133,7 @@ static int node_submit( void * instance_struct, struct dag_node *n, struct batch
 
 static int node_success( void * instance_struct, struct dag_node *n, struct batch_task *task){
 	struct dag_file *f = NULL;
+	int i;
 	cleaned_completed_node = 1;
 	
 	if(makeflow_alloc_use_space(storage_allocation, n)){
@@ -140,8 +141,8 @@ static int node_success( void * instance_struct, struct dag_node *n, struct batc
 	}
 
 	/* Mark source files that have been used by this node */
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))) {
+	for(i = 0; i < n->source_count; i++) {
+		f = n->source_files[i];
 		if(f->state == DAG_FILE_STATE_COMPLETE){
 			if(storage_allocation->locked && f->type != DAG_FILE_TYPE_OUTPUT)
 				makeflow_clean_file(n->d, makeflow_get_queue(n), f);
@@ -150,8 +151,8 @@ static int node_success( void * instance_struct, struct dag_node *n, struct batc
 
 	/* Delete output files that have no use and are not actual outputs */
 	if(storage_allocation->locked){
-		list_first_item(n->target_files);
-		while((f = list_next_item(n->target_files))){
+		for(i = 0; i < n->target_count; i++) {
+			f = n->target_files[i];
 			if(f->reference_count == 0 && f->type != DAG_FILE_TYPE_OUTPUT)
 				makeflow_clean_file(n->d, makeflow_get_queue(n), f);
 		}
@@ -171,10 +172,7 @@ struct dag *file_find_dag(struct dag_file *f){
 	if(f->created_by){
 		d = f->created_by->d;
 	} else {
-		struct dag_node *n;
-		list_first_item(f->needed_by);
-		n = list_next_item(f->needed_by);
-		d = n->d;
+		d = f->needed_by[0]->d;
 	}
 	return d;
 }
@@ -90,8 +90,8 @@ void makeflow_summary_create(struct dag *d, const char *filename, const char *em
 			tasks_aborted++;
 		else if(state == DAG_NODE_STATE_COMPLETE) {
 			tasks_completed++;
-			list_first_item(n->source_files);
-			while((f = list_next_item(n->source_files))) {
+			for(i = 0; i < n->source_count; i++) {
+				f = n->source_files[i];
 				fn = f->filename;
 				if(!list_find(output_files, (int (*)(void *, const void *)) string_equal, (void *) fn))
 					list_push_tail(output_files, (void *) fn);
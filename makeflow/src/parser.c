@@ -115,6 +115,7 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 	dag_close_over_nodes(d);
 	dag_close_over_categories(d);
 
+	dag_compact(d);
 	dag_compile_ancestors(d);
 
 	return d;
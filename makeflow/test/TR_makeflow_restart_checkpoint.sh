@@ -0,0 +1,172 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+test_output=`basename $0 .sh`.output
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+	echo "hello" > file.1
+
+cat > test.jx << EOF
+{
+	"rules" :
+	[
+		{
+			"command" : format("sleep 1 && cp file.%d file.%d",i,i+1),
+			"inputs"  : [ "file."+i ],
+			"outputs" : [ "file."+(i+1) ]
+		} for i in range(1,12)
+	]
+}
+EOF
+	exit 0
+}
+
+# Wait up to a minute for a file to appear.
+wait_for_file()
+{
+	i=0
+	while [ ! -f "$1" ]
+	do
+		i=$((i+1))
+		if [ $i -gt 600 ]
+		then
+			echo "+++++ $1 never appeared +++++"
+			return 1
+		fi
+		sleep 0.1
+	done
+	return 0
+}
+
+# Run makeflow in the background and kill it as if it crashed once a file appears.
+crash_after()
+{
+	file=$1
+	shift
+
+	./makeflow -j 1 "$@" --jx test.jx > crash.output 2>&1 &
+	pid=$!
+
+	wait_for_file "$file" || return 1
+	kill -9 $pid
+	wait $pid 2>/dev/null
+
+	# Let the orphaned job finish before looking at the files.
+	sleep 2
+	return 0
+}
+
+# Node state changes in the log after the given offset, without times and job ids.
+node_states()
+{
+	tail -c +$(($2+1)) "$1" | awk '!/^#/ { print $2, $3 }'
+}
+
+# Restart a copy of the workflow to completion and record which nodes it ran.
+restart()
+{
+	(
+		cd $1
+		size=`wc -c < test.jx.makeflowlog`
+		./makeflow -j 1 --log-checkpoint=0 --jx test.jx > restart.output 2>&1 || exit 1
+		node_states test.jx.makeflowlog $size > restart.states
+	)
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ first run: crash after a checkpoint +++++"
+	crash_after test.jx.makeflowlog.checkpoint --log-checkpoint=1 || exit 1
+	cat crash.output
+
+	echo "+++++ second run: crash again, without checkpoints, so the log goes past the checkpoint +++++"
+	size=`wc -c < test.jx.makeflowlog`
+	done_file=`ls file.* | sort -t. -k2 -n | tail -1`
+	next_file=file.$((${done_file#file.}+2))
+	crash_after $next_file --log-checkpoint=0 || exit 1
+	cat crash.output
+
+	if ! grep -q "from checkpoint" crash.output
+	then
+		echo "+++++ second run did not use the checkpoint +++++"
+		exit 1
+	fi
+
+	if [ `wc -c < test.jx.makeflowlog` -le $size ]
+	then
+		echo "+++++ log did not grow past the checkpoint +++++"
+		exit 1
+	fi
+
+	echo "+++++ restarting from the checkpoint and from a full replay of the log +++++"
+	mkdir checkpoint replay
+	cp -p makeflow test.jx test.jx.makeflowlog test.jx.makeflowlog.checkpoint file.* checkpoint/
+	cp -p makeflow test.jx test.jx.makeflowlog file.* replay/
+
+	restart checkpoint || exit 1
+	restart replay || exit 1
+	cat checkpoint/restart.output
+
+	if ! grep -q "from checkpoint" checkpoint/restart.output || grep -q "from checkpoint" replay/restart.output
+	then
+		echo "+++++ checkpoint was not used in exactly one restart +++++"
+		exit 1
+	fi
+
+	if ! cmp checkpoint/restart.states replay/restart.states
+	then
+		echo "+++++ restarts ran different nodes +++++"
+		diff checkpoint/restart.states replay/restart.states
+		exit 1
+	fi
+
+	if [ ! -s checkpoint/restart.states ] || ! cmp checkpoint/file.12 file.1
+	then
+		echo "+++++ restart did not finish the workflow +++++"
+		exit 1
+	fi
+
+	echo "+++++ a checkpoint of a different log is ignored +++++"
+	mkdir stale
+	cp -p makeflow test.jx file.1 stale/
+	cp test.jx.makeflowlog.checkpoint stale/old.checkpoint
+	(
+		cd stale
+		./makeflow -j 1 --log-checkpoint=0 --jx test.jx > first.output 2>&1 || exit 1
+		mv old.checkpoint test.jx.makeflowlog.checkpoint
+		restart . || exit 1
+		cat restart.output
+
+		if grep -q "from checkpoint" restart.output
+		then
+			echo "+++++ stale checkpoint was used +++++"
+			exit 1
+		fi
+
+		if [ -s restart.states ]
+		then
+			echo "+++++ completed nodes were run again +++++"
+			exit 1
+		fi
+	) || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir $test_output
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -1079,6 +1079,22 @@ Set the minimum timeout when sending a brief message to a foreman. (default=1h)
 
 Set the number of tasks considered when computing category buckets.
 
+=item "dispatch-batch-size"
+
+Set the maximum number of tasks sent to workers per iteration of wait. (default=100)
+
+=item "max-concurrent-transfers"
+
+Set the maximum number of workers that are sent input files at the same time. If 0, input files are sent synchronously when a task is dispatched. (default=10)
+
+=item "peer-transfer-limit"
+
+Set the maximum number of cached files a worker may send to other workers at the same time. Workers that have a cached input file send it to workers that need it, rather than the master. If 0, the master sends all input files. (default=0)
+
+=item "cache-by-content"
+
+If 1, name cached input files after the hash of their contents, so that identical files are sent once to each worker, and files modified in place are sent again. The hash is computed once per version of a file. (default=0)
+
 =back
 
 =head3 C<specify_max_resources>
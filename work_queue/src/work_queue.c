@@ -23,6 +23,9 @@ See the file COPYING for details.
 #include "itable.h"
 #include "list.h"
 #include "macros.h"
+#include "set.h"
+#include "slab.h"
+#include "string_intern.h"
 #include "username.h"
 #include "create_dir.h"
 #include "xxmalloc.h"
@@ -75,6 +78,7 @@ See the file COPYING for details.
 
 #define WORKER_ADDRPORT_MAX 32
 #define WORKER_HASHKEY_MAX 32
+#define WORKER_TOKEN_MAX 33
 
 #define RESOURCE_MONITOR_TASK_LOCAL_NAME "wq-%d-task-%d"
 #define RESOURCE_MONITOR_REMOTE_NAME "cctools-monitor"
@@ -84,6 +88,35 @@ See the file COPYING for details.
 
 #define MAX_NEW_WORKERS 10
 
+// Maximum number of tasks dispatched per iteration of work_queue_wait
+#define WORK_QUEUE_DISPATCH_BATCH_SIZE 100
+
+// Maximum number of workers receiving inputs at the same time
+#define WORK_QUEUE_MAX_CONCURRENT_TRANSFERS 10
+
+// Bytes sent to a worker before moving to the next worker with pending transfers
+#define WORK_QUEUE_TRANSFER_QUANTUM (4*MEGABYTE)
+
+// Cached files a worker may send to other workers at once. If 0, peer transfers are disabled.
+#define WORK_QUEUE_PEER_TRANSFER_LIMIT 0
+
+// File times in nanoseconds, where the platform reports them.
+#if defined(CCTOOLS_OPSYS_DARWIN)
+#define WORK_QUEUE_TIME_NS(ts) ((int64_t) (ts).tv_sec * 1000000000 + (ts).tv_nsec)
+#define WORK_QUEUE_MTIME_NS(info) WORK_QUEUE_TIME_NS((info)->st_mtimespec)
+#define WORK_QUEUE_CTIME_NS(info) WORK_QUEUE_TIME_NS((info)->st_ctimespec)
+#elif defined(CCTOOLS_OPSYS_LINUX)
+#define WORK_QUEUE_TIME_NS(ts) ((int64_t) (ts).tv_sec * 1000000000 + (ts).tv_nsec)
+#define WORK_QUEUE_MTIME_NS(info) WORK_QUEUE_TIME_NS((info)->st_mtim)
+#define WORK_QUEUE_CTIME_NS(info) WORK_QUEUE_TIME_NS((info)->st_ctim)
+#else
+#define WORK_QUEUE_MTIME_NS(info) ((int64_t) (info)->st_mtime * 1000000000)
+#define WORK_QUEUE_CTIME_NS(info) ((int64_t) (info)->st_ctime * 1000000000)
+#endif
+
+// Seconds after its last change during which the content name of a file is not remembered.
+#define WORK_QUEUE_CONTENT_SETTLE_TIME 1
+
 // Result codes for signaling the completion of operations in WQ
 typedef enum {
 	WQ_SUCCESS = 0,
@@ -139,17 +172,44 @@ struct work_queue {
 	char workingdir[PATH_MAX];
 
 	struct link      *master_link;   // incoming tcp connection for workers.
-	struct link_info *poll_table;
+	struct link_poll_set *poll_set;  // master link and worker links, registered while connected.
+	struct link_info *poll_table;    // links reported ready by the last poll.
 	int poll_table_size;
+	int master_link_ready;           // master link had pending connections in the last poll.
 
 	struct itable *tasks;           // taskid -> task
 	struct itable *task_state_map;  // taskid -> state
 	struct list   *ready_list;      // ready to be sent to a worker
 
+	struct list   *waiting_retrieval_list; // results available at workers, in the order they were reported.
+	struct list   *retrieved_list;         // results available at the master, in the order they were retrieved.
+	struct itable *task_state_cursors;     // taskid -> cursor to the task in waiting_retrieval_list or retrieved_list.
+
+	int task_state_counts[WORK_QUEUE_TASK_CANCELED + 1];  // number of tasks in the queue per state.
+	struct hash_table *category_task_state_counts;        // category name -> number of tasks per state.
+
+	int dispatch_batch_size;              // maximum number of tasks sent per iteration of work_queue_wait.
+	int64_t resources_generation;         // incremented when a worker may fit tasks it could not fit before.
+	int64_t tasks_no_fit_generation;      // value of resources_generation when tasks_no_fit was last cleared.
+	struct hash_table *tasks_no_fit;      // shapes of ready tasks for which no worker was found.
+
+	int max_concurrent_transfers;         // workers sent inputs at the same time. If 0, inputs are sent synchronously.
+	struct list *transfer_queue;          // workers with pending transfers, in the order they were committed a task.
+	int64_t transfer_pacing_wait;         // microseconds until a transfer held back by the bandwidth limit may go on, or 0.
+
+	int peer_transfer_limit;              // cached files a worker may send to other workers at once. If 0, the master sends all inputs.
+	struct list *peer_transfers_failed;   // peer transfers to be replaced by a transfer from the master.
+
+	int cache_by_content;                 // if 1, cached input files are named after their contents.
+	struct hash_table *content_names;     // local path -> struct content_name, computed once per version of a file.
+
 	struct hash_table *worker_table;
 	struct hash_table *worker_blacklist;
 	struct itable  *worker_task_map;
 
+	struct itable *workers_by_free_cores; // free cores -> set of workers with that many cores available.
+	struct set    *workers_without_cores; // workers that do not report cores, thus not indexed by free cores.
+
 	struct hash_table *categories;
 
 	struct hash_table *workers_with_available_results;
@@ -232,6 +292,7 @@ struct work_queue_worker {
 	struct link *link;
 	struct itable *current_tasks;
 	struct itable *current_tasks_boxes;
+	int64_t index_free_cores;                 // key in q->workers_by_free_cores, or -1 if in q->workers_without_cores.
 	int finished_tasks;
 	int64_t total_tasks_complete;
 	int64_t total_bytes_transferred;
@@ -240,6 +301,46 @@ struct work_queue_worker {
 	timestamp_t start_time;
 	timestamp_t last_msg_recv_time;
 	timestamp_t last_update_msg_time;
+
+	struct list *transfers;                   // messages and files queued for the worker, sent from the event loop.
+	int transfer_files;                       // files in transfers. The worker takes no more tasks until they are sent.
+	int staging;                              // if 1, input files of the task being committed are queued in transfers.
+	time_t transfer_stoptime;                 // the transfer at the head of the queue fails if not done by then.
+
+	buffer_t *batch;                          // if not NULL, messages to the worker are collected here, to be sent in a single write.
+
+	int transfer_port;                        // port where the worker serves its cache to other workers, or 0.
+	char transfer_token[WORKER_TOKEN_MAX];    // secret that other workers show to fetch from the cache of this worker.
+	int peer_transfers_out;                   // cached files the worker is currently sending to other workers.
+	struct hash_table *peer_transfers_in;     // cached name -> struct peer_transfer the worker is fetching from another worker.
+};
+
+/* A message or file waiting in a worker's transfer queue. */
+struct worker_transfer {
+	char *data;           // bytes to send, or NULL when sending from fd.
+	int fd;               // file to send, or -1.
+	int64_t total;        // size of the transfer.
+	int64_t length;       // bytes left to send.
+	char *filename;       // name of the file sent, for the transactions log.
+	int taskid;           // if not zero, the commit of this task ends with this transfer.
+	timestamp_t start;    // when the transfer reached the head of the queue.
+};
+
+/* The name of a cached file derived from its contents, valid while the file keeps its size, times, and inode. */
+struct content_name {
+	int64_t mtime;  /* in nanoseconds */
+	int64_t ctime;  /* in nanoseconds */
+	int64_t inode;
+	off_t size;
+	char *cached_name;
+};
+
+/* A cached file a worker fetches from another worker, rather than from the master. */
+struct peer_transfer {
+	char source[WORKER_HASHKEY_MAX];   // worker sending the file.
+	char target[WORKER_HASHKEY_MAX];   // worker receiving the file.
+	char *cached_name;
+	char *local_name;                  // file at the master, sent instead if the peer transfer fails.
 };
 
 struct work_queue_task_report {
@@ -259,6 +360,7 @@ struct blacklist_host_info {
 };
 
 static void handle_worker_failure(struct work_queue *q, struct work_queue_worker *w);
+static int get_transfer_wait_time(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int64_t length);
 static void handle_app_failure(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t);
 static void remove_worker(struct work_queue *q, struct work_queue_worker *w, worker_disconnect_reason reason);
 
@@ -269,6 +371,9 @@ static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker
 static int cancel_task_on_worker(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
 static void count_worker_resources(struct work_queue *q, struct work_queue_worker *w);
 
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w);
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w);
+
 static void find_max_worker(struct work_queue *q);
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w);
 
@@ -284,6 +389,10 @@ const char *task_result_str(work_queue_result_t result);
 static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task_state_t state);
 /* pointer to first task found with state. NULL if no such task */
 static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state);
+/* list of tasks with state, if such a list is kept. */
+static struct list *task_state_list(struct work_queue *q, work_queue_task_state_t state);
+/* update the number of tasks with state */
+static void count_task_state(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state, int delta);
 /* number of tasks with state */
 static int task_state_count( struct work_queue *q, const char *category, work_queue_task_state_t state);
 /* number of tasks with the resource allocation request */
@@ -315,6 +424,7 @@ static void write_transaction_task(struct work_queue *q, struct work_queue_task
 static void write_transaction_category(struct work_queue *q, struct category *c);
 static void write_transaction_worker(struct work_queue *q, struct work_queue_worker *w, int leaving, worker_disconnect_reason reason_leaving);
 static void write_transaction_worker_resources(struct work_queue *q, struct work_queue_worker *w);
+static void write_transaction_transfer(struct work_queue *q, struct work_queue_worker *w, int taskid, int is_input, const char *filename, int64_t bytes, timestamp_t elapsed);
 
 /** Clone a @ref work_queue_file
 This performs a deep copy of the file struct.
@@ -333,6 +443,24 @@ static struct list *work_queue_task_file_list_clone(struct list *list);
 /** Write master's resources to resource summary file and close the file **/
 void work_queue_disable_monitoring(struct work_queue *q);
 
+/*
+Tasks and files are created before they are submitted to a queue, so they
+come from slabs shared by the whole process. Their names, which are repeated
+across the many tasks that share inputs, are interned (see string_intern.h).
+*/
+static struct slab *task_slab = NULL;
+static struct slab *file_slab = NULL;
+
+static int64_t work_queue_metadata_bytes()
+{
+	int64_t bytes = string_intern_bytes();
+
+	if(task_slab) bytes += slab_bytes(task_slab);
+	if(file_slab) bytes += slab_bytes(file_slab);
+
+	return bytes;
+}
+
 /******************************************************/
 /********** work_queue internal functions *************/
 /******************************************************/
@@ -510,6 +638,220 @@ static void link_to_hash_key(struct link *link, char *key)
 	sprintf(key, "0x%p", link);
 }
 
+/*
+Input files are queued while a task is committed to a worker (see
+w->staging), and then sent from the event loop without blocking, so that
+staging inputs to one worker does not stall the others. Messages are sent
+right away, unless the queue of the worker is not empty, in which case they
+are queued behind it to preserve the order of messages.
+*/
+
+static void worker_transfer_delete(struct worker_transfer *x)
+{
+	if(x->fd >= 0)
+		close(x->fd);
+	free(x->data);
+	free(x->filename);
+	free(x);
+}
+
+static void queue_worker_transfer(struct work_queue *q, struct work_queue_worker *w, const char *data, int fd, int64_t length, const char *filename, int taskid)
+{
+	struct worker_transfer *x = calloc(1, sizeof(*x));
+
+	if(data) {
+		x->data = xxmalloc(length);
+		memcpy(x->data, data, length);
+	}
+
+	x->fd = fd;
+	x->total = length;
+	x->length = length;
+	x->filename = filename ? xxstrdup(filename) : NULL;
+	x->taskid = taskid;
+
+	if(list_size(w->transfers) == 0) {
+		list_push_tail(q->transfer_queue, w);
+	}
+
+	if(fd >= 0) {
+		w->transfer_files++;
+	}
+
+	list_push_tail(w->transfers, x);
+}
+
+static void finish_worker_transfer(struct work_queue *q, struct work_queue_worker *w, struct worker_transfer *x)
+{
+	timestamp_t now = timestamp_get();
+
+	if(x->fd >= 0) {
+		w->total_bytes_transferred += x->total;
+		w->total_transfer_time     += now - x->start;
+		write_transaction_transfer(q, w, x->taskid, 1, x->filename, x->total, now - x->start);
+
+		w->transfer_files--;
+		if(w->transfer_files == 0) {
+			// Only messages are left, so the worker may take new tasks again.
+			q->resources_generation++;
+		}
+	}
+
+	if(x->taskid) {
+		struct work_queue_task *t = itable_lookup(q->tasks, x->taskid);
+		if(t) {
+			t->time_when_commit_end = now;
+		}
+	}
+}
+
+/*
+Send the transfers queued for a worker, without blocking, until about quantum
+bytes are sent. Return 1 if nothing is left in the queue, 0 if some transfers
+remain, and -1 if the worker failed.
+*/
+
+static int send_worker_transfers(struct work_queue *q, struct work_queue_worker *w, int64_t quantum)
+{
+	struct worker_transfer *x;
+	int64_t sent = 0;
+
+	while((x = list_peek_head(w->transfers))) {
+		if(!x->start) {
+			x->start = timestamp_get();
+			w->transfer_stoptime = time(0) + get_transfer_wait_time(q, w, NULL, x->total);
+		}
+
+		while(x->length > 0 && sent < quantum) {
+			int64_t chunk = MIN(x->length, quantum - sent);
+			int64_t actual;
+
+			if(x->fd >= 0) {
+				actual = link_stream_from_fd_avail(w->link, x->fd, chunk);
+				if(actual == 0) {
+					debug(D_WQ, "%s (%s) file %s is shorter than expected", w->hostname, w->addrport, x->filename);
+					return -1;
+				}
+			} else {
+				actual = link_write(w->link, x->data + (x->total - x->length), chunk, LINK_NOWAIT);
+			}
+
+			if(actual < 0) {
+				if(errno_is_temporary(errno))
+					break;
+				return -1;
+			}
+
+			x->length -= actual;
+			sent += actual;
+		}
+
+		if(x->length > 0) {
+			if(time(0) > w->transfer_stoptime) {
+				debug(D_WQ, "%s (%s) timed out receiving %s", w->hostname, w->addrport, x->filename ? x->filename : "a message");
+				return -1;
+			}
+			return 0;
+		}
+
+		finish_worker_transfer(q, w, x);
+		list_pop_head(w->transfers);
+		worker_transfer_delete(x);
+
+		if(sent >= quantum)
+			break;
+	}
+
+	return list_size(w->transfers) == 0;
+}
+
+static void worker_transfers_done(struct work_queue *q, struct work_queue_worker *w)
+{
+	list_remove(q->transfer_queue, w);
+	link_poll_set_add(q->poll_set, w->link, LINK_READ);
+}
+
+/*
+Advance the transfers of the workers in the transfer queue. Only the first
+max_concurrent_transfers workers with files in their queue are sent files at
+the same time, while workers with only messages left are always advanced.
+Each worker is sent at most a quantum per call, so that a large transfer to
+one worker does not starve the others.
+Return the number of workers that failed.
+*/
+
+static int send_queued_transfers(struct work_queue *q)
+{
+	struct work_queue_worker *w;
+	struct list *done = list_create();
+	struct list *failed = list_create();
+	int active = 0;
+	int workers_failed = 0;
+
+	q->transfer_pacing_wait = 0;
+
+	struct list_cursor *cur = list_cursor_create(q->transfer_queue);
+	for(list_seek(cur, 0); list_get(cur, (void **) &w); list_next(cur)) {
+		if(w->transfer_files > 0) {
+			if(active >= MAX(1, q->max_concurrent_transfers))
+				continue;
+			active++;
+		}
+
+		int result = send_worker_transfers(q, w, WORK_QUEUE_TRANSFER_QUANTUM);
+		if(result > 0) {
+			list_push_tail(done, w);
+		} else if(result < 0) {
+			list_push_tail(failed, w);
+		} else {
+			int64_t wait = link_rate_wait(w->link);
+			if(wait > 0) {
+				// Held back by the bandwidth limit, so wake up when the limit allows more.
+				link_poll_set_add(q->poll_set, w->link, LINK_READ);
+				if(!q->transfer_pacing_wait || wait < q->transfer_pacing_wait)
+					q->transfer_pacing_wait = wait;
+			} else {
+				// Wake up the event loop when the worker can take more data.
+				link_poll_set_add(q->poll_set, w->link, LINK_READ | LINK_WRITE);
+			}
+		}
+	}
+	list_cursor_destroy(cur);
+
+	while((w = list_pop_head(done))) {
+		worker_transfers_done(q, w);
+	}
+
+	while((w = list_pop_head(failed))) {
+		handle_worker_failure(q, w);
+		workers_failed++;
+	}
+
+	list_delete(done);
+	list_delete(failed);
+
+	return workers_failed;
+}
+
+/*
+Send raw data to the worker, queueing it behind any transfers still pending.
+*/
+
+static int send_worker_data(struct work_queue *q, struct work_queue_worker *w, const char *data, int64_t length, time_t stoptime)
+{
+	if(w->batch) {
+		buffer_putlstring(w->batch, data, length);
+		return length;
+	}
+
+	if(list_size(w->transfers) > 0) {
+		queue_worker_transfer(q, w, data, -1, length, NULL, 0);
+		return length;
+	}
+
+	return link_putlstring(w->link, data, length, stoptime);
+}
+
 /**
  * This function sends a message to the worker and records the time the message is
  * successfully sent. This timestamp is used to determine when to send keepalive checks.
@@ -536,13 +878,31 @@ static int send_worker_msg( struct work_queue *q, struct work_queue_worker *w, c
 	else
 		stoptime = time(0) + q->short_timeout;
 
-	int result = link_putlstring(w->link, buffer_tostring(B), buffer_pos(B), stoptime);
+	int result = send_worker_data(q, w, buffer_tostring(B), buffer_pos(B), stoptime);
 
 	buffer_free(B);
 
 	return result;
 }
 
+/*
+Send the messages collected in batch all at once. The worker reads them as
+usual, but here they cost a single write, or a single entry in the transfer
+queue of the worker.
+*/
+
+static int send_worker_batch( struct work_queue *q, struct work_queue_worker *w, buffer_t *batch )
+{
+	size_t length;
+	const char *data = buffer_tolstring(batch, &length);
+
+	debug(D_WQ, "tx to %s (%s): %zu bytes of messages", w->hostname, w->addrport, length);
+
+	time_t stoptime = time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout);
+
+	return send_worker_data(q, w, data, length, stoptime);
+}
+
 void work_queue_broadcast_message(struct work_queue *q, const char *msg) {
 	if(!q)
 		return;
@@ -591,6 +951,110 @@ work_queue_msg_code_t advertise_tlq_url(struct work_queue *q, struct work_queue_
 	return MSG_PROCESSED;
 }
 
+static void peer_transfer_delete(struct peer_transfer *x)
+{
+	free(x->cached_name);
+	free(x->local_name);
+	free(x);
+}
+
+/*
+Ask workers to serve their cache to other workers. Workers do not accept
+connections from other workers unless asked, and reply with the port of
+their transfer server. The server only sends files to workers that show
+the token given here, which the master passes on with each peerget.
+*/
+
+static void request_peer_transfers(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->type == WORKER_TYPE_WORKER && q->peer_transfer_limit > 0) {
+		if(!w->transfer_token[0]) {
+			random_hex(w->transfer_token, sizeof(w->transfer_token));
+		}
+		send_worker_msg(q, w, "peer-transfers %s\n", w->transfer_token);
+	}
+}
+
+/*
+Process the report of a worker that fetched a cached file from another worker.
+If the transfer failed, the file is sent by the master from the event loop,
+while the worker waits for it.
+*/
+
+static void peer_transfer_done(struct work_queue *q, struct work_queue_worker *w, const char *value)
+{
+	char cached_name_encoded[WORK_QUEUE_LINE_MAX];
+	char cached_name[WORK_QUEUE_LINE_MAX];
+	char status[WORK_QUEUE_LINE_MAX];
+
+	if(sscanf(value, "%s %s", cached_name_encoded, status) != 2)
+		return;
+
+	url_decode(cached_name_encoded, cached_name, sizeof(cached_name));
+
+	struct peer_transfer *x = hash_table_remove(w->peer_transfers_in, cached_name);
+	if(!x)
+		return;
+
+	struct work_queue_worker *source = hash_table_lookup(q->worker_table, x->source);
+	if(source)
+		source->peer_transfers_out--;
+
+	if(!strcmp(status, "ok")) {
+		debug(D_WQ, "%s (%s) received %s from worker %s", w->hostname, w->addrport, cached_name, source ? source->addrport : x->source);
+		peer_transfer_delete(x);
+		return;
+	}
+
+	debug(D_WQ, "%s (%s) could not fetch %s from worker %s (%s), sending it from the master", w->hostname, w->addrport, cached_name, source ? source->addrport : x->source, status);
+
+	/* other workers cannot connect to the source, so do not use it again. */
+	if(source && !strcmp(status, "unreachable"))
+		source->transfer_port = 0;
+
+	free(hash_table_remove(w->current_files, cached_name));
+	list_push_tail(q->peer_transfers_failed, x);
+}
+
+/*
+The worker asks to remove a file from its cache because it is short of disk.
+Agree with unlink, unless a task already sent to the worker needs the file.
+The worker does not remove the file until then, so tasks sent later that need
+the file send it again.
+*/
+
+static void cache_evict_request(struct work_queue *q, struct work_queue_worker *w, const char *cached_name_encoded)
+{
+	char cached_name[WORK_QUEUE_LINE_MAX];
+	struct work_queue_task *t;
+	struct work_queue_file *tf;
+	uint64_t taskid;
+
+	url_decode(cached_name_encoded, cached_name, sizeof(cached_name));
+
+	itable_firstkey(w->current_tasks);
+	while(itable_nextkey(w->current_tasks, &taskid, (void **) &t)) {
+		list_first_item(t->input_files);
+		while((tf = list_next_item(t->input_files))) {
+			if(!strcmp(cached_name, tf->cached_name)) {
+				debug(D_WQ, "%s (%s) keeps %s in its cache for task %d", w->hostname, w->addrport, cached_name, t->taskid);
+				return;
+			}
+		}
+		list_first_item(t->output_files);
+		while((tf = list_next_item(t->output_files))) {
+			if(!strcmp(cached_name, tf->cached_name)) {
+				debug(D_WQ, "%s (%s) keeps %s in its cache for task %d", w->hostname, w->addrport, cached_name, t->taskid);
+				return;
+			}
+		}
+	}
+
+	debug(D_WQ, "%s (%s) evicts %s from its cache", w->hostname, w->addrport, cached_name);
+	send_worker_msg(q, w, "unlink %s\n", cached_name_encoded);
+	free(hash_table_remove(w->current_files, cached_name));
+}
+
 work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worker *w, char *line)
 {
 	char field[WORK_QUEUE_LINE_MAX];
@@ -624,11 +1088,18 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 		q->stats->workers_idled_out++;
 	} else if(string_prefix_is(field, "end_of_resource_update")) {
 		count_worker_resources(q, w);
+		q->resources_generation++;
 		write_transaction_worker_resources(q, w);
 	} else if(string_prefix_is(field, "worker-id")) {
 		free(w->workerid);
 		w->workerid = xxstrdup(value);
 		write_transaction_worker(q, w, 0, 0);
+	} else if(string_prefix_is(field, "transfer-port")) {
+		w->transfer_port = atoi(value);
+	} else if(string_prefix_is(field, "peer-transfer-done")) {
+		peer_transfer_done(q, w, value);
+	} else if(string_prefix_is(field, "cache-evict")) {
+		cache_evict_request(q, w, value);
 	}
 
 	//Note we always mark info messages as processed, as they are optional.
@@ -934,13 +1405,45 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w, wor
 
 	cleanup_worker(q, w);
 
+	worker_index_remove(q, w);
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
 
 	record_removed_worker_stats(q, w);
 
-	if(w->link)
+	if(list_size(w->transfers) > 0) {
+		list_remove(q->transfer_queue, w);
+	}
+	struct worker_transfer *x;
+	while((x = list_pop_head(w->transfers))) {
+		worker_transfer_delete(x);
+	}
+	list_delete(w->transfers);
+
+	struct peer_transfer *p;
+	char *cached_name;
+	hash_table_firstkey(w->peer_transfers_in);
+	while(hash_table_nextkey(w->peer_transfers_in, &cached_name, (void **) &p)) {
+		struct work_queue_worker *source = hash_table_lookup(q->worker_table, p->source);
+		if(source)
+			source->peer_transfers_out--;
+		peer_transfer_delete(p);
+	}
+	hash_table_delete(w->peer_transfers_in);
+
+	struct list_cursor *cur = list_cursor_create(q->peer_transfers_failed);
+	for(list_seek(cur, 0); list_get(cur, (void **) &p); list_next(cur)) {
+		if(!strcmp(p->target, w->hashkey)) {
+			list_drop(cur);
+			peer_transfer_delete(p);
+		}
+	}
+	list_cursor_destroy(cur);
+
+	if(w->link) {
+		link_poll_set_remove(q->poll_set, w->link);
 		link_close(w->link);
+	}
 
 	itable_delete(w->current_tasks);
 	itable_delete(w->current_tasks_boxes);
@@ -1026,6 +1529,9 @@ static void add_worker(struct work_queue *q)
 	w->current_files = hash_table_create(0, 0);
 	w->current_tasks = itable_create(0);
 	w->current_tasks_boxes = itable_create(0);
+	w->transfers = list_create();
+	w->transfer_files = 0;
+	w->peer_transfers_in = hash_table_create(0, 0);
 	w->finished_tasks = 0;
 	w->start_time = timestamp_get();
 
@@ -1040,6 +1546,13 @@ static void add_worker(struct work_queue *q)
 	sprintf(w->addrport, "%s:%d", addr, port);
 	hash_table_insert(q->worker_table, w->hashkey, w);
 
+	/* no resources reported yet */
+	w->index_free_cores = -1;
+	set_insert(q->workers_without_cores, w);
+
+	link_poll_set_add(q->poll_set, link, LINK_READ);
+	link_rate_limit(link, q->bandwidth);
+
 	return;
 }
 
@@ -1048,12 +1561,6 @@ Get a single file from a remote worker.
 */
 static work_queue_result_code_t get_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *local_name, int64_t length, int64_t * total_bytes)
 {
-	// If a bandwidth limit is in effect, choose the effective stoptime.
-	timestamp_t effective_stoptime = 0;
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
-	}
-
 	// Choose the actual stoptime.
 	time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
 
@@ -1083,11 +1590,14 @@ static work_queue_result_code_t get_file( struct work_queue *q, struct work_queu
 		return WQ_APP_FAILURE;
 	}
 
-	// Write the data on the link to file.
+	// Write the data on the link to file. Any bandwidth limit is enforced by the link as the data flows.
+	timestamp_t transfer_start = timestamp_get();
 	int64_t actual = link_stream_to_fd(w->link, fd, length, stoptime);
 
 	close(fd);
 
+	write_transaction_transfer(q, w, t ? t->taskid : 0, 0, local_name, actual, timestamp_get() - transfer_start);
+
 	if(actual != length) {
 		debug(D_WQ, "Received item size (%"PRId64") does not match the expected size - %"PRId64" bytes.", actual, length);
 		unlink(local_name);
@@ -1096,12 +1606,6 @@ static work_queue_result_code_t get_file( struct work_queue *q, struct work_queu
 
 	*total_bytes += length;
 
-	// If the transfer was too fast, slow things down.
-	timestamp_t current_time = timestamp_get();
-	if(effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
-	}
-
 	return WQ_SUCCESS;
 }
 
@@ -1259,6 +1763,58 @@ char *make_cached_name( const struct work_queue_file *f )
 	}
 }
 
+/*
+When caching by content, name a cached input file after the hash of its
+contents, so that the same file under several paths is sent to a worker
+once, and a file modified in place gets a new name, rather than being used
+with an older version. The hash is remembered per path, and computed again
+when the size, the times, or the inode of the file change. A file changed in
+the last WORK_QUEUE_CONTENT_SETTLE_TIME seconds may change again without its
+times moving, so its hash is computed every time until it settles.
+Files that are not regular or cannot be read keep their usual name.
+*/
+
+static void set_content_cached_name( struct work_queue *q, struct work_queue_file *f, const char *expanded_local_name )
+{
+	struct stat info;
+	if(stat(expanded_local_name, &info) < 0 || !S_ISREG(info.st_mode)) {
+		return;
+	}
+
+	struct content_name *c = hash_table_lookup(q->content_names, expanded_local_name);
+
+	if(!c || c->mtime != WORK_QUEUE_MTIME_NS(&info) || c->ctime != WORK_QUEUE_CTIME_NS(&info) || c->inode != (int64_t) info.st_ino || c->size != info.st_size) {
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		if(!md5_file(expanded_local_name, digest)) {
+			debug(D_NOTICE, "Cannot hash file %s: %s", expanded_local_name, strerror(errno));
+			return;
+		}
+
+		if(!c) {
+			c = calloc(1, sizeof(*c));
+			hash_table_insert(q->content_names, expanded_local_name, c);
+		}
+
+		free(c->cached_name);
+		c->cached_name = string_format("content-%s", md5_string(digest));
+		c->mtime = WORK_QUEUE_MTIME_NS(&info);
+		c->ctime = WORK_QUEUE_CTIME_NS(&info);
+		c->inode = info.st_ino;
+		c->size = info.st_size;
+
+		time_t now = time(0);
+		if(now - info.st_mtime <= WORK_QUEUE_CONTENT_SETTLE_TIME || now - info.st_ctime <= WORK_QUEUE_CONTENT_SETTLE_TIME) {
+			/* Never matched, so that the next use hashes the file again. */
+			c->inode = -1;
+		}
+	}
+
+	if(strcmp(f->cached_name, c->cached_name)) {
+		string_intern_release(f->cached_name);
+		f->cached_name = (char *) string_intern(c->cached_name);
+	}
+}
+
 /*
 This function stores an output file from the remote cache directory
 to a third-party location, which can be either a remote filesystem
@@ -1760,6 +2316,8 @@ static work_queue_msg_code_t process_workqueue(struct work_queue *q, struct work
 		w->type = WORKER_TYPE_WORKER;
 	}
 
+	request_peer_transfers(q, w);
+
 	q->stats->workers_joined++;
 	debug(D_WQ, "%d workers are connected in total now", count_workers(q, WORKER_TYPE_WORKER | WORKER_TYPE_FOREMAN));
 
@@ -1857,7 +2415,6 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 	int64_t actual;
 
 	timestamp_t observed_execution_time;
-	timestamp_t effective_stoptime = 0;
 	time_t stoptime;
 
 	//Format: task completion status, exit status (exit code or signal), output length, execution time, taskid
@@ -1905,10 +2462,6 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 		t->disk_allocation_exhausted = 0;
 	}
 
-	if(q->bandwidth) {
-		effective_stoptime = (output_length/q->bandwidth)*1000000 + timestamp_get();
-	}
-
 	if(output_length <= MAX_TASK_STDOUT_STORAGE) {
 		retrieved_output_length = output_length;
 	} else {
@@ -1951,11 +2504,6 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 			strncpy(t->output+MAX_TASK_STDOUT_STORAGE-strlen(truncate_msg), truncate_msg, strlen(truncate_msg));
 			free(truncate_msg);
 		}
-
-		timestamp_t current_time = timestamp_get();
-		if(effective_stoptime && effective_stoptime > current_time) {
-			usleep(effective_stoptime - current_time);
-		}
 	} else {
 		actual = 0;
 	}
@@ -2360,6 +2908,7 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"time_internal",info.time_internal);
 	jx_insert_integer(j,"time_polling",info.time_polling);
 	jx_insert_integer(j,"time_application",info.time_application);
+	jx_insert_integer(j,"time_scheduling",info.time_scheduling);
 
 	jx_insert_integer(j,"time_workers_execute",info.time_workers_execute);
 	jx_insert_integer(j,"time_workers_execute_good",info.time_workers_execute_good);
@@ -2367,6 +2916,7 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 
 	jx_insert_integer(j,"bytes_sent",info.bytes_sent);
 	jx_insert_integer(j,"bytes_received",info.bytes_received);
+	jx_insert_integer(j,"bytes_metadata",info.bytes_metadata);
 
 	jx_insert_integer(j,"capacity_tasks",info.capacity_tasks);
 	jx_insert_integer(j,"capacity_cores",info.capacity_cores);
@@ -2732,6 +3282,7 @@ static work_queue_msg_code_t process_feature( struct work_queue *q, struct work_
 	debug(D_WQ, "Feature found: %s\n", fdec);
 
 	hash_table_insert(w->features, fdec, (void **) 1);
+	q->resources_generation++;
 
 	return MSG_PROCESSED;
 }
@@ -2768,53 +3319,26 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 
 static int build_poll_table(struct work_queue *q, struct link *master)
 {
-	int n = 0;
-	char *key;
-	struct work_queue_worker *w;
-
-	// Allocate a small table, if it hasn't been done yet.
-	if(!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if(!q->poll_table) {
-			//if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
-
-	// The first item in the poll table is the master link, which accepts new connections.
-	q->poll_table[0].link = q->master_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
-
+	// The foreman uplink changes with each connection to the upper master,
+	// so it is (re)registered here. Adding a link already in the set is a no-op.
 	if(master) {
-		/* foreman uplink */
-		q->poll_table[1].link = master;
-		q->poll_table[1].events = LINK_READ;
-		q->poll_table[1].revents = 0;
-		n++;
+		link_poll_set_add(q->poll_set, master, LINK_READ);
 	}
 
-	// For every worker in the hash table, add an item to the poll table
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		// If poll table is not large enough, reallocate it
-		if(n >= q->poll_table_size) {
+	// The table only holds the links reported ready, so it is sized to the poll set.
+	int needed = link_poll_set_size(q->poll_set);
+	if(!q->poll_table || needed > q->poll_table_size) {
+		while(needed > q->poll_table_size) {
 			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if(q->poll_table == NULL) {
-				//if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
 		}
-
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
+		q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+		if(!q->poll_table) {
+			//if we can't allocate a poll table, we can't do anything else.
+			fatal("allocating memory for poll table failed.");
+		}
 	}
 
-	return n;
+	return q->poll_table_size;
 }
 
 /*
@@ -2836,7 +3360,7 @@ static int send_symlink( struct work_queue *q, struct work_queue_worker *w, stru
 
 	send_worker_msg(q,w,"symlink %s %d\n",remotename_encoded,length);
 
-	link_write(w->link,target,length,time(0)+q->long_timeout);
+	send_worker_data(q,w,target,length,time(0)+q->long_timeout);
 
 	*total_bytes += length;
 
@@ -2852,11 +3376,10 @@ If the transfer takes too long, then abort.
 static int send_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localname, const char *remotename, off_t offset, int64_t length, struct stat info, int64_t *total_bytes )
 {
 	time_t stoptime;
-	timestamp_t effective_stoptime = 0;
 	int64_t actual = 0;
 
 	/* normalize the mode so as not to set up invalid permissions */
-	int mode = ( info.st_mode | 0x600 ) & 0777;
+	int mode = ( info.st_mode | 0600 ) & 0777;
 
 	if(!length) {
 		length = info.st_size;
@@ -2882,28 +3405,31 @@ static int send_file( struct work_queue *q, struct work_queue_worker *w, struct
 		return WQ_APP_FAILURE;
 	}
 
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
-	}
-
 	/* filenames are url-encoded to avoid problems with spaces, etc */
 	char remotename_encoded[WORK_QUEUE_LINE_MAX];
 	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
 
 	stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
 	send_worker_msg(q,w, "put %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
+
+	if(w->staging) {
+		/* the queue takes ownership of fd, and sends the file from the event loop. */
+		queue_worker_transfer(q, w, NULL, fd, length, localname, t ? t->taskid : 0);
+		*total_bytes += length;
+		return WQ_SUCCESS;
+	}
+
+	/* any bandwidth limit is enforced by the link as the data flows. */
+	timestamp_t transfer_start = timestamp_get();
 	actual = link_stream_from_fd(w->link, fd, length, stoptime);
 	close(fd);
 
+	write_transaction_transfer(q, w, t ? t->taskid : 0, 1, localname, actual, timestamp_get() - transfer_start);
+
 	*total_bytes += actual;
 
 	if(actual != length) return WQ_WORKER_FAILURE;
 
-	timestamp_t current_time = timestamp_get();
-	if(effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
-	}
-
 	return WQ_SUCCESS;
 }
 
@@ -2994,6 +3520,119 @@ static work_queue_result_code_t send_item( struct work_queue *q, struct work_que
 	return result;
 }
 
+/*
+Find a worker with an up-to-date copy of a cached file that may send it to
+another worker. Each worker sends at most peer_transfer_limit files at once,
+so as copies spread the workers that received a file become sources themselves,
+and the distribution takes the shape of a tree rooted at the master.
+*/
+
+static struct work_queue_worker *find_peer_source(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct stat *local_info, int content_named)
+{
+	struct work_queue_worker *source = NULL;
+	struct work_queue_worker *s;
+	char *key;
+
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void **) &s)) {
+		if(s == w || s->type != WORKER_TYPE_WORKER || !s->transfer_port)
+			continue;
+
+		if(s->peer_transfers_out >= q->peer_transfer_limit)
+			continue;
+
+		// The file may still be on its way to the source.
+		if(list_size(s->transfers) > 0 || hash_table_lookup(s->peer_transfers_in, cached_name))
+			continue;
+
+		struct stat *info = hash_table_lookup(s->current_files, cached_name);
+		if(!info || (!content_named && info->st_mtime != local_info->st_mtime) || info->st_size != local_info->st_size)
+			continue;
+
+		if(!source || s->peer_transfers_out < source->peer_transfers_out)
+			source = s;
+	}
+
+	return source;
+}
+
+/*
+Tell the worker to fetch a cached file from the source worker. The worker
+reports with peer-transfer-done when the file is in its cache.
+*/
+
+static work_queue_result_code_t send_peer_transfer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_worker *source, struct work_queue_file *tf, const char *expanded_local_name, struct stat *local_info)
+{
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+
+	if(!link_address_remote(source->link, addr, &port)) {
+		return WQ_APP_FAILURE;
+	}
+
+	char cached_name_encoded[WORK_QUEUE_LINE_MAX];
+	url_encode(tf->cached_name, cached_name_encoded, sizeof(cached_name_encoded));
+
+	int mode = ( local_info->st_mode | 0600 ) & 0777;
+
+	debug(D_WQ, "%s (%s) fetches %s from worker %s (%s)", w->hostname, w->addrport, tf->cached_name, source->hostname, source->addrport);
+
+	if(send_worker_msg(q, w, "peerget %s %s %d %"PRId64" 0%o %s\n", cached_name_encoded, addr, source->transfer_port, (int64_t) local_info->st_size, mode, source->transfer_token) < 0) {
+		return WQ_WORKER_FAILURE;
+	}
+
+	struct peer_transfer *x = calloc(1, sizeof(*x));
+	strcpy(x->source, source->hashkey);
+	strcpy(x->target, w->hashkey);
+	x->cached_name = xxstrdup(tf->cached_name);
+	x->local_name = xxstrdup(expanded_local_name);
+
+	hash_table_insert(w->peer_transfers_in, tf->cached_name, x);
+	source->peer_transfers_out++;
+
+	return WQ_SUCCESS;
+}
+
+/*
+Send from the master the files that workers could not fetch from other workers.
+The workers are waiting for these files, so a worker that does not get its
+file is disconnected. Returns the number of workers that failed.
+*/
+
+static int send_failed_peer_transfers(struct work_queue *q)
+{
+	int workers_failed = 0;
+	struct peer_transfer *x;
+
+	while((x = list_pop_head(q->peer_transfers_failed))) {
+		struct work_queue_worker *w = hash_table_lookup(q->worker_table, x->target);
+		struct stat local_info;
+
+		if(w && stat(x->local_name, &local_info) == 0) {
+			int64_t total_bytes = 0;
+			work_queue_result_code_t result = send_item(q, w, NULL, x->local_name, x->cached_name, 0, 0, &total_bytes, 1);
+
+			if(result == WQ_SUCCESS) {
+				struct stat *remote_info = xxmalloc(sizeof(*remote_info));
+				memcpy(remote_info, &local_info, sizeof(local_info));
+				hash_table_insert(w->current_files, x->cached_name, remote_info);
+				q->stats->bytes_sent += total_bytes;
+			} else {
+				handle_worker_failure(q, w);
+				workers_failed++;
+			}
+		} else if(w) {
+			debug(D_NOTICE, "Cannot stat file %s: %s", x->local_name, strerror(errno));
+			handle_worker_failure(q, w);
+			workers_failed++;
+		}
+
+		peer_transfer_delete(x);
+	}
+
+	return workers_failed;
+}
+
 /*
 Send an item to a remote worker, if it is not already cached.
 The local file name should already have been expanded by the caller.
@@ -3012,7 +3651,10 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 
 	struct stat *remote_info = hash_table_lookup(w->current_files, tf->cached_name);
 
-	if(remote_info && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
+	/* a name derived from the contents already tells the version of the file. */
+	int content_named = q->cache_by_content && string_prefix_is(tf->cached_name, "content-");
+
+	if(remote_info && !content_named && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
 		debug(D_NOTICE|D_WQ, "File %s changed locally. Task %d will be executed with an older version.", expanded_local_name, t->taskid);
 		return WQ_SUCCESS;
 	} else if(!remote_info) {
@@ -3023,8 +3665,19 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 		  debug(D_WQ, "%s (%s) needs file %s (offset %lld length %lld) as '%s'", w->hostname, w->addrport, expanded_local_name, (long long) tf->offset, (long long) tf->length, tf->cached_name );
 		}
 
-		work_queue_result_code_t result;
-		result = send_item(q, w, t, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, total_bytes, 1 );
+		struct work_queue_worker *source = NULL;
+		if(q->peer_transfer_limit > 0 && w->type == WORKER_TYPE_WORKER && tf->type == WORK_QUEUE_FILE && (tf->flags & WORK_QUEUE_CACHE) && S_ISREG(local_info.st_mode)) {
+			source = find_peer_source(q, w, tf->cached_name, &local_info, content_named);
+		}
+
+		work_queue_result_code_t result = WQ_APP_FAILURE;
+		if(source) {
+			result = send_peer_transfer(q, w, source, tf, expanded_local_name, &local_info);
+		}
+
+		if(result == WQ_APP_FAILURE) {
+			result = send_item(q, w, t, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, total_bytes, 1 );
+		}
 
 		if(result == WQ_SUCCESS && tf->flags & WORK_QUEUE_CACHE) {
 			remote_info = xxmalloc(sizeof(*remote_info));
@@ -3127,7 +3780,7 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 		debug(D_WQ, "%s (%s) needs literal as %s", w->hostname, w->addrport, f->remote_name);
 		time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, f->length);
 		send_worker_msg(q,w, "put %s %d %o\n",f->cached_name, f->length, 0777 );
-		actual = link_putlstring(w->link, f->payload, f->length, stoptime);
+		actual = send_worker_data(q, w, f->payload, f->length, stoptime);
 		if(actual!=f->length) {
 			result = WQ_WORKER_FAILURE;
 		}
@@ -3142,7 +3795,7 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 	case WORK_QUEUE_URL:
 		debug(D_WQ, "%s (%s) needs %s from the url, %s %d", w->hostname, w->addrport, f->cached_name, f->payload, f->length);
 		send_worker_msg(q,w, "url %s %d 0%o %d\n",f->cached_name, f->length, 0777, f->flags);
-		link_putlstring(w->link, f->payload, f->length, time(0) + q->short_timeout);
+		send_worker_data(q, w, f->payload, f->length, time(0) + q->short_timeout);
 		break;
 
 	case WORK_QUEUE_DIRECTORY:
@@ -3166,6 +3819,9 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 		} else {
 			char *expanded_payload = expand_envnames(w, f->payload);
 			if(expanded_payload) {
+				if(q->cache_by_content && f->type == WORK_QUEUE_FILE && (f->flags & WORK_QUEUE_CACHE)) {
+					set_content_cached_name(q, f, expanded_payload);
+				}
 				result = send_item_if_not_cached(q,w,t,f,expanded_payload,&total_bytes);
 				free(expanded_payload);
 			} else {
@@ -3182,15 +3838,18 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 		t->bytes_sent        += total_bytes;
 		t->bytes_transferred += total_bytes;
 
-		w->total_bytes_transferred += total_bytes;
-		w->total_transfer_time     += elapsed_time;
-
 		q->stats->bytes_sent += total_bytes;
 
+		// Queued files are accounted for when they are actually sent.
+		if(!w->staging) {
+			w->total_bytes_transferred += total_bytes;
+			w->total_transfer_time     += elapsed_time;
+		}
+
 		// Avoid division by zero below.
 		if(elapsed_time==0) elapsed_time = 1;
 
-		if(total_bytes > 0) {
+		if(total_bytes > 0 && !w->staging) {
 			debug(D_WQ, "%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
 				w->hostname,
 				w->addrport,
@@ -3300,11 +3959,17 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		return result;
 	}
 
+	/* The description of the task goes to the worker in a single write. */
+	buffer_t batch;
+	buffer_init(&batch);
+	buffer_abortonfailure(&batch, 1);
+	w->batch = &batch;
+
 	send_worker_msg(q,w, "task %lld\n",  (long long) t->taskid);
 
 	long long cmd_len = strlen(command_line);
 	send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
+	send_worker_data(q, w, command_line, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
 	debug(D_WQ, "%s\n", command_line);
 	free(command_line);
 
@@ -3362,6 +4027,10 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 	// message we sent to the worker (other messages may have failed above).
 	int result_msg = send_worker_msg(q,w,"end\n");
 
+	w->batch = NULL;
+	result_msg = send_worker_batch(q, w, &batch);
+	buffer_free(&batch);
+
 	if(result_msg > -1)
 	{
 		debug(D_WQ, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
@@ -3518,6 +4187,11 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 		return 0;
 	}
 
+	/* a worker still receiving the input files of a task gets no other task until they are sent. */
+	if(w->transfer_files > 0) {
+		return 0;
+	}
+
 	if(w->type != WORKER_TYPE_FOREMAN) {
 		struct blacklist_host_info *info = hash_table_lookup(q->worker_blacklist, w->hostname);
 		if (info && info->blacklisted) {
@@ -3529,42 +4203,193 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 
 	int ok = 1;
 
-	if(w->resources->cores.inuse + limits->cores > overcommitted_resource_total(q, w->resources->cores.total, 1)) {
-		ok = 0;
-	}
+	if(w->resources->cores.inuse + limits->cores > overcommitted_resource_total(q, w->resources->cores.total, 1)) {
+		ok = 0;
+	}
+
+	if(w->resources->memory.inuse + limits->memory > overcommitted_resource_total(q, w->resources->memory.total, 0)) {
+		ok = 0;
+	}
+
+	if(w->resources->disk.inuse + limits->disk > w->resources->disk.total) { /* No overcommit disk */
+		ok = 0;
+	}
+
+	if(w->resources->gpus.inuse + limits->gpus > overcommitted_resource_total(q, w->resources->gpus.total, 0)) {
+		ok = 0;
+	}
+
+	rmsummary_delete(limits);
+
+	if(t->features) {
+		if(!w->features)
+			return 0;
+
+		char *feature;
+		list_first_item(t->features);
+		while((feature = list_next_item(t->features))) {
+			if(!hash_table_lookup(w->features, feature))
+				return 0;
+		}
+	}
+
+	return ok;
+}
+
+/*
+Workers are indexed by the number of cores they have available (taking into
+account the asynchrony settings), so that the scheduler only considers the
+workers that may have room for a task, instead of walking the whole worker
+table for every task in the ready list. Workers that do not report any cores
+are kept aside, as they may still run tasks that do not need cores.
+*/
+
+static int64_t worker_free_cores(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->resources->cores.largest < 1) {
+		return -1;
+	}
+
+	return MAX(0, overcommitted_resource_total(q, w->resources->cores.total, 1) - w->resources->cores.inuse);
+}
+
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->index_free_cores < 0) {
+		set_remove(q->workers_without_cores, w);
+		return;
+	}
+
+	struct set *bucket = itable_lookup(q->workers_by_free_cores, w->index_free_cores);
+	if(!bucket)
+		return;
+
+	set_remove(bucket, w);
+
+	if(set_size(bucket) < 1) {
+		itable_remove(q->workers_by_free_cores, w->index_free_cores);
+		set_delete(bucket);
+	}
+}
+
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w)
+{
+	int64_t free_cores = worker_free_cores(q, w);
+
+	if(free_cores == w->index_free_cores)
+		return;
+
+	worker_index_remove(q, w);
+	w->index_free_cores = free_cores;
+
+	if(free_cores < 0) {
+		set_insert(q->workers_without_cores, w);
+		return;
+	}
+
+	struct set *bucket = itable_lookup(q->workers_by_free_cores, free_cores);
+	if(!bucket) {
+		bucket = set_create(0);
+		itable_insert(q->workers_by_free_cores, free_cores, bucket);
+	}
+
+	set_insert(bucket, w);
+}
+
+/* the free cores of all workers change when the asynchrony settings change. */
+static void worker_index_rebuild(struct work_queue *q)
+{
+	char *key;
+	struct work_queue_worker *w;
+
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		worker_index_update(q, w);
+	}
+
+	q->resources_generation++;
+}
+
+/*
+Visit the workers that have enough free cores to possibly run t, without
+copying them. The buckets of workers_by_free_cores are walked in increasing
+order of free cores, so that tasks go to the workers they fit best, followed
+by the workers that do not report cores. A task without an explicit cores
+request gets the largest core count of the worker, thus it needs at least one
+free core on any indexed worker. The caller still has to call
+check_hand_against_task on each candidate.
+*/
+
+struct candidate_cursor {
+	uint64_t *free_cores;  // keys of the buckets to visit, in increasing order.
+	int count;             // number of buckets to visit.
+	int current;           // bucket being visited, or count for workers_without_cores.
+	struct set *bucket;    // set being visited, or NULL before the first.
+};
+
+static int compare_free_cores(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void candidate_workers_first(struct work_queue *q, struct work_queue_task *t, struct candidate_cursor *c)
+{
+	const struct rmsummary *max = task_max_resources(q, t);
+	int64_t min_free_cores = max->cores > -1 ? max->cores : 1;
+
+	uint64_t free_cores;
+	struct set *bucket;
+
+	c->free_cores = malloc(MAX(1, itable_size(q->workers_by_free_cores)) * sizeof(*c->free_cores));
+	c->count = 0;
+	c->current = -1;
+	c->bucket = NULL;
 
-	if(w->resources->memory.inuse + limits->memory > overcommitted_resource_total(q, w->resources->memory.total, 0)) {
-		ok = 0;
+	itable_firstkey(q->workers_by_free_cores);
+	while(itable_nextkey(q->workers_by_free_cores, &free_cores, (void **) &bucket)) {
+		if((int64_t) free_cores >= min_free_cores) {
+			c->free_cores[c->count++] = free_cores;
+		}
 	}
 
-	if(w->resources->disk.inuse + limits->disk > w->resources->disk.total) { /* No overcommit disk */
-		ok = 0;
-	}
+	qsort(c->free_cores, c->count, sizeof(*c->free_cores), compare_free_cores);
+}
 
-	if(w->resources->gpus.inuse + limits->gpus > overcommitted_resource_total(q, w->resources->gpus.total, 0)) {
-		ok = 0;
-	}
+static struct work_queue_worker *candidate_workers_next(struct work_queue *q, struct candidate_cursor *c)
+{
+	struct work_queue_worker *w;
 
-	rmsummary_delete(limits);
+	while(1) {
+		if(c->bucket && (w = set_next_element(c->bucket))) {
+			return w;
+		}
 
-	if(t->features) {
-		if(!w->features)
-			return 0;
+		if(c->current >= c->count) {
+			return NULL;
+		}
 
-		char *feature;
-		list_first_item(t->features);
-		while((feature = list_next_item(t->features))) {
-			if(!hash_table_lookup(w->features, feature))
-				return 0;
+		c->current++;
+		if(c->current < c->count) {
+			c->bucket = itable_lookup(q->workers_by_free_cores, c->free_cores[c->current]);
+		} else {
+			c->bucket = q->workers_without_cores;
 		}
+
+		set_first_element(c->bucket);
 	}
+}
 
-	return ok;
+static void candidate_workers_done(struct candidate_cursor *c)
+{
+	free(c->free_cores);
+	c->free_cores = NULL;
 }
 
 static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	int64_t most_task_cached_bytes = 0;
@@ -3572,8 +4397,10 @@ static struct work_queue_worker *find_worker_by_files(struct work_queue *q, stru
 	struct stat *remote_info;
 	struct work_queue_file *tf;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	struct candidate_cursor candidates;
+	candidate_workers_first(q, t, &candidates);
+
+	while((w = candidate_workers_next(q, &candidates))) {
 		if( check_hand_against_task(q, w, t) ) {
 			task_cached_bytes = 0;
 			list_first_item(t->input_files);
@@ -3592,36 +4419,53 @@ static struct work_queue_worker *find_worker_by_files(struct work_queue *q, stru
 		}
 	}
 
+	candidate_workers_done(&candidates);
+
 	return best_worker;
 }
 
+/*
+The candidates come in order of free cores, so keep the one that connected
+first among those that can run the task.
+*/
+
 static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+	struct work_queue_worker *best_worker = 0;
+	struct candidate_cursor candidates;
+	candidate_workers_first(q, t, &candidates);
+
+	while((w = candidate_workers_next(q, &candidates))) {
+		if(best_worker && w->start_time >= best_worker->start_time) {
+			continue;
+		}
 		if( check_hand_against_task(q, w, t) ) {
-			return w;
+			best_worker = w;
 		}
 	}
-	return NULL;
+
+	candidate_workers_done(&candidates);
+
+	return best_worker;
 }
 
 static struct work_queue_worker *find_worker_by_random(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w = NULL;
 	int random_worker;
 	struct list *valid_workers = list_create();
+	struct candidate_cursor candidates;
+	candidate_workers_first(q, t, &candidates);
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+	while((w = candidate_workers_next(q, &candidates))) {
 		if(check_hand_against_task(q, w, t)) {
 			list_push_tail(valid_workers, w);
 		}
 	}
 
+	candidate_workers_done(&candidates);
+
 	w = NULL;
 	if(list_size(valid_workers) > 0) {
 		random_worker = (rand() % list_size(valid_workers)) + 1;
@@ -3673,7 +4517,6 @@ static int compare_worst_fit(struct work_queue_resources *a, struct work_queue_r
 
 static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = NULL;
 
@@ -3683,8 +4526,10 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 	memset(&bres, 0, sizeof(struct work_queue_resources));
 	memset(&wres, 0, sizeof(struct work_queue_resources));
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	struct candidate_cursor candidates;
+	candidate_workers_first(q, t, &candidates);
+
+	while((w = candidate_workers_next(q, &candidates))) {
 		if( check_hand_against_task(q, w, t) ) {
 
 			//Use total field on bres, wres to indicate free resources.
@@ -3701,18 +4546,21 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 		}
 	}
 
+	candidate_workers_done(&candidates);
+
 	return best_worker;
 }
 
 static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	double best_time = HUGE_VAL;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	struct candidate_cursor candidates;
+	candidate_workers_first(q, t, &candidates);
+
+	while((w = candidate_workers_next(q, &candidates))) {
 		if(check_hand_against_task(q, w, t)) {
 			if(w->total_tasks_complete > 0) {
 				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
@@ -3724,6 +4572,8 @@ static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struc
 		}
 	}
 
+	candidate_workers_done(&candidates);
+
 	if(best_worker) {
 		return best_worker;
 	} else {
@@ -3769,6 +4619,7 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 
 	if(w->resources->workers.total < 1)
 	{
+		worker_index_update(q, w);
 		return;
 	}
 
@@ -3779,6 +4630,8 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 		w->resources->disk.inuse      += box->disk;
 		w->resources->gpus.inuse      += box->gpus;
 	}
+
+	worker_index_update(q, w);
 }
 
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w) {
@@ -3831,9 +4684,16 @@ static void commit_task_to_worker(struct work_queue *q, struct work_queue_worker
 	t->host = xxstrdup(w->addrport);
 
 	t->time_when_commit_start = timestamp_get();
+	w->staging = q->max_concurrent_transfers > 0;
 	work_queue_result_code_t result = start_one_task(q, w, t);
+	w->staging = 0;
 	t->time_when_commit_end = timestamp_get();
 
+	if(list_size(w->transfers) > 0) {
+		// The commit ends when the last queued transfer is sent.
+		queue_worker_transfer(q, w, NULL, -1, 0, NULL, t->taskid);
+	}
+
 	itable_insert(w->current_tasks, t->taskid, t);
 	itable_insert(q->worker_task_map, t->taskid, w); //add worker as execution site for t.
 
@@ -3872,49 +4732,119 @@ static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker
 	change_task_state(q, t, new_state);
 
 	count_worker_resources(q, w);
+	q->resources_generation++;
+}
+
+/*
+Tasks with the same shape fit in exactly the same workers: they share the
+category, the minimum and maximum allocations, and the required features.
+*/
+
+static void task_shape(struct work_queue *q, struct work_queue_task *t, buffer_t *b)
+{
+	const struct rmsummary *min = task_min_resources(q, t);
+	buffer_printf(b, "%s %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64, t->category, min->cores, min->memory, min->disk, min->gpus);
+
+	const struct rmsummary *max = task_max_resources(q, t);
+	buffer_printf(b, " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64, max->cores, max->memory, max->disk, max->gpus);
+
+	if(t->features) {
+		char *feature;
+		list_first_item(t->features);
+		while((feature = list_next_item(t->features))) {
+			buffer_printf(b, " %s", feature);
+		}
+	}
 }
 
-static int send_one_task( struct work_queue *q )
+/*
+Send up to q->dispatch_batch_size tasks to workers in a single pass over the
+ready list. When no worker is found for a task, its shape is remembered so
+that other tasks with the same shape are skipped, until some worker may fit
+them again (see resources_generation).
+*/
+
+static int send_tasks( struct work_queue *q, time_t stoptime )
 {
 	struct work_queue_task *t;
 	struct work_queue_worker *w;
+	int sent = 0;
+
+	/* q->ready_list's own iterator is used while logging stats on each
+	 * commit, so we use a separate cursor. */
+	struct list_cursor *cur = list_cursor_create(q->ready_list);
 
 	// Consider each task in the order of priority:
-	list_first_item(q->ready_list);
-	while( (t = list_next_item(q->ready_list))) {
+	for(list_seek(cur, 0); list_get(cur, (void **) &t); list_next(cur)) {
+
+		if(sent >= q->dispatch_batch_size)
+			break;
+
+		if(sent > 0 && stoptime && time(0) >= stoptime)
+			break;
+
+		if(q->tasks_no_fit_generation != q->resources_generation) {
+			hash_table_clear(q->tasks_no_fit);
+			q->tasks_no_fit_generation = q->resources_generation;
+		}
+
+		buffer_t shape;
+		buffer_init(&shape);
+		task_shape(q, t, &shape);
+
+		// Skip the task if a task like it did not fit anywhere.
+		if(hash_table_lookup(q->tasks_no_fit, buffer_tostring(&shape))) {
+			buffer_free(&shape);
+			continue;
+		}
 
-		// Find the best worker for the task at the head of the list
+		// Find the best worker for the task
+		timestamp_t time_scheduling_start = timestamp_get();
 		w = find_best_worker(q,t);
+		q->stats->time_scheduling += timestamp_get() - time_scheduling_start;
 
 		// If there is no suitable worker, consider the next task.
-		if(!w) continue;
+		if(!w) {
+			hash_table_insert(q->tasks_no_fit, buffer_tostring(&shape), (void *) 1);
+			buffer_free(&shape);
+			continue;
+		}
+
+		buffer_free(&shape);
 
 		// Otherwise, remove it from the ready list and start it:
 		commit_task_to_worker(q,w,t);
-
-		return 1;
+		sent++;
 	}
 
-	return 0;
+	list_cursor_destroy(cur);
+
+	return sent;
 }
 
 static int receive_one_task( struct work_queue *q )
 {
-	struct work_queue_task *t;
-
-	struct work_queue_worker *w;
-	uint64_t taskid;
+	struct work_queue_task *t = NULL;
+	struct work_queue_worker *w = NULL;
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) {
-			w = itable_lookup(q->worker_task_map, taskid);
-			fetch_output_from_worker(q, w, taskid);
-			return 1;
+	// Outputs are fetched synchronously, so skip workers whose queue is not yet sent.
+	struct list_cursor *cur = list_cursor_create(q->waiting_retrieval_list);
+	for(list_seek(cur, 0); list_get(cur, (void **) &t); list_next(cur)) {
+		w = itable_lookup(q->worker_task_map, t->taskid);
+		if(list_size(w->transfers) == 0) {
+			break;
 		}
+		t = NULL;
 	}
+	list_cursor_destroy(cur);
 
-	return 0;
+	if(!t) {
+		return 0;
+	}
+
+	fetch_output_from_worker(q, w, t->taskid);
+
+	return 1;
 }
 
 //Sends keepalives to check if connected workers are responsive, and ask for updates If not, removes those workers.
@@ -4133,17 +5063,20 @@ static struct work_queue_task *find_task_by_tag(struct work_queue *q, const char
 
 
 static struct work_queue_file *work_queue_file_clone(const struct work_queue_file *file) {
-  const int file_t_size = sizeof(struct work_queue_file);
-  struct work_queue_file *new = xxmalloc(file_t_size);
-
-  memcpy(new, file, file_t_size);
-  //allocate new memory for strings so we don't segfault when the original
-  //memory is freed.
-  new->payload     = xxstrdup(file->payload);
-  new->remote_name = xxstrdup(file->remote_name);
+  struct work_queue_file *new = slab_alloc(file_slab);
+
+  memcpy(new, file, sizeof(*new));
+  //take new references to the strings so we don't segfault when the original
+  //file is deleted. Buffers are not interned, and are copied.
+  if(file->type == WORK_QUEUE_BUFFER) {
+	  new->payload = xxmalloc(file->length);
+	  memcpy(new->payload, file->payload, file->length);
+  } else {
+	  new->payload = (char *) string_intern(file->payload);
+  }
 
-  if(file->cached_name)
-	  new->cached_name = xxstrdup(file->cached_name);
+  new->remote_name = (char *) string_intern(file->remote_name);
+  new->cached_name = (char *) string_intern(file->cached_name);
 
   return new;
 }
@@ -4179,12 +5112,11 @@ static struct list *work_queue_task_env_list_clone(struct list *env_list) {
 
 struct work_queue_task *work_queue_task_create(const char *command_line)
 {
-	struct work_queue_task *t = malloc(sizeof(*t));
-	if(!t) {
-		fprintf(stderr, "Error: failed to allocate memory for task.\n");
-		return NULL;
+	if(!task_slab) {
+		task_slab = slab_create(sizeof(struct work_queue_task), 0);
 	}
-	memset(t, 0, sizeof(*t));
+
+	struct work_queue_task *t = slab_alloc(task_slab);
 
 	/* REMEMBER: Any memory allocation done in this function should have a
 	 * corresponding copy in work_queue_task_clone. Otherwise we get
@@ -4214,7 +5146,7 @@ struct work_queue_task *work_queue_task_create(const char *command_line)
 
 struct work_queue_task *work_queue_task_clone(const struct work_queue_task *task)
 {
-  struct work_queue_task *new = xxmalloc(sizeof(struct work_queue_task));
+  struct work_queue_task *new = slab_alloc(task_slab);
   memcpy(new, task, sizeof(*new));
 
   new->taskid = 0;
@@ -4421,25 +5353,25 @@ struct work_queue_file *work_queue_file_create(const char *payload, const char *
 {
 	struct work_queue_file *f;
 
-	f = malloc(sizeof(*f));
-	if(!f) {
-		debug(D_NOTICE, "Cannot allocate memory for file %s.\n", remote_name);
-		return NULL;
+	if(!file_slab) {
+		file_slab = slab_create(sizeof(struct work_queue_file), 0);
 	}
 
-	memset(f, 0, sizeof(*f));
+	f = slab_alloc(file_slab);
 
-	f->remote_name = xxstrdup(remote_name);
+	f->remote_name = (char *) string_intern(remote_name);
 	f->type = type;
 	f->flags = flags;
 
 	/* WORK_QUEUE_BUFFER needs to set these after the current function returns */
 	if(payload) {
-		f->payload = xxstrdup(payload);
+		f->payload = (char *) string_intern(payload);
 		f->length  = strlen(payload);
 	}
 
-	f->cached_name = make_cached_name(f);
+	char *cached_name = make_cached_name(f);
+	f->cached_name = (char *) string_intern(cached_name);
+	free(cached_name);
 
 	return f;
 }
@@ -4841,13 +5773,23 @@ void work_queue_task_specify_monitor_output(struct work_queue_task *t, const cha
 }
 
 void work_queue_file_delete(struct work_queue_file *tf) {
-	if(tf->payload)
+	if(tf->type == WORK_QUEUE_BUFFER) {
 		free(tf->payload);
-	if(tf->remote_name)
-		free(tf->remote_name);
-	if(tf->cached_name)
-		free(tf->cached_name);
-	free(tf);
+	} else {
+		string_intern_release(tf->payload);
+	}
+	string_intern_release(tf->remote_name);
+	string_intern_release(tf->cached_name);
+	slab_free(file_slab, tf);
+}
+
+static void invalidate_content_name(struct work_queue *q, const char *expanded_local_name) {
+	struct content_name *c = hash_table_remove(q->content_names, expanded_local_name);
+	if(c) {
+		work_queue_invalidate_cached_file_internal(q, c->cached_name);
+		free(c->cached_name);
+		free(c);
+	}
 }
 
 void work_queue_invalidate_cached_file(struct work_queue *q, const char *local_name, work_queue_file_t type) {
@@ -4855,6 +5797,21 @@ void work_queue_invalidate_cached_file(struct work_queue *q, const char *local_n
 
 	work_queue_invalidate_cached_file_internal(q, f->cached_name);
 	work_queue_file_delete(f);
+
+	/* Content names are kept under the name expanded for each worker. */
+	invalidate_content_name(q, local_name);
+	if(strchr(local_name, '$')) {
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->worker_table);
+		while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+			char *expanded_name = expand_envnames(w, local_name);
+			if(expanded_name) {
+				invalidate_content_name(q, expanded_name);
+				free(expanded_name);
+			}
+		}
+	}
 }
 
 void work_queue_invalidate_cached_file_internal(struct work_queue *q, const char *filename) {
@@ -4944,7 +5901,7 @@ void work_queue_task_delete(struct work_queue_task *t)
 
 		free(t->monitor_output_directory);
 		free(t->monitor_snapshot_file);
-		free(t);
+		slab_free(task_slab, t);
 	}
 }
 
@@ -5023,14 +5980,32 @@ struct work_queue *work_queue_create(int port)
 
 	q->ready_list = list_create();
 
+	q->dispatch_batch_size = WORK_QUEUE_DISPATCH_BATCH_SIZE;
+
+	q->max_concurrent_transfers = WORK_QUEUE_MAX_CONCURRENT_TRANSFERS;
+	q->transfer_queue = list_create();
+	q->peer_transfer_limit = WORK_QUEUE_PEER_TRANSFER_LIMIT;
+	q->peer_transfers_failed = list_create();
+	q->content_names = hash_table_create(0, 0);
+	q->tasks_no_fit = hash_table_create(0, 0);
+
 	q->tasks          = itable_create(0);
 
 	q->task_state_map = itable_create(0);
 
+	q->waiting_retrieval_list = list_create();
+	q->retrieved_list         = list_create();
+	q->task_state_cursors     = itable_create(0);
+
+	q->category_task_state_counts = hash_table_create(0, 0);
+
 	q->worker_table = hash_table_create(0, 0);
 	q->worker_blacklist = hash_table_create(0, 0);
 	q->worker_task_map = itable_create(0);
 
+	q->workers_by_free_cores = itable_create(0);
+	q->workers_without_cores = set_create(0);
+
 	q->measured_local_resources   = rmsummary_create(-1);
 	q->current_max_worker         = rmsummary_create(-1);
 
@@ -5044,6 +6019,9 @@ struct work_queue *work_queue_create(int port)
 	// (and resized) as needed by build_poll_table.
 	q->poll_table_size = 8;
 
+	q->poll_set = link_poll_set_create();
+	link_poll_set_add(q->poll_set, q->master_link, LINK_READ);
+
 	q->worker_selection_algorithm = wq_option_scheduler;
 	q->process_pending_check = 0;
 
@@ -5334,6 +6312,10 @@ void work_queue_delete(struct work_queue *q)
 		hash_table_delete(q->worker_blacklist);
 		itable_delete(q->worker_task_map);
 
+		/* all workers were released above, thus the index is empty. */
+		itable_delete(q->workers_by_free_cores);
+		set_delete(q->workers_without_cores);
+
 		struct category *c;
 		hash_table_firstkey(q->categories);
 		while(hash_table_nextkey(q->categories, &key, (void **) &c)) {
@@ -5342,11 +6324,44 @@ void work_queue_delete(struct work_queue *q)
 		hash_table_delete(q->categories);
 
 		list_delete(q->ready_list);
+		hash_table_delete(q->tasks_no_fit);
+		list_delete(q->transfer_queue);
+
+		struct peer_transfer *p;
+		while((p = list_pop_head(q->peer_transfers_failed))) {
+			peer_transfer_delete(p);
+		}
+		list_delete(q->peer_transfers_failed);
+
+		struct content_name *content;
+		hash_table_firstkey(q->content_names);
+		while(hash_table_nextkey(q->content_names, &key, (void **) &content)) {
+			free(content->cached_name);
+			free(content);
+		}
+		hash_table_delete(q->content_names);
 
 		itable_delete(q->tasks);
 
 		itable_delete(q->task_state_map);
 
+		struct list_cursor *cur;
+		uint64_t taskid;
+		itable_firstkey(q->task_state_cursors);
+		while(itable_nextkey(q->task_state_cursors, &taskid, (void **) &cur)) {
+			list_cursor_destroy(cur);
+		}
+		itable_delete(q->task_state_cursors);
+		list_delete(q->waiting_retrieval_list);
+		list_delete(q->retrieved_list);
+
+		int *counts;
+		hash_table_firstkey(q->category_task_state_counts);
+		while(hash_table_nextkey(q->category_task_state_counts, &key, (void **) &counts)) {
+			free(counts);
+		}
+		hash_table_delete(q->category_task_state_counts);
+
 		hash_table_delete(q->workers_with_available_results);
 
 		struct work_queue_task_report *tr;
@@ -5368,6 +6383,7 @@ void work_queue_delete(struct work_queue *q)
 
 		free(q->poll_table);
 		link_close(q->master_link);
+		link_poll_set_delete(q->poll_set);
 		if(q->logfile) {
 			fclose(q->logfile);
 		}
@@ -5584,8 +6600,17 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 	if( old_state == WORK_QUEUE_TASK_READY ) {
 		// Treat WORK_QUEUE_TASK_READY specially, as it has the order of the tasks
 		list_remove(q->ready_list, t);
+	} else if( old_state == WORK_QUEUE_TASK_WAITING_RETRIEVAL || old_state == WORK_QUEUE_TASK_RETRIEVED ) {
+		struct list_cursor *cur = itable_remove(q->task_state_cursors, t->taskid);
+		if(cur) {
+			list_drop(cur);
+			list_cursor_destroy(cur);
+		}
 	}
 
+	count_task_state(q, t, old_state, -1);
+	count_task_state(q, t, new_state,  1);
+
 	// insert to corresponding table
 	debug(D_WQ, "Task %d state change: %s (%d) to %s (%d)\n", t->taskid, task_state_str(old_state), old_state, task_state_str(new_state), new_state);
 
@@ -5594,6 +6619,18 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 			update_task_result(t, WORK_QUEUE_RESULT_UNKNOWN);
 			push_task_to_ready_list(q, t);
 			break;
+		case WORK_QUEUE_TASK_WAITING_RETRIEVAL:
+		case WORK_QUEUE_TASK_RETRIEVED:
+			{
+				/* keep a cursor to the task, so that it can be removed from the list in constant time. */
+				struct list *l = task_state_list(q, new_state);
+				list_push_tail(l, t);
+
+				struct list_cursor *cur = list_cursor_create(l);
+				list_seek(cur, -1);
+				itable_insert(q->task_state_cursors, t->taskid, cur);
+			}
+			break;
 		case WORK_QUEUE_TASK_DONE:
 		case WORK_QUEUE_TASK_CANCELED:
 			/* tasks are freed when returned to user, thus we remove them from our local record */
@@ -5710,10 +6747,29 @@ static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task
 	return itable_lookup(q->task_state_map, taskid) == (void *) state;
 }
 
+/* list of the tasks in state, or NULL if the tasks in state are not kept in a list. */
+static struct list *task_state_list(struct work_queue *q, work_queue_task_state_t state) {
+	switch(state) {
+		case WORK_QUEUE_TASK_READY:
+			return q->ready_list;
+		case WORK_QUEUE_TASK_WAITING_RETRIEVAL:
+			return q->waiting_retrieval_list;
+		case WORK_QUEUE_TASK_RETRIEVED:
+			return q->retrieved_list;
+		default:
+			return NULL;
+	}
+}
+
 static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state) {
 	struct work_queue_task *t;
 	uint64_t taskid;
 
+	struct list *l = task_state_list(q, state);
+	if(l) {
+		return list_peek_head(l);
+	}
+
 	itable_firstkey(q->tasks);
 	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
 		if( task_state_is(q, taskid, state) ) {
@@ -5724,22 +6780,41 @@ static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_t
 	return NULL;
 }
 
-static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
+/* Update the number of tasks in state, for the queue and the category of t.
+ * As tasks DONE or CANCELED are not kept in the queue, they are not counted. */
+static void count_task_state(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state, int delta) {
+	switch(state) {
+		case WORK_QUEUE_TASK_READY:
+		case WORK_QUEUE_TASK_RUNNING:
+		case WORK_QUEUE_TASK_WAITING_RETRIEVAL:
+		case WORK_QUEUE_TASK_RETRIEVED:
+			break;
+		default:
+			return;
+	}
 
-	int count = 0;
+	q->task_state_counts[state] += delta;
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
+	int *counts = hash_table_lookup(q->category_task_state_counts, t->category);
+	if(!counts) {
+		counts = calloc(WORK_QUEUE_TASK_CANCELED + 1, sizeof(*counts));
+		hash_table_insert(q->category_task_state_counts, t->category, counts);
 	}
 
-	return count;
+	counts[state] += delta;
+}
+
+static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
+	if(!category) {
+		return q->task_state_counts[state];
+	}
+
+	int *counts = hash_table_lookup(q->category_task_state_counts, category);
+	if(!counts) {
+		return 0;
+	}
+
+	return counts[state];
 }
 
 static int task_request_count( struct work_queue *q, const char *category, category_allocation_t request) {
@@ -5833,6 +6908,7 @@ void work_queue_blacklist_remove(struct work_queue *q, const char *hostname)
 	if(info) {
 		info->blacklisted = 0;
 		info->release_at  = 0;
+		q->resources_generation++;
 	}
 }
 
@@ -5920,6 +6996,9 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
 	int msec = q->busy_waiting_flag ? 1000 : 0;
+	if(q->transfer_pacing_wait > 0) {
+		msec = MIN(msec, q->transfer_pacing_wait / 1000 + 1);
+	}
 	if(stoptime) {
 		msec = MIN(msec, (stoptime - time(0)) * 1000);
 	}
@@ -5932,19 +7011,14 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Wait for activity on any registered link; only the ready ones are returned.
+	n = link_poll_set_wait(q->poll_set, q->poll_table, n, msec);
 	q->link_poll_end = timestamp_get();
 
-	int i, j = 1;
-	// Consider the foreman_uplink passed into the function and disregard if inactive.
+	int i;
+	q->master_link_ready = 0;
 	if(foreman_uplink) {
-		if(q->poll_table[1].revents) {
-			*foreman_uplink_active = 1; //signal that the master link saw activity
-		} else {
-			*foreman_uplink_active = 0;
-		}
-		j++;
+		*foreman_uplink_active = 0;
 	}
 
 	END_ACCUM_TIME(q, time_polling);
@@ -5952,24 +7026,41 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
 	int workers_failed = 0;
-	// Then consider all existing active workers
-	for(i = j; i < n; i++) {
-		if(q->poll_table[i].revents) {
-			if(handle_worker(q, q->poll_table[i].link) == WQ_WORKER_FAILURE) {
-				workers_failed++;
-			}
+	for(i = 0; i < n; i++) {
+		struct link *link = q->poll_table[i].link;
+		if(link == q->master_link) {
+			q->master_link_ready = 1;
+		} else if(link == foreman_uplink) {
+			*foreman_uplink_active = 1; //signal that the master link saw activity
+		} else if(!(q->poll_table[i].revents & LINK_READ)) {
+			// only writable, the transfers below take care of it.
+		} else if(handle_worker(q, link) == WQ_WORKER_FAILURE) {
+			workers_failed++;
 		}
 	}
 
+	workers_failed += send_queued_transfers(q);
+	workers_failed += send_failed_peer_transfers(q);
+
 	if(hash_table_size(q->workers_with_available_results) > 0) {
 		char *key;
 		struct work_queue_worker *w;
+		struct list *available = list_create();
+
+		// Workers still receiving inputs are asked for results once their transfers are done.
 		hash_table_firstkey(q->workers_with_available_results);
 		while(hash_table_nextkey(q->workers_with_available_results,&key,(void**)&w)) {
+			if(list_size(w->transfers) == 0) {
+				list_push_tail(available, w);
+			}
+		}
+
+		while((w = list_pop_head(available))) {
+			hash_table_remove(q->workers_with_available_results, w->hashkey);
 			get_available_results(q, w);
-			hash_table_remove(q->workers_with_available_results, key);
-			hash_table_firstkey(q->workers_with_available_results);
 		}
+
+		list_delete(available);
 	}
 
 	END_ACCUM_TIME(q, time_status_msgs);
@@ -5985,7 +7076,7 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 	// If the master link was awake, then accept at most max_new_workers.
 	// Note we are using the information gathered in poll_active_workers, which
 	// is a little ugly.
-	if(q->poll_table[0].revents) {
+	if(q->master_link_ready) {
 		do {
 			add_worker(q);
 			new_workers++;
@@ -5999,12 +7090,12 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeout, struct link *foreman_uplink, int *foreman_uplink_active)
 /*
    - compute stoptime
-   S time left?                              No:  return null
-   - task completed?                         Yes: return completed task to user
+   S task completed?                         Yes: return completed task to user
+   - time left (always on the first pass)?   No:  return null
    - update catalog if appropiate
    - retrieve workers status messages
    - tasks waiting to be retrieved?          Yes: retrieve one task and go to S.
-   - tasks waiting to be dispatched?         Yes: dispatch one task and go to S.
+   - tasks waiting to be dispatched?         Yes: dispatch a batch of tasks and go to S.
    - send keepalives to appropiate workers
    - fast-abort workers
    - if new workers, connect n of them
@@ -6028,10 +7119,10 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 	time_t stoptime = (timeout == WORK_QUEUE_WAITFORTASK) ? 0 : time(0) + timeout;
 
 	int result;
+	int first_pass = 1;
 	struct work_queue_task *t = NULL;
-	// time left?
 
-	while( (stoptime == 0) || (time(0) < stoptime) ) {
+	while(1) {
 
 		BEGIN_ACCUM_TIME(q, time_internal);
 
@@ -6053,6 +7144,14 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 			break;
 		}
 
+		// time left? A zero timeout still makes one pass without blocking,
+		// so that tasks already complete at the workers can be collected.
+		if(!first_pass && stoptime != 0 && time(0) >= stoptime) {
+			END_ACCUM_TIME(q, time_internal);
+			break;
+		}
+		first_pass = 0;
+
 		 // update catalog if appropriate
 		if(q->name) {
 			update_catalog(q, foreman_uplink, 0);
@@ -6102,7 +7201,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// tasks waiting to be dispatched?
 		BEGIN_ACCUM_TIME(q, time_send);
-		result = send_one_task(q);
+		result = send_tasks(q, stoptime);
 		END_ACCUM_TIME(q, time_send);
 		if(result) {
 			// sent at least one task
@@ -6154,7 +7253,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// return if queue is empty.
 		BEGIN_ACCUM_TIME(q, time_internal);
-		int done = !task_state_any(q, WORK_QUEUE_TASK_RUNNING) && !task_state_any(q, WORK_QUEUE_TASK_READY) && !task_state_any(q, WORK_QUEUE_TASK_WAITING_RETRIEVAL) && !(foreman_uplink);
+		int done = !task_state_count(q, NULL, WORK_QUEUE_TASK_RUNNING) && !task_state_count(q, NULL, WORK_QUEUE_TASK_READY) && !task_state_count(q, NULL, WORK_QUEUE_TASK_WAITING_RETRIEVAL) && !(foreman_uplink);
 		END_ACCUM_TIME(q, time_internal);
 
 		if(done)
@@ -6239,6 +7338,9 @@ int work_queue_specify_draining_by_hostname(struct work_queue *q, const char *ho
 		}
 	}
 
+	if(workers_updated > 0)
+		q->resources_generation++;
+
 	return workers_updated;
 }
 
@@ -6378,9 +7480,11 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 
 	if(!strcmp(name, "asynchrony-multiplier")) {
 		q->asynchrony_multiplier = MAX(value, 1.0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "asynchrony-modifier")) {
 		q->asynchrony_modifier = MAX(value, 0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "min-transfer-timeout")) {
 		q->minimum_transfer_timeout = (int)value;
@@ -6409,6 +7513,28 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "long-timeout")) {
 		q->long_timeout = MAX(1, (int)value);
 
+	} else if(!strcmp(name, "dispatch-batch-size")) {
+		q->dispatch_batch_size = MAX(1, (int)value);
+
+	} else if(!strcmp(name, "max-concurrent-transfers")) {
+		q->max_concurrent_transfers = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "peer-transfer-limit")) {
+		int was_enabled = q->peer_transfer_limit > 0;
+		q->peer_transfer_limit = MAX(0, (int)value);
+
+		if(!was_enabled && q->peer_transfer_limit > 0) {
+			char *key;
+			struct work_queue_worker *w;
+			hash_table_firstkey(q->worker_table);
+			while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+				request_peer_transfers(q, w);
+			}
+		}
+
+	} else if(!strcmp(name, "cache-by-content")) {
+		q->cache_by_content = !!((int)value);
+
 	} else if(!strcmp(name, "category-steady-n-tasks")) {
 		category_tune_bucket_size("category-steady-n-tasks", (int) value);
 
@@ -6433,6 +7559,16 @@ char * work_queue_get_worker_summary( struct work_queue *q )
 void work_queue_set_bandwidth_limit(struct work_queue *q, const char *bandwidth)
 {
 	q->bandwidth = string_metric_parse(bandwidth);
+	if(q->bandwidth < 0) {
+		q->bandwidth = 0;
+	}
+
+	char *key;
+	struct work_queue_worker *w;
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+		link_rate_limit(w->link, q->bandwidth);
+	}
 }
 
 double work_queue_get_effective_bandwidth(struct work_queue *q)
@@ -6528,6 +7664,8 @@ void work_queue_get_stats(struct work_queue *q, struct work_queue_stats *s)
 	struct work_queue_resources r;
 	aggregate_workers_resources(q,&r,NULL);
 
+	s->bytes_metadata = work_queue_metadata_bytes();
+
 	s->total_cores = r.cores.total;
 	s->total_memory = r.memory.total;
 	s->total_disk = r.disk.total;
@@ -6903,6 +8041,21 @@ static void write_transaction_worker_resources(struct work_queue *q, struct work
 	free(rjx);
 }
 
+static void write_transaction_transfer(struct work_queue *q, struct work_queue_worker *w, int taskid, int is_input, const char *filename, int64_t bytes, timestamp_t elapsed) {
+	if(!q->transactions_logfile)
+		return;
+
+	struct buffer B;
+	buffer_init(&B);
+
+	double rate = elapsed > 0 ? (bytes * 1000000.0) / elapsed : 0;
+
+	buffer_printf(&B, "TRANSFER %s %d %s %" PRId64 " %" PRIu64 " %.0f %s", is_input ? "INPUT" : "OUTPUT", taskid, w->addrport, bytes, elapsed, rate, filename);
+
+	write_transaction(q, buffer_tostring(&B));
+
+	buffer_free(&B);
+}
 
 int work_queue_specify_transactions_log(struct work_queue *q, const char *logfile) {
 	q->transactions_logfile =fopen(logfile, "a");
@@ -6919,7 +8072,8 @@ int work_queue_specify_transactions_log(struct work_queue *q, const char *logfil
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid WAITING category-name {FIRST_RESOURCES|MAX_RESOURCES} resources-requested\n");
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid RUNNING worker-address {FIRST_RESOURCES|MAX_RESOURCES} resources-given\n");
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid WAITING_RETRIEVAL worker-address\n");
-		fprintf(q->transactions_logfile, "# time master-pid TASK taskid {RETRIEVED|DONE} {SUCCESS|SIGNAL|END_TIME|FORSAKEN|MAX_RETRIES|MAX_WALLTIME|UNKNOWN|RESOURCE_EXHAUSTION} {exit-code} {limits-exceeded} {resources-measured}\n\n");
+		fprintf(q->transactions_logfile, "# time master-pid TASK taskid {RETRIEVED|DONE} {SUCCESS|SIGNAL|END_TIME|FORSAKEN|MAX_RETRIES|MAX_WALLTIME|UNKNOWN|RESOURCE_EXHAUSTION} {exit-code} {limits-exceeded} {resources-measured}\n");
+		fprintf(q->transactions_logfile, "# time master-pid TRANSFER {INPUT|OUTPUT} taskid worker-address bytes transfer-usecs bytes-per-second filename\n\n");
 
 		write_transaction(q, "MASTER START");
 		return 1;
@@ -47,7 +47,7 @@ typedef enum {
 
 typedef enum {
 	WORK_QUEUE_SCHEDULE_UNSET = 0,
-	WORK_QUEUE_SCHEDULE_FCFS,      /**< Select worker on a first-come-first-serve basis. */
+	WORK_QUEUE_SCHEDULE_FCFS,      /**< Select the worker that connected first among those that can run the task. */
 	WORK_QUEUE_SCHEDULE_FILES,     /**< Select worker that has the most data required by the task. */
 	WORK_QUEUE_SCHEDULE_TIME,      /**< Select worker that has the fastest execution time on previous tasks. */
 	WORK_QUEUE_SCHEDULE_RAND,      /**< Select a random worker. (default) */
@@ -230,6 +230,7 @@ struct work_queue_stats {
 	timestamp_t time_internal;     /**< Total time the queue spents in internal processing. */
 	timestamp_t time_polling;      /**< Total time blocking waiting for worker communications (i.e., master idle waiting for a worker message). */
 	timestamp_t time_application;  /**< Total time spent outside work_queue_wait. */
+	timestamp_t time_scheduling;   /**< Total time spent finding a worker for tasks in the ready list. (Part of time_send.) */
 
 	/* Workers time statistics: */
 	timestamp_t time_workers_execute;            /**< Total time workers spent executing done tasks. */
@@ -241,6 +242,9 @@ struct work_queue_stats {
 	int64_t bytes_received; /**< Total number of file bytes (not including protocol control msg bytes) received from the workers by the master. */
 	double  bandwidth;      /**< Average network bandwidth in MB/S observed by the master when transferring to workers. */
 
+	/* memory statistics */
+	int64_t bytes_metadata; /**< Memory in bytes held by the master process for the descriptions of tasks and their files. */
+
 	/* resources statistics */
 	int capacity_tasks;     /**< The estimated number of tasks that this master can effectively support. */
 	int capacity_cores;     /**< The estimated number of workers' cores that this master can effectively support.*/
@@ -716,7 +720,7 @@ If the task could not, then the <tt>result</tt> field will be non-zero and the
 <tt>return_status</tt> field will be undefined.
 
 @param q A work queue object.
-@param timeout The number of seconds to wait for a completed task before returning.  Use an integer time to set the timeout or the constant @ref WORK_QUEUE_WAITFORTASK to block until a task has completed.
+@param timeout The number of seconds to wait for a completed task before returning.  Use an integer time to set the timeout or the constant @ref WORK_QUEUE_WAITFORTASK to block until a task has completed.  A timeout of zero returns a task that has already completed, without blocking.
 @returns A completed task description, or null if the queue is empty, or the timeout was reached without a completed task, or there is completed child process (call @ref process_wait to retrieve the status of the completed child process).
 */
 struct work_queue_task *work_queue_wait(struct work_queue *q, int timeout);
@@ -1003,6 +1007,10 @@ void work_queue_master_preferred_connection(struct work_queue *q, const char *pr
  - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
  - "long-timeout" Set the minimum timeout when sending a brief message to a foreman. (default=1h)
  - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
+ - "dispatch-batch-size" Set the maximum number of tasks sent to workers per iteration of work_queue_wait. (default=100)
+ - "max-concurrent-transfers" Set the maximum number of workers that are sent input files at the same time. If 0, input files are sent synchronously when a task is dispatched. (default=10)
+ - "peer-transfer-limit" Set the maximum number of cached files a worker may send to other workers at the same time. Workers that have a cached input file send it to workers that need it, rather than the master. Workers start serving their cache to other workers only once this is set. If 0, the master sends all input files. (default=0)
+ - "cache-by-content" If 1, name cached input files after the hash of their contents, so that identical files are sent once to each worker, and files modified in place are sent again. The hash is computed once per version of a file. (default=0)
 @param value The value to set the parameter to.
 @return 0 on succes, -1 on failure.
 */
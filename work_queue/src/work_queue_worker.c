@@ -27,6 +27,8 @@ See the file COPYING for details.
 #include "hash_cache.h"
 #include "link.h"
 #include "link_auth.h"
+#include "buffer.h"
+#include "full_io.h"
 #include "list.h"
 #include "xxmalloc.h"
 #include "debug.h"
@@ -44,6 +46,7 @@ See the file COPYING for details.
 #include "disk_alloc.h"
 #include "hash_table.h"
 #include "pattern.h"
+#include "priority_queue.h"
 #include "gpu_info.h"
 #include "tlq_config.h"
 
@@ -122,8 +125,10 @@ static int abort_flag = 0;
 // Record the signal received, to inform the master if appropiate.
 static int abort_signal_received = 0;
 
-// Flag used to indicate a child must be waited for.
-static int sigchld_received_flag = 0;
+// Signal handlers write a byte to this pipe, so that the worker wakes up
+// immediately when a task exits, instead of at its next periodic check.
+static int wakeup_pipe[2] = {-1, -1};
+static struct link *wakeup_link = NULL;
 
 // Threshold for available memory, and disk space (MB) beyond which clean up and quit.
 static int64_t disk_avail_threshold = 100;
@@ -135,6 +140,19 @@ char *password = 0;
 // Allow worker to use symlinks when link() fails.  Enabled by default.
 static int symlinks_enabled = 1;
 
+// Serve cached files to other workers of the same master, when the master asks for it.
+static int peer_transfers_enabled = 1;
+
+// Port and pid of the process serving cached files to other workers, or 0.
+static int transfer_server_port = 0;
+static pid_t transfer_server_pid = 0;
+
+// Token that other workers must show to fetch from the transfer server, given by the master.
+static char transfer_server_token[WORK_QUEUE_LINE_MAX];
+
+// Maximum time to wait when connecting to the transfer server of another worker.
+static const int peer_connect_timeout = 15;
+
 // Worker id. A unique id for this worker instance.
 static char *worker_id;
 
@@ -180,6 +198,37 @@ static int disk_allocation = 0;
 
 static int64_t files_counted = 0;
 
+// Bytes and entries in the cache directory. They are updated as files enter
+// and leave the cache, so that measuring the disk does not walk the cache.
+static int64_t cache_bytes = 0;
+static int64_t cache_entries = 0;
+
+// Time of the last complete walk of the cache, which corrects the counts above
+// in case something else changed the cache. Zero if the counts are unknown.
+static time_t cache_walk_time = 0;
+static int cache_walk_interval = 600;
+
+// Files and directories at the top of the cache, indexed by the name given by
+// the master, with their size and the last time a task used them.
+struct cache_file {
+	int64_t size;
+	time_t last_access;
+	time_t evict_time;
+};
+
+static struct hash_table *cache_files = NULL;
+
+// Cached files that could not be fetched from another worker, and that the
+// master sends instead.  Tasks that need them wait until they arrive.
+static struct hash_table *peer_files_awaited = NULL;
+
+// When the cache uses more than cache_high_water of the disk not reserved by
+// tasks, the least recently used files are offered back to the master until
+// it would use less than cache_low_water.
+static const double cache_high_water = 0.9;
+static const double cache_low_water = 0.75;
+static const int cache_evict_retry = 60;
+
 static int check_resources_interval = 5;
 static int max_time_on_measurement  = 3;
 
@@ -222,6 +271,12 @@ static char *debug_path = NULL;
 static char *catalog_hosts = NULL;
 static int tlq_port = 0;
 
+// If not NULL, messages to the master are collected here, to be sent in a single write.
+static buffer_t *master_batch = NULL;
+
+// Results are sent in batches of about this size. Larger task outputs are streamed.
+#define RESULTS_BATCH_MAX (1024*1024)
+
 __attribute__ (( format(printf,2,3) ))
 static void send_master_message( struct link *master, const char *fmt, ... )
 {
@@ -235,11 +290,35 @@ static void send_master_message( struct link *master, const char *fmt, ... )
 	va_copy(debug_va, va);
 
 	vdebug(D_WQ, debug_msg, debug_va);
-	link_putvfstring(master, fmt, time(0)+active_timeout, va);
+	if(master_batch) {
+		buffer_putvfstring(master_batch, fmt, va);
+	} else {
+		link_putvfstring(master, fmt, time(0)+active_timeout, va);
+	}
 
 	va_end(va);
 }
 
+/*
+Send the messages collected in master_batch all at once. The master reads
+them as usual.
+*/
+
+static void send_master_batch( struct link *master )
+{
+	size_t length;
+	const char *data = buffer_tolstring(master_batch, &length);
+
+	if(length == 0)
+		return;
+
+	debug(D_WQ, "tx to master: %zu bytes of messages", length);
+
+	link_putlstring(master, data, length, time(0)+active_timeout);
+
+	buffer_rewind(master_batch, 0);
+}
+
 static int recv_master_message( struct link *master, char *line, int length, time_t stoptime )
 {
 	int result = link_readline(master,line,length,stoptime);
@@ -264,34 +343,205 @@ void reset_idle_timer()
 int64_t measure_worker_disk() {
 	static struct path_disk_size_info *state = NULL;
 
-	path_disk_size_info_get_r("./cache", max_time_on_measurement, &state);
+	/* The cache is walked, a few seconds at a time, only when its counts are due for a correction. */
+	if(!cache_walk_time || (state && state->current_dirs) || time(0) - cache_walk_time >= cache_walk_interval) {
+		path_disk_size_info_get_r("./cache", max_time_on_measurement, &state);
 
-	int64_t disk_measured = 0;
-	if(state->last_byte_size_complete >= 0) {
-		disk_measured = (int64_t) ceil(state->last_byte_size_complete/(1.0*MEGA));
+		if(state->complete_measurement) {
+			if(state->last_byte_size_complete >= 0) {
+				if(cache_walk_time && (state->last_byte_size_complete != cache_bytes || state->last_file_count_complete != cache_entries)) {
+					debug(D_WQ, "cache has %" PRId64 " bytes in %" PRId64 " entries, counted %" PRId64 " bytes in %" PRId64 " entries", state->last_byte_size_complete, state->last_file_count_complete, cache_bytes, cache_entries);
+				}
+				cache_bytes = state->last_byte_size_complete;
+				cache_entries = state->last_file_count_complete;
+			}
+			cache_walk_time = time(0);
+		} else if(!cache_walk_time) {
+			/* Until the first walk completes, report at least what has been found so far. */
+			cache_bytes = MAX(cache_bytes, state->last_byte_size_complete);
+			cache_entries = MAX(cache_entries, state->last_file_count_complete);
+		}
 	}
 
-	files_counted = state->last_file_count_complete;
-
-	if(state->complete_measurement) {
-		/* if a complete measurement has been done, then update
-		 * for the found value, and add the known values of the processes. */
+	int64_t disk_measured = (int64_t) ceil(cache_bytes/(1.0*MEGA));
+	files_counted = cache_entries;
 
-		struct work_queue_process *p;
-		uint64_t taskid;
+	/* add the known values of the processes. */
+	struct work_queue_process *p;
+	uint64_t taskid;
 
-		itable_firstkey(procs_table);
-		while(itable_nextkey(procs_table,&taskid,(void**)&p)) {
-			if(p->sandbox_size > 0) {
-				disk_measured += p->sandbox_size;
-				files_counted += p->sandbox_file_count;
-			}
+	itable_firstkey(procs_table);
+	while(itable_nextkey(procs_table,&taskid,(void**)&p)) {
+		if(p->sandbox_size > 0) {
+			disk_measured += p->sandbox_size;
+			files_counted += p->sandbox_file_count;
 		}
 	}
 
 	return disk_measured;
 }
 
+/*
+Add to the cache counts the size of a path in the cache, or subtract it if
+sign is negative. This is called before a path is replaced or removed, and
+after it is created. As in path_disk_size_info, every entry is counted, but
+only regular files add bytes.
+*/
+
+static void cache_account(const char *path, int sign)
+{
+	struct stat info;
+	int64_t bytes = 0;
+	int64_t entries = 1;
+
+	if(lstat(path, &info) < 0)
+		return;
+
+	if(S_ISDIR(info.st_mode)) {
+		if(path_disk_size_info_get(path, &bytes, &entries) < 0 && (bytes < 0 || entries < 0))
+			return;
+	} else if(S_ISREG(info.st_mode)) {
+		bytes = info.st_size;
+	}
+
+	cache_bytes = MAX(0, cache_bytes + sign * bytes);
+	cache_entries = MAX(0, cache_entries + sign * entries);
+}
+
+/*
+Record that a file named by the master entered the cache, or was replaced.
+*/
+
+static void cache_file_insert(const char *cached_name)
+{
+	struct stat info;
+	int64_t bytes = 0;
+	int64_t entries;
+
+	char *path = string_format("cache/%s", cached_name);
+
+	if(lstat(path, &info) == 0) {
+		if(S_ISDIR(info.st_mode)) {
+			path_disk_size_info_get(path, &bytes, &entries);
+		} else if(S_ISREG(info.st_mode)) {
+			bytes = info.st_size;
+		}
+
+		struct cache_file *c = hash_table_lookup(cache_files, cached_name);
+		if(!c) {
+			c = xxcalloc(1, sizeof(*c));
+			hash_table_insert(cache_files, cached_name, c);
+		}
+
+		c->size = MAX(0, bytes);
+		c->last_access = time(0);
+		c->evict_time = 0;
+
+		hash_table_remove(peer_files_awaited, cached_name);
+	}
+
+	free(path);
+}
+
+static void cache_file_remove(const char *cached_name)
+{
+	free(hash_table_remove(cache_files, cached_name));
+}
+
+static void cache_files_clear()
+{
+	char *name;
+	struct cache_file *c;
+
+	hash_table_firstkey(cache_files);
+	while(hash_table_nextkey(cache_files, &name, (void **) &c)) {
+		free(c);
+	}
+	hash_table_clear(cache_files);
+}
+
+/*
+Return the name used by the master for a task file in the cache, or null.
+*/
+
+static const char *cache_file_name(struct work_queue_file *f)
+{
+	if(!string_prefix_is(f->payload, "cache/"))
+		return 0;
+	return f->payload + strlen("cache/");
+}
+
+/*
+If the cache is using too much of the disk, ask the master to remove the least
+recently used files that no task of this worker needs.  The master does so with
+an unlink message, unless a task it already sent needs the file, in which case
+the request is repeated later.  Files are never removed without the master
+knowing, so its list of the files at this worker stays correct.
+*/
+
+static void cache_evict(struct link *master)
+{
+	struct work_queue_process *p;
+	struct work_queue_file *f;
+	struct cache_file *c;
+	uint64_t taskid;
+	char *name;
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+
+	if(worker_mode == WORKER_MODE_FOREMAN)
+		return;
+
+	int64_t available = (local_resources->disk.total - disk_allocated) * MEGA;
+	if(available <= 0 || cache_bytes <= available * cache_high_water)
+		return;
+
+	int64_t excess = cache_bytes - available * cache_low_water;
+	time_t now = time(0);
+
+	struct hash_table *pinned = hash_table_create(0, 0);
+	itable_firstkey(procs_table);
+	while(itable_nextkey(procs_table, &taskid, (void **) &p)) {
+		list_first_item(p->task->input_files);
+		while((f = list_next_item(p->task->input_files))) {
+			if(cache_file_name(f))
+				hash_table_insert(pinned, cache_file_name(f), f);
+		}
+		list_first_item(p->task->output_files);
+		while((f = list_next_item(p->task->output_files))) {
+			if(cache_file_name(f))
+				hash_table_insert(pinned, cache_file_name(f), f);
+		}
+	}
+
+	struct priority_queue *lru = priority_queue_create(hash_table_size(cache_files));
+	hash_table_firstkey(cache_files);
+	while(hash_table_nextkey(cache_files, &name, (void **) &c)) {
+		if(c->evict_time && now < c->evict_time + cache_evict_retry) {
+			/* already offered to the master, and soon to be removed. */
+			excess -= c->size;
+		} else if(!hash_table_lookup(pinned, name)) {
+			priority_queue_push(lru, name, -(double) c->last_access);
+		}
+	}
+
+	int offered = 0;
+	while(excess > 0 && (name = priority_queue_pop(lru))) {
+		c = hash_table_lookup(cache_files, name);
+		url_encode(name, name_encoded, sizeof(name_encoded));
+		send_master_message(master, "info cache-evict %s\n", name_encoded);
+		c->evict_time = now;
+		excess -= c->size;
+		offered++;
+	}
+
+	if(offered > 0) {
+		debug(D_WQ, "cache uses %" PRId64 " MB of %" PRId64 " MB available, asked master to remove %d files", cache_bytes / MEGA, available / MEGA, offered);
+	}
+
+	priority_queue_delete(lru);
+	hash_table_delete(pinned);
+}
+
 /*
 Measure only the resources associated with this particular node
 and apply any operations that override.
@@ -605,8 +855,8 @@ static int start_process( struct work_queue_process *p )
 }
 
 /*
-Transmit the results of the given process to the master.
-If a local worker, stream the output from disk.
+Transmit the results of the given process to the master, through master_batch.
+If a local worker, read the output from disk, or stream it if it is large.
 If a foreman, send the outputs contained in the task structure.
 */
 
@@ -619,8 +869,21 @@ static void report_task_complete( struct link *master, struct work_queue_process
 		fstat(p->output_fd, &st);
 		output_length = st.st_size;
 		lseek(p->output_fd, 0, SEEK_SET);
-		send_master_message(master, "result %d %d %lld %llu %d\n", p->task_status, p->exit_status, (long long) output_length, (unsigned long long) p->execution_end-p->execution_start, p->task->taskid);
-		link_stream_from_fd(master, p->output_fd, output_length, time(0)+active_timeout);
+		if(output_length <= RESULTS_BATCH_MAX) {
+			char *output = xxcalloc(1, output_length + 1);
+			if(full_read(p->output_fd, output, output_length) != output_length) {
+				debug(D_WQ, "couldn't read the output of task %d: %s", p->task->taskid, strerror(errno));
+				p->task_status |= WORK_QUEUE_RESULT_STDOUT_MISSING;
+				output_length = 0;
+			}
+			send_master_message(master, "result %d %d %lld %llu %d\n", p->task_status, p->exit_status, (long long) output_length, (unsigned long long) p->execution_end-p->execution_start, p->task->taskid);
+			buffer_putlstring(master_batch, output, output_length);
+			free(output);
+		} else {
+			send_master_message(master, "result %d %d %lld %llu %d\n", p->task_status, p->exit_status, (long long) output_length, (unsigned long long) p->execution_end-p->execution_start, p->task->taskid);
+			send_master_batch(master);
+			link_stream_from_fd(master, p->output_fd, output_length, time(0)+active_timeout);
+		}
 
 		total_task_execution_time += (p->execution_end - p->execution_start);
 		total_tasks_executed++;
@@ -633,7 +896,7 @@ static void report_task_complete( struct link *master, struct work_queue_process
 		}
 		send_master_message(master, "result %d %d %lld %llu %d\n", t->result, t->return_status, (long long) output_length, (unsigned long long) t->time_workers_execute_last, t->taskid);
 		if(output_length) {
-			link_putlstring(master, t->output, output_length, time(0)+active_timeout);
+			buffer_putlstring(master_batch, t->output, output_length);
 		}
 
 		total_task_execution_time += t->time_workers_execute_last;
@@ -670,14 +933,30 @@ static void report_tasks_complete( struct link *master )
 {
 	struct work_queue_process *p;
 
+	/* Results go to the master in as few writes as possible. */
+	buffer_t batch;
+	buffer_init(&batch);
+	buffer_abortonfailure(&batch, 1);
+	master_batch = &batch;
+
 	while((p=itable_pop(procs_complete))) {
 		report_task_complete(master,p);
+		if(buffer_pos(master_batch) >= RESULTS_BATCH_MAX) {
+			send_master_batch(master);
+		}
 	}
 
+	// The watcher writes to the link directly.
+	send_master_batch(master);
+
 	work_queue_watcher_send_changes(watcher,master,time(0)+active_timeout);
 
 	send_master_message(master, "end\n");
 
+	send_master_batch(master);
+	master_batch = NULL;
+	buffer_free(&batch);
+
 	results_to_be_sent_msg = 0;
 }
 
@@ -759,6 +1038,8 @@ static int handle_tasks(struct link *master)
 
 				debug(D_WQ,"moving output file from %s to %s",sandbox_name,f->payload);
 
+				cache_account(f->payload, -1);
+
 				/* First we try a cheap rename. It that does not work, we try to copy the file. */
 				if(rename(sandbox_name,f->payload) == -1) {
 					debug(D_WQ, "could not rename output file %s to %s: %s",sandbox_name,f->payload,strerror(errno));
@@ -767,6 +1048,10 @@ static int handle_tasks(struct link *master)
 					}
 				}
 
+				cache_account(f->payload, 1);
+				if(cache_file_name(f))
+					cache_file_insert(cache_file_name(f));
+
 				free(sandbox_name);
 			}
 
@@ -885,6 +1170,9 @@ int setup_sandbox( struct work_queue_process *p )
 		char *sandbox_name = string_format("%s/%s",skip_dotslash(p->sandbox),f->remote_name);
 		int result = 0;
 
+		struct cache_file *c = cache_file_name(f) ? hash_table_lookup(cache_files, cache_file_name(f)) : 0;
+		if(c) c->last_access = time(0);
+
 		// remote name may contain relative path components, so create them in advance
 		create_dir_parents(sandbox_name,0777);
 
@@ -1077,6 +1365,7 @@ static int do_put_symlink_internal( struct link *master, char *filename, int len
 		free(target);
 		return 0;
 	}
+	cache_account(filename, 1);
 
 	free(target);
 
@@ -1100,14 +1389,18 @@ static int do_put_file_internal( struct link *master, char *filename, int64_t le
 	/* Ensure that worker can access the file! */
 	mode = mode | 0600;
 
+	cache_account(filename, -1);
+
 	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, mode);
 	if(fd<0) {
 		debug(D_WQ, "Could not open %s for writing. (%s)\n", filename, strerror(errno));
+		cache_account(filename, 1);
 		return 0;
 	}
 
 	int64_t actual = link_stream_to_fd(master, fd, length, time(0) + active_timeout);
 	close(fd);
+	cache_account(filename, 1);
 	if(actual!=length) {
 		debug(D_WQ, "Failed to put file - %s (%s)\n", filename, strerror(errno));
 		return 0;
@@ -1138,6 +1431,7 @@ static int do_put_dir_internal( struct link *master, char *dirname )
 		debug(D_WQ,"unable to create %s: %s",dirname,strerror(errno));
 		return 0;
 	}
+	cache_account(dirname, 1);
 
 	while(1) {
 		if(!recv_master_message(master,line,sizeof(line),time(0)+active_timeout)) return 0;
@@ -1189,6 +1483,8 @@ static int do_put_dir( struct link *master, char *dirname )
 	int result = do_put_dir_internal(master,cachename);
 	free(cachename);
 
+	if(result) cache_file_insert(dirname);
+
 	return result;
 }
 
@@ -1224,6 +1520,8 @@ static int do_put_single_file( struct link *master, char *filename, int64_t leng
 
 	free(cached_filename);
 
+	if(result) cache_file_insert(filename);
+
 	return result;
 }
 
@@ -1251,7 +1549,12 @@ static int do_url(struct link* master, const char *filename, int length, int mod
 		char cache_name[WORK_QUEUE_LINE_MAX];
 		string_nformat(cache_name, sizeof(cache_name), "cache/%s", filename);
 
-		return file_from_url(url, cache_name);
+		cache_account(cache_name, -1);
+		int result = file_from_url(url, cache_name);
+		cache_account(cache_name, 1);
+		if(result) cache_file_insert(filename);
+
+		return result;
 }
 
 static int do_tlq_url(const char *master_tlq_url) {
@@ -1270,7 +1573,9 @@ static int do_unlink(const char *path)
 	}
 
 	//Use delete_dir() since it calls unlink() if path is a file.
+	cache_account(cached_path, -1);
 	if(delete_dir(cached_path) != 0) {
+		cache_account(cached_path, 1);
 		struct stat buf;
 		if(stat(cached_path, &buf) != 0) {
 			if(errno == ENOENT) {
@@ -1281,6 +1586,7 @@ static int do_unlink(const char *path)
 		// Failed to do unlink
 		return 0;
 	}
+	cache_file_remove(path);
 	return 1;
 }
 
@@ -1290,12 +1596,224 @@ static int do_get(struct link *master, const char *filename, int recursive) {
 	return 1;
 }
 
+/*
+Fetch a cached file from the transfer server of another worker, and tell the
+master how it went.  If the transfer failed, the master sends the file itself,
+and tasks that need it wait until it arrives.
+*/
+
+static int do_peerget(struct link *master, const char *filename_encoded, const char *filename, const char *addr, int port, int64_t length, int mode, const char *token)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+	int64_t actual_length;
+	const char *status = "failed";
+	time_t stoptime = time(0) + active_timeout;
+
+	char *cached_filename = string_format("cache/%s", filename);
+	char *tmp_filename = string_format("cache/.%s.peer", filename);
+
+	struct link *peer = link_connect(addr, port, time(0) + peer_connect_timeout);
+	if(!peer) {
+		debug(D_WQ, "could not connect to worker %s:%d: %s", addr, port, strerror(errno));
+		status = "unreachable";
+	} else if((password && !link_auth_password(peer, password, stoptime)) || !link_auth_password(peer, token, stoptime)) {
+		debug(D_WQ, "could not authenticate to worker %s:%d", addr, port);
+	} else {
+		link_putfstring(peer, "get %s\n", stoptime, filename_encoded);
+
+		if(!link_readline(peer, line, sizeof(line), stoptime) || sscanf(line, "file %s %" SCNd64, name, &actual_length) != 2) {
+			debug(D_WQ, "worker %s:%d does not have %s", addr, port, filename);
+		} else if(actual_length != length) {
+			// The other worker may still be receiving the file.
+			debug(D_WQ, "worker %s:%d has %" PRId64 " bytes of %s instead of %" PRId64, addr, port, actual_length, filename, length);
+		} else if(do_put_file_internal(peer, tmp_filename, length, mode) && link_readline(peer, line, sizeof(line), stoptime) && !strcmp(line, "end")) {
+			cache_account(cached_filename, -1);
+			if(rename(tmp_filename, cached_filename) == 0) {
+				status = "ok";
+			} else {
+				cache_account(cached_filename, 1);
+			}
+		}
+	}
+
+	if(peer) {
+		link_close(peer);
+	}
+
+	/* If the transfer succeeded, the file was counted under its temporary name. */
+	cache_account(tmp_filename, -1);
+	unlink(tmp_filename);
+	free(tmp_filename);
+
+	if(!strcmp(status, "ok")) {
+		cache_file_insert(filename);
+	} else {
+		hash_table_insert(peer_files_awaited, filename, (void *) 1);
+	}
+
+	send_master_message(master, "info peer-transfer-done %s %s\n", filename_encoded, status);
+
+	free(cached_filename);
+
+	return 1;
+}
+
+/*
+Return true if the task needs a cached file that the master has yet to send.
+*/
+
+static int task_inputs_awaited(struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+
+	if(hash_table_size(peer_files_awaited) == 0 || !t->input_files)
+		return 0;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		const char *name = cache_file_name(f);
+		if(name && hash_table_lookup(peer_files_awaited, name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+Send one cached file to another worker that asked for it.
+*/
+
+static void serve_peer(struct link *peer)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	char filename[WORK_QUEUE_LINE_MAX];
+	time_t stoptime = time(0) + active_timeout;
+
+	if(password && !link_auth_password(peer, password, stoptime)) {
+		return;
+	}
+
+	if(!link_auth_password(peer, transfer_server_token, stoptime)) {
+		return;
+	}
+
+	if(!link_readline(peer, line, sizeof(line), stoptime) || sscanf(line, "get %s", filename_encoded) != 1) {
+		return;
+	}
+
+	url_decode(filename_encoded, filename, sizeof(filename));
+	if(!is_valid_filename(filename) || !strcmp(filename, ".") || !strcmp(filename, "..")) {
+		return;
+	}
+
+	do_get(peer, filename, 0);
+}
+
+/*
+When the master asks for peer transfers, the worker serves its cache to
+other workers from a child process, so that inputs needed by many tasks
+spread between workers rather than all being sent by the master.  Each
+request is handled in its own process, and the server exits when the
+worker disconnects from the master or goes away.  Only workers that know
+the token the master gave to this worker, and the password if there is
+one, are served.
+*/
+
+static void transfer_server_start(struct link *master)
+{
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+
+	struct link *server = link_serve(LINK_PORT_ANY);
+	if(!server || !link_address_local(server, addr, &port)) {
+		debug(D_WQ, "could not start transfer server: %s", strerror(errno));
+		link_close(server);
+		return;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		link_close(master);
+
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGUSR1, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+		signal(SIGCHLD, SIG_IGN);
+
+		pid_t parent = getppid();
+		while(getppid() == parent) {
+			struct link *peer = link_accept(server, time(0) + 5);
+			if(!peer) continue;
+
+			if(fork() == 0) {
+				link_close(server);
+				serve_peer(peer);
+				link_close(peer);
+				_exit(0);
+			}
+
+			link_close(peer);
+		}
+		_exit(0);
+	} else if(pid < 0) {
+		debug(D_WQ, "could not start transfer server: %s", strerror(errno));
+		link_close(server);
+		return;
+	}
+
+	link_close(server);
+
+	transfer_server_pid = pid;
+	transfer_server_port = port;
+
+	debug(D_WQ, "serving cached files to other workers on port %d", port);
+}
+
+static void transfer_server_stop()
+{
+	if(!transfer_server_pid) return;
+
+	kill(transfer_server_pid, SIGTERM);
+	waitpid(transfer_server_pid, NULL, 0);
+
+	transfer_server_pid = 0;
+	transfer_server_port = 0;
+}
+
+static int do_peer_transfers(struct link *master, const char *token)
+{
+	if(!peer_transfers_enabled || worker_mode != WORKER_MODE_WORKER) {
+		debug(D_WQ, "not serving cached files to other workers");
+		return 1;
+	}
+
+	if(transfer_server_pid && strcmp(token, transfer_server_token)) {
+		transfer_server_stop();
+	}
+
+	if(!transfer_server_pid) {
+		string_nformat(transfer_server_token, sizeof(transfer_server_token), "%s", token);
+		transfer_server_start(master);
+	}
+
+	if(transfer_server_port) {
+		send_master_message(master, "info transfer-port %d\n", transfer_server_port);
+	}
+
+	return 1;
+}
+
 static int do_thirdget(int mode, char *filename, const char *path) {
 	char cmd[WORK_QUEUE_LINE_MAX];
 	char cached_filename[WORK_QUEUE_LINE_MAX];
 	char *cur_pos;
 	char *cmd_tmp;
 	struct stat info;
+	int result = 1;
 
 	if(mode != WORK_QUEUE_FS_CMD) {
 		if(stat(path, &info) != 0) {
@@ -1331,18 +1849,22 @@ static int do_thirdget(int mode, char *filename, const char *path) {
 		return 1;
 	}
 
+	/* A dangling symlink fails stat, but is still counted and about to be replaced. */
+	cache_account(cached_filename, -1);
+
 	switch (mode) {
 	case WORK_QUEUE_FS_SYMLINK:
 		if(symlink(path, cached_filename) != 0) {
 			debug(D_WQ, "Could not thirdget %s, symlink (%s) failed. (%s)\n", filename, path, strerror(errno));
-			return 0;
+			result = 0;
+			break;
 		}
 		/* falls through */
 	case WORK_QUEUE_FS_PATH:
 		string_nformat(cmd, sizeof(cmd), "/bin/cp %s %s", path, cached_filename);
 		if(system(cmd) != 0) {
 			debug(D_WQ, "Could not thirdget %s, copy (%s) failed. (%s)\n", filename, path, strerror(errno));
-			return 0;
+			result = 0;
 		}
 		break;
 	case WORK_QUEUE_FS_CMD:
@@ -1352,11 +1874,13 @@ static int do_thirdget(int mode, char *filename, const char *path) {
 		debug(D_WQ, "Transfering %s via cmd: %s", cached_filename, cmd);
 		if(system(cmd) != 0) {
 			debug(D_WQ, "Could not thirdget %s, command (%s) failed. (%s)\n", filename, cmd, strerror(errno));
-			return 0;
+			result = 0;
 		}
 		break;
 	}
-	return 1;
+	cache_account(cached_filename, 1);
+	if(result) cache_file_insert(cached_filename + strlen("cache/"));
+	return result;
 }
 
 static int do_thirdput(struct link *master, int mode, char *filename, const char *path) {
@@ -1628,9 +2152,11 @@ static int handle_master(struct link *master) {
 	char filename[WORK_QUEUE_LINE_MAX];
 	char master_tlq_url[WORK_QUEUE_LINE_MAX];
 	char path[WORK_QUEUE_LINE_MAX];
+	char token[WORK_QUEUE_LINE_MAX];
+	char addr[LINK_ADDRESS_MAX];
 	int64_t length;
 	int64_t taskid = 0;
-	int mode, r, n;
+	int mode, r, n, port;
 
 	if(recv_master_message(master, line, sizeof(line), idle_stoptime )) {
 		if(sscanf(line,"task %" SCNd64, &taskid)==1) {
@@ -1646,6 +2172,14 @@ static int handle_master(struct link *master) {
 		} else if(sscanf(line, "url %s %" SCNd64 " %o", filename, &length, &mode) == 3) {
 			r = do_url(master, filename, length, mode);
 			reset_idle_timer();
+		} else if(sscanf(line, "peerget %s %s %d %" SCNd64 " %o %s", filename_encoded, addr, &port, &length, &mode, token) == 6) {
+			url_decode(filename_encoded,filename,sizeof(filename));
+			if(is_valid_filename(filename)) {
+				r = do_peerget(master, filename_encoded, filename, addr, port, length, mode, token);
+			} else {
+				r = 0;
+			}
+			reset_idle_timer();
 		} else if(sscanf(line, "tlq %s", master_tlq_url) == 1) {
 			r = do_tlq_url(master_tlq_url);
 			reset_idle_timer();
@@ -1678,6 +2212,8 @@ static int handle_master(struct link *master) {
 			work_queue_broadcast_message(foreman_q, "exit\n");
 			abort_flag = 1;
 			r = 1;
+		} else if(sscanf(line, "peer-transfers %s", token) == 1) {
+			r = do_peer_transfers(master, token);
 		} else if(!strncmp(line, "check", 6)) {
 			r = send_keepalive(master, 0);
 		} else if(!strncmp(line, "auth", 4)) {
@@ -1801,19 +2337,74 @@ static int enforce_worker_promises(struct link *master) {
 	return 1;
 }
 
+static void wakeup_worker()
+{
+	if(wakeup_pipe[1] < 0)
+		return;
+
+	/* If the pipe is full, the worker is going to wake up anyway. */
+	int saved_errno = errno;
+	char c = 0;
+	if(write(wakeup_pipe[1], &c, 1) < 0) {
+	}
+	errno = saved_errno;
+}
+
+static int wakeup_pipe_create()
+{
+	if(pipe(wakeup_pipe) < 0)
+		return 0;
+
+	int i;
+	for(i = 0; i < 2; i++) {
+		fcntl(wakeup_pipe[i], F_SETFL, fcntl(wakeup_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(wakeup_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	wakeup_link = link_attach_to_fd(wakeup_pipe[0]);
+
+	return wakeup_link != NULL;
+}
+
+static void wakeup_pipe_drain()
+{
+	char buf[256];
+	while(read(wakeup_pipe[0], buf, sizeof(buf)) > 0) {
+	}
+}
+
+/*
+Milliseconds until the worker has something to do other than reacting to
+the master or to a task exiting: measuring its resources, or ending a task
+that reached its end time or wall time.
+*/
+
+static int work_for_master_timeout()
+{
+	struct work_queue_process *p;
+	uint64_t pid;
+
+	timestamp_t now = timestamp_get();
+	timestamp_t next = now + check_resources_interval * (timestamp_t) 1000000;
+
+	itable_firstkey(procs_running);
+	while(itable_nextkey(procs_running, &pid, (void**)&p)) {
+		/* Deadlines already past were handled before this wait. */
+		struct rmsummary *r = p->task->resources_requested;
+		if(r->end > 0 && (timestamp_t) r->end > now && (timestamp_t) r->end < next)
+			next = r->end;
+		if(r->wall_time > 0 && p->execution_start + r->wall_time > now && p->execution_start + r->wall_time < next)
+			next = p->execution_start + r->wall_time;
+	}
+
+	return (next - now) / 1000 + 1;
+}
+
 static void work_for_master(struct link *master) {
-	sigset_t mask;
+	struct link_info events[2];
 
 	debug(D_WQ, "working for master at %s:%d.\n", current_master_address->addr, current_master_address->port);
 
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGCHLD);
-	sigaddset(&mask, SIGTERM);
-	sigaddset(&mask, SIGQUIT);
-	sigaddset(&mask, SIGINT);
-	sigaddset(&mask, SIGUSR1);
-	sigaddset(&mask, SIGUSR2);
-
 	reset_idle_timer();
 
 	time_t volatile_stoptime = time(0) + 60;
@@ -1836,26 +2427,26 @@ static void work_for_master(struct link *master) {
 		}
 
 		/*
-		link_usleep will cause the worker to sleep for a time until
-		interrupted by a SIGCHILD signal.  However, the signal could
-		have been delivered while we were outside of the wait function,
-		setting sigchld_received_flag.  In that case, do not block
-		but proceed with the
-
-		There is a still a (very small) race condition in that the
-		signal could be received between the check and link_usleep,
-		hence a maximum wait time of five seconds is enforced.
+		Wait for the master, for a task to exit, or for the next timer.
+		A signal received at any time before the wait leaves a byte in
+		the wakeup pipe, so the wait returns right away.
 		*/
 
-		int wait_msec = 5000;
+		events[0].link = master;
+		events[0].events = LINK_READ;
+		events[1].link = wakeup_link;
+		events[1].events = LINK_READ;
 
-		if(sigchld_received_flag) {
-			wait_msec = 0;
-			sigchld_received_flag = 0;
+		int result = link_poll(events, 2, work_for_master_timeout());
+		if(result < 0 && errno != EINTR) {
+			debug(D_WQ, "error waiting for master or tasks: %s", strerror(errno));
+			break;
 		}
 
-		int master_activity = link_usleep_mask(master, wait_msec*1000, &mask, 1, 0);
-		if(master_activity < 0) break;
+		int master_activity = result > 0 && (events[0].revents & LINK_READ);
+		if(result > 0 && (events[1].revents & LINK_READ)) {
+			wakeup_pipe_drain();
+		}
 
 		int ok = 1;
 		if(master_activity) {
@@ -1868,6 +2459,8 @@ static void work_for_master(struct link *master) {
 
 		measure_worker_resources();
 
+		cache_evict(master);
+
 		if(!enforce_worker_promises(master)) {
 			abort_flag = 1;
 			break;
@@ -1897,6 +2490,8 @@ static void work_for_master(struct link *master) {
 				p = list_pop_head(procs_waiting);
 				if(!p) {
 					break;
+				} else if(task_inputs_awaited(p->task)) {
+					list_push_tail(procs_waiting, p);
 				} else if(task_resources_fit_now(p->task)) {
 					start_process(p);
 					task_event++;
@@ -2082,6 +2677,13 @@ static int workspace_prepare()
 	char *tmp_name = string_format("%s/cache/tmp", workspace);
 	result |= create_dir(tmp_name,0777);
 
+	/* The cache may have been cleaned, so count it again. */
+	cache_bytes = 0;
+	cache_entries = 0;
+	cache_walk_time = 0;
+	cache_files_clear();
+	hash_table_clear(peer_files_awaited);
+
 	setenv("WORKER_TMPDIR", tmp_name, 1);
 	free(tmp_name);
 
@@ -2117,6 +2719,13 @@ static void workspace_delete()
 	if(procs_complete)     itable_delete(procs_complete);
 	if(procs_waiting)      list_delete(procs_waiting);
 
+	if(cache_files) {
+		cache_files_clear();
+		hash_table_delete(cache_files);
+	}
+
+	if(peer_files_awaited) hash_table_delete(peer_files_awaited);
+
 	if(watcher)            work_queue_watcher_delete(watcher);
 
 	printf( "work_queue_worker: deleting workspace %s\n", workspace);
@@ -2203,6 +2812,7 @@ static int serve_master_by_hostport( const char *host, int port, const char *ver
 	last_task_received     = 0;
 	results_to_be_sent_msg = 0;
 
+	transfer_server_stop();
 	workspace_cleanup();
 	disconnect_master(master);
 	printf("disconnected from master %s:%d\n", host, port );
@@ -2356,11 +2966,12 @@ static void handle_abort(int sig)
 {
 	abort_flag = 1;
 	abort_signal_received = sig;
+	wakeup_worker();
 }
 
 static void handle_sigchld(int sig)
 {
-	sigchld_received_flag = 1;
+	wakeup_worker();
 }
 
 static void read_resources_env_var(const char *name, int64_t *manual_option) {
@@ -2468,6 +3079,7 @@ static void show_help(const char *cmd)
 	printf( " %-30s Specifies a user-defined feature the worker provides. May be specified several times.\n", "--feature");
 	printf( " %-30s Set the maximum number of seconds the worker may be active. (in s).\n", "--wall-time=<s>");
 	printf( " %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
+	printf( " %-30s Do not send cached files to other workers.\n", "--disable-peer-transfers");
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf(" %-30s docker mode -- run each task with a container based on this docker image.\n", "--docker=<image>");
 	printf(" %-30s docker-preserve mode -- tasks execute by a worker share a container based on this docker image.\n", "--docker-preserve=<image>");
@@ -2481,7 +3093,7 @@ enum {LONG_OPT_DEBUG_FILESIZE = 256, LONG_OPT_VOLATILITY, LONG_OPT_BANDWIDTH,
 	  LONG_OPT_DISK, LONG_OPT_GPUS, LONG_OPT_FOREMAN, LONG_OPT_FOREMAN_PORT, LONG_OPT_DISABLE_SYMLINKS,
 	  LONG_OPT_IDLE_TIMEOUT, LONG_OPT_CONNECT_TIMEOUT, LONG_OPT_RUN_DOCKER, LONG_OPT_RUN_DOCKER_PRESERVE,
 	  LONG_OPT_BUILD_FROM_TAR, LONG_OPT_SINGLE_SHOT, LONG_OPT_WALL_TIME, LONG_OPT_DISK_ALLOCATION,
-	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_TLQ};
+	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_TLQ, LONG_OPT_DISABLE_PEER_TRANSFERS};
 
 static const struct option long_options[] = {
 	{"advertise",           no_argument,        0,  'a'},
@@ -2527,6 +3139,7 @@ static const struct option long_options[] = {
 	{"docker-tar",          required_argument,  0,  LONG_OPT_BUILD_FROM_TAR},
 	{"feature",             required_argument,  0,  LONG_OPT_FEATURE},
 	{"tlq",					required_argument,	0,  LONG_OPT_TLQ},
+	{"disable-peer-transfers", no_argument,     0,  LONG_OPT_DISABLE_PEER_TRANSFERS},
 	{0,0,0,0}
 };
 
@@ -2719,6 +3332,9 @@ int main(int argc, char *argv[])
 		case LONG_OPT_DISABLE_SYMLINKS:
 			symlinks_enabled = 0;
 			break;
+		case LONG_OPT_DISABLE_PEER_TRANSFERS:
+			peer_transfers_enabled = 0;
+			break;
 		case LONG_OPT_SINGLE_SHOT:
 			single_shot_mode = 1;
 			break;
@@ -2828,6 +3444,11 @@ int main(int argc, char *argv[])
 	//terminates this process with SIGKILL.
 	signal(SIGUSR1, handle_abort);
 	signal(SIGUSR2, handle_abort);
+	if(!wakeup_pipe_create()) {
+		fprintf(stderr, "work_queue_worker: could not create wakeup pipe: %s\n", strerror(errno));
+		exit(1);
+	}
+
 	signal(SIGCHLD, handle_sigchld);
 
 	random_init();
@@ -2927,6 +3548,9 @@ int main(int argc, char *argv[])
 	procs_waiting  = list_create();
 	procs_complete = itable_create(0);
 
+	cache_files    = hash_table_create(0, 0);
+	peer_files_awaited = hash_table_create(0, 0);
+
 	watcher = work_queue_watcher_create();
 
 	if(!check_disk_space_for_filesize(".", 0, disk_avail_threshold)) {
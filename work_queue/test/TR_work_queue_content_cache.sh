@@ -0,0 +1,122 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+exe="work_queue_content_cache.test"
+
+prepare()
+{
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz <<EOF
+#include "work_queue.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHECK(expr) if(!(expr)) { fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #expr); exit(1); }
+
+static void write_input(const char *text)
+{
+	FILE *file = fopen("content.input", "w");
+	CHECK(file);
+	fputs(text, file);
+	fclose(file);
+}
+
+/* Run a task that copies the cached input, and return what it read. */
+static const char *run_task(struct work_queue *q)
+{
+	static char output[64];
+
+	struct work_queue_task *t = work_queue_task_create("cat input");
+	work_queue_task_specify_file(t, "content.input", "input", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_submit(q, t);
+
+	t = work_queue_wait(q, 60);
+	CHECK(t);
+	CHECK(t->result == WORK_QUEUE_RESULT_SUCCESS);
+	snprintf(output, sizeof(output), "%s", t->output ? t->output : "");
+	work_queue_task_delete(t);
+
+	return output;
+}
+
+int main(int argc, char *argv[])
+{
+	struct work_queue *q = work_queue_create(0);
+	CHECK(q);
+	work_queue_tune(q, "cache-by-content", 1);
+
+	FILE *file = fopen("master.port", "w");
+	CHECK(file);
+	fprintf(file, "%d\n", work_queue_port(q));
+	fclose(file);
+
+	/* A file rewritten with the same size within the same second. */
+	write_input("aaaa");
+	CHECK(!strcmp(run_task(q), "aaaa"));
+	write_input("bbbb");
+	CHECK(!strcmp(run_task(q), "bbbb"));
+
+	/* An old file rewritten with the same size, and its mtime put back. */
+	struct timespec times[2];
+	times[0].tv_sec = times[1].tv_sec = time(0) - 3600;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+
+	write_input("cccc");
+	CHECK(!utimensat(AT_FDCWD, "content.input", times, 0));
+	CHECK(!strcmp(run_task(q), "cccc"));
+	sleep(2);
+	CHECK(!strcmp(run_task(q), "cccc"));
+
+	write_input("dddd");
+	CHECK(!utimensat(AT_FDCWD, "content.input", times, 0));
+	CHECK(!strcmp(run_task(q), "dddd"));
+
+	work_queue_delete(q);
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	rm -f master.port
+	./"$exe" &
+	pid=$!
+
+	wait_for_file_creation master.port 5 || return 1
+
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 20 --cores 1 --memory-threshold 10 --memory 50 &
+	worker=$!
+
+	wait $pid
+	result=$?
+
+	kill $worker
+	wait $worker
+
+	if [ $result -ne 0 ]
+	then
+		echo "worker log:"
+		cat worker.log
+	fi
+
+	return $result
+}
+
+clean()
+{
+	rm -f "$exe" master.port worker.log content.input
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: